@@ -0,0 +1,923 @@
+// Copyright (c) 2026 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+/**
+* @brief  Micro and macro benchmarks of the PmLogLib hot paths.
+*
+* Every case is run with the level enabled and disabled, for each of
+* the requested thread counts, in one or more processes.  Records are
+* sent to a local datagram socket served by a forked stand-in for
+* syslogd, so the numbers don't depend on the system logger.
+*
+* Results are written to stdout as one JSON object per line:
+*
+*   {"bench":"PmLogMsg","path":"enabled","mode":"sync","threads":1,
+*    "procs":1,"ops":200000,"ns_per_op":512.3,"ops_per_sec":1951923,
+*    "syscalls_per_op":1.00,"mallocs_per_op":0.00}
+*
+* ns_per_op is the mean time of one call on one thread.  syscalls_per_op
+* is counted on a separate single-threaded run under ptrace, on the
+* calling thread only; it is null if ptrace is not permitted.
+* mallocs_per_op counts malloc(), calloc() and realloc() calls of the
+* calling thread after a warm-up; it is null without glibc.
+*
+* @file pmlog-bench.c
+* <hr>
+**/
+
+// get GNU extensions (ptrace options, mkdtemp)
+#define _GNU_SOURCE
+
+#include "PmLogLib.h"
+#include "PmLogLibPrv.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+
+#define BENCH_CONTEXT       "pmlog-bench"
+#define MAX_THREADS         64
+
+// C++ cases, see stream.cpp
+extern void BenchStreamSetup(void);
+extern void BenchStreamOp(void);
+
+static PmLogContext gContext;
+
+
+/***********************************************************************
+ * Cases
+ ***********************************************************************/
+typedef struct
+{
+    const char  *name;
+    bool        hasDisabledPath;
+    void        (*op)(void);
+}
+BenchCase;
+
+static void OpPmLogMsg(void)
+{
+    PmLogInfo(gContext, "BENCH_MSG", 2,
+              PMLOGKS("NAME", "pmlog-bench"),
+              PMLOGKFV("VALUE", "%d", 42),
+              "free text %d", 7);
+}
+
+static void OpPmLogString(void)
+{
+    PmLogString(gContext, kPmLogLevel_Info, "BENCH_STRING",
+                "{\"NAME\":\"pmlog-bench\",\"VALUE\":42}", "free text");
+}
+
+// the legacy API is deprecated, but still used and worth measuring
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+static void OpPmLogPrint(void)
+{
+    PmLogPrintInfo(gContext, "legacy text %d %s", 42, "pmlog-bench");
+}
+#pragma GCC diagnostic pop
+
+static void OpPmLogDumpData(void)
+{
+    static const uint8_t data[ 64 ] = { 0x50, 0x6d, 0x4c, 0x6f, 0x67 };
+
+    PmLogDumpDataInfo(gContext, data, sizeof(data), kPmLogDumpFormatDefault);
+}
+
+static void OpPmLogGetContext(void)
+{
+    PmLogContext context;
+
+    PmLogGetContext(BENCH_CONTEXT, &context);
+}
+
+static const BenchCase kCases[] =
+{
+    { "PmLogMsg",        true,  OpPmLogMsg },
+    { "PmLogString_",    true,  OpPmLogString },
+    { "PmLogPrint_",     true,  OpPmLogPrint },
+    { "PmLogDumpData_",  true,  OpPmLogDumpData },
+    { "PmLogGetContext", false, OpPmLogGetContext },
+    { "Stream",          true,  BenchStreamOp },
+};
+
+
+/***********************************************************************
+ * Settings
+ ***********************************************************************/
+static struct
+{
+    long        ops;            /* per thread */
+    long        syscallOps;
+    int         threads[ 8 ];
+    int         numThreads;
+    int         procs;
+    bool        async;
+    bool        deferred;
+    bool        ring;
+    const char  *filter;
+    char        socketPath[ sizeof(((struct sockaddr_un*) NULL)->sun_path) ];
+}
+gSettings =
+{
+    .ops = 200000,
+    .syscallOps = 2000,
+    .threads = { 1, 4 },
+    .numThreads = 2,
+    .procs = 1,
+};
+
+
+static uint64_t NowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+
+/***********************************************************************
+ * syslogd stand-in
+ *
+ * A child process bound to the socket, receiving and dropping records.
+ ***********************************************************************/
+static pid_t StartReceiver(void)
+{
+    struct sockaddr_un  addr;
+    char                buffer[ 4096 ];
+    int                 fd;
+    int                 size = 4 << 20;
+    pid_t               pid;
+
+    fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        perror("socket");
+        exit(1);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, gSettings.socketPath);
+
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1)
+    {
+        perror("bind");
+        exit(1);
+    }
+
+    (void) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    pid = fork();
+    if (pid == 0)
+    {
+        for (;;)
+        {
+            (void) recv(fd, buffer, sizeof(buffer), 0);
+        }
+    }
+
+    close(fd);
+    return pid;
+}
+
+
+/***********************************************************************
+ * Timed runs
+ ***********************************************************************/
+typedef struct
+{
+    const BenchCase     *benchCase;
+    pthread_barrier_t   *barrier;
+    uint64_t            elapsedNs;
+}
+ThreadArg;
+
+static void* BenchThread(void *arg)
+{
+    ThreadArg   *threadArg = arg;
+    void        (*op)(void) = threadArg->benchCase->op;
+    uint64_t    start;
+    long        i;
+
+    pthread_barrier_wait(threadArg->barrier);
+
+    start = NowNs();
+    for (i = 0; i < gSettings.ops; i++)
+    {
+        op();
+    }
+    threadArg->elapsedNs = NowNs() - start;
+
+    return NULL;
+}
+
+
+/**
+ * Runs the case on the given number of threads of this process.
+ * Returns the sum of the threads' run times, and the wall time in
+ * *wallNsP.
+ */
+static uint64_t RunThreads(const BenchCase *benchCase, int threads,
+    uint64_t *wallNsP)
+{
+    pthread_t           tids[ MAX_THREADS ];
+    ThreadArg           args[ MAX_THREADS ];
+    pthread_barrier_t   barrier;
+    uint64_t            total = 0;
+    uint64_t            start;
+    int                 i;
+
+    pthread_barrier_init(&barrier, NULL, threads);
+
+    start = NowNs();
+    for (i = 0; i < threads; i++)
+    {
+        args[ i ].benchCase = benchCase;
+        args[ i ].barrier = &barrier;
+        pthread_create(&tids[ i ], NULL, BenchThread, &args[ i ]);
+    }
+
+    for (i = 0; i < threads; i++)
+    {
+        pthread_join(tids[ i ], NULL);
+        total += args[ i ].elapsedNs;
+    }
+    *wallNsP = NowNs() - start;
+
+    pthread_barrier_destroy(&barrier);
+
+    return total;
+}
+
+
+/**
+ * Runs the case in gSettings.procs processes at once.  The children
+ * start together when the parent closes the start pipe, and report
+ * their times back through the result pipe.
+ */
+static uint64_t RunProcesses(const BenchCase *benchCase, int threads,
+    uint64_t *wallNsP)
+{
+    int         startPipe[ 2 ];
+    int         resultPipe[ 2 ];
+    uint64_t    times[ 2 ];
+    uint64_t    total = 0;
+    uint64_t    start;
+    char        c;
+    int         i;
+
+    if ((pipe(startPipe) == -1) || (pipe(resultPipe) == -1))
+    {
+        perror("pipe");
+        exit(1);
+    }
+
+    for (i = 0; i < gSettings.procs; i++)
+    {
+        if (fork() == 0)
+        {
+            close(startPipe[ 1 ]);
+            (void) read(startPipe[ 0 ], &c, 1);
+
+            times[ 0 ] = RunThreads(benchCase, threads, &times[ 1 ]);
+            (void) write(resultPipe[ 1 ], times, sizeof(times));
+
+            if (gSettings.async)
+            {
+                PmLogSetAsyncLogging(false);
+            }
+            _exit(0);
+        }
+    }
+
+    close(resultPipe[ 1 ]);
+
+    start = NowNs();
+    close(startPipe[ 1 ]);
+    close(startPipe[ 0 ]);
+
+    for (i = 0; i < gSettings.procs; i++)
+    {
+        if (read(resultPipe[ 0 ], times, sizeof(times)) == sizeof(times))
+        {
+            total += times[ 0 ];
+        }
+        (void) wait(NULL);
+    }
+    *wallNsP = NowNs() - start;
+
+    close(resultPipe[ 0 ]);
+
+    return total;
+}
+
+
+/***********************************************************************
+ * Syscall counting
+ *
+ * The case is run in a child traced with PTRACE_SYSCALL.  The child
+ * marks the start and the end of the measured loop with a getppid()
+ * call, which the library never makes, and the parent counts the
+ * syscall entries between the two marks.
+ ***********************************************************************/
+static double CountSyscalls(const BenchCase *benchCase)
+{
+    long    count = -1;
+    long    marks = 0;
+    bool    entry = true;
+    long    nr;
+    long    i;
+    int     status;
+    pid_t   pid;
+
+    pid = fork();
+    if (pid == 0)
+    {
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) == -1)
+        {
+            _exit(2);
+        }
+        raise(SIGSTOP);
+
+        // warm up, so one-time initialization isn't counted
+        benchCase->op();
+
+        syscall(SYS_getppid);
+        for (i = 0; i < gSettings.syscallOps; i++)
+        {
+            benchCase->op();
+        }
+        syscall(SYS_getppid);
+
+        _exit(0);
+    }
+
+    if ((waitpid(pid, &status, 0) == -1) || !WIFSTOPPED(status))
+    {
+        // the child could not be traced
+        return -1;
+    }
+
+    (void) ptrace(PTRACE_SETOPTIONS, pid, NULL,
+                  (void*) (PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL));
+
+    for (;;)
+    {
+        if (ptrace(PTRACE_SYSCALL, pid, NULL, NULL) == -1)
+        {
+            break;
+        }
+        if ((waitpid(pid, &status, 0) == -1) || !WIFSTOPPED(status))
+        {
+            break;
+        }
+        if (WSTOPSIG(status) != (SIGTRAP | 0x80))
+        {
+            continue;
+        }
+
+        // syscall stops alternate between entry and exit
+        if (entry)
+        {
+#if defined(__x86_64__)
+            nr = ptrace(PTRACE_PEEKUSER, pid, sizeof(long) * 15 /* ORIG_RAX */, NULL);
+#elif defined(__i386__)
+            nr = ptrace(PTRACE_PEEKUSER, pid, sizeof(long) * 11 /* ORIG_EAX */, NULL);
+#else
+            nr = -1;
+#endif
+            if (nr == SYS_getppid)
+            {
+                marks++;
+                if (marks == 1)
+                {
+                    count = 0;
+                }
+                else
+                {
+                    kill(pid, SIGKILL);
+                }
+            }
+            else if (marks == 1)
+            {
+                count++;
+            }
+        }
+        entry = !entry;
+    }
+
+    (void) waitpid(pid, &status, 0);
+
+    if ((marks < 2) || (count < 0))
+    {
+        return -1;
+    }
+
+    return (double) count / gSettings.syscallOps;
+}
+
+
+/***********************************************************************
+ * Allocation counting
+ *
+ * With glibc, malloc(), calloc() and realloc() are interposed by the
+ * executable and count the calls of the current thread before going
+ * to the glibc allocator.
+ ***********************************************************************/
+#if defined(__GLIBC__)
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static __thread long tAllocs;
+
+void *malloc(size_t size)
+{
+    tAllocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    tAllocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    tAllocs++;
+    return __libc_realloc(ptr, size);
+}
+
+static double CountAllocs(const BenchCase *benchCase)
+{
+    long    i;
+
+    // warm up, so one-time initialization isn't counted
+    for (i = 0; i < 16; i++)
+    {
+        benchCase->op();
+    }
+
+    tAllocs = 0;
+    for (i = 0; i < gSettings.syscallOps; i++)
+    {
+        benchCase->op();
+    }
+
+    return (double) tAllocs / gSettings.syscallOps;
+}
+
+#else
+
+static double CountAllocs(const BenchCase *benchCase)
+{
+    (void) benchCase;
+    return -1;
+}
+
+#endif
+
+
+/***********************************************************************
+ * Ring check
+ *
+ * Not a benchmark: checks the shared memory ring transport end to end
+ * with this process as the reader.  A child writes RING_RECORDS records
+ * into its ring, then a malformed entry, which the reader must reject
+ * instead of using.  Another child registers itself as the reader and
+ * exits, after which new processes must not create rings any more.
+ ***********************************************************************/
+#define RING_RECORDS        100
+
+/**
+ * Forks a child that reports on 'ready' once it runs, waits for a byte
+ * on 'go', logs the records and the bad entry, and exits.
+ */
+static pid_t StartRingWriter(int ready[ 2 ], int go[ 2 ])
+{
+    pid_t   pid;
+    char    c = 0;
+    int     i;
+
+    pid = fork();
+    if (pid == 0)
+    {
+        (void) write(ready[ 1 ], &c, 1);
+        if (read(go[ 0 ], &c, 1) != 1)
+        {
+            _exit(1);
+        }
+
+        for (i = 0; i < RING_RECORDS; i++)
+        {
+            PmLogInfo(gContext, "BENCH_RING", 1, PMLOGKFV("SEQ", "%d", i), "");
+        }
+        (void) PmLogPrvTest("RingBadEntry", NULL);
+
+        _exit(0);
+    }
+
+    (void) read(ready[ 0 ], &c, 1);
+    return pid;
+}
+
+static bool CheckRingRecords(PmLogRing *ring)
+{
+    PmLogRingRecord record;
+    PmLogErr        err = kPmLogErr_NoData;
+    char            seq[ 32 ];
+    int             records = 0;
+    int             waits = 0;
+
+    while (waits < 50)
+    {
+        err = PmLogPrvRingRead(ring, &record);
+        if (err == kPmLogErr_InvalidData)
+        {
+            break;
+        }
+
+        if (err != kPmLogErr_None)
+        {
+            (void) PmLogPrvRingWait(ring, 100);
+            waits++;
+            continue;
+        }
+
+        snprintf(seq, sizeof(seq), "{\"SEQ\":%d}", records);
+        if ((records == RING_RECORDS) || (strstr(record.text, seq) == NULL) ||
+            (strlen(record.text) != record.len))
+        {
+            fprintf(stderr, "ring: unexpected record %d: %s\n", records, record.text);
+            return false;
+        }
+        records++;
+        waits = 0;
+    }
+
+    if (err != kPmLogErr_InvalidData)
+    {
+        fprintf(stderr, "ring: the bad entry was not rejected\n");
+        return false;
+    }
+
+    if (records != RING_RECORDS)
+    {
+        fprintf(stderr, "ring: %d records read instead of %d\n", records, RING_RECORDS);
+        return false;
+    }
+
+    if (PmLogPrvRingWait(ring, 0) != kPmLogErr_InvalidData)
+    {
+        fprintf(stderr, "ring: still mapped after the bad entry\n");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Returns 0 if the check passes, 77 if it can't run here (no shared
+ * memory), 1 if it fails.
+ */
+static int CheckRing(void)
+{
+    PmLogRing   *ring;
+    PmLogErr    err;
+    char        path[ 64 ];
+    int         ready[ 2 ];
+    int         go[ 2 ];
+    bool        passed;
+    pid_t       pid;
+
+    if (PmLogPrvRingSetConsumer(true) != kPmLogErr_None)
+    {
+        fprintf(stderr, "ring: no shared memory, skipped\n");
+        return 77;
+    }
+
+    if ((pipe(ready) == -1) || (pipe(go) == -1))
+    {
+        perror("pipe");
+        return 1;
+    }
+
+    pid = StartRingWriter(ready, go);
+
+    err = PmLogPrvRingOpen(pid, &ring);
+    if (err != kPmLogErr_None)
+    {
+        fprintf(stderr, "ring: cannot open the ring of %d: %s\n", (int) pid,
+                PmLogGetErrDbgString(err));
+        kill(pid, SIGKILL);
+        (void) waitpid(pid, NULL, 0);
+        return 1;
+    }
+
+    (void) write(go[ 1 ], "g", 1);
+    passed = CheckRingRecords(ring);
+
+    (void) waitpid(pid, NULL, 0);
+    PmLogPrvRingClose(ring);
+
+    snprintf(path, sizeof(path), "%s%d", PMLOG_RING_PATH_PREFIX, (int) pid);
+    if (passed && (access(path, F_OK) == 0))
+    {
+        fprintf(stderr, "ring: %s not removed\n", path);
+        passed = false;
+    }
+
+    // a reader that has exited must not make new processes create rings
+    pid = fork();
+    if (pid == 0)
+    {
+        (void) PmLogPrvRingSetConsumer(true);
+        _exit(0);
+    }
+    (void) waitpid(pid, NULL, 0);
+
+    // that child has a ring too, closing it removes it
+    if (PmLogPrvRingOpen(pid, &ring) == kPmLogErr_None)
+    {
+        PmLogPrvRingClose(ring);
+    }
+
+    pid = StartRingWriter(ready, go);
+    err = PmLogPrvRingOpen(pid, &ring);
+    if (err != kPmLogErr_NoData)
+    {
+        fprintf(stderr, "ring: ring created for an exited reader\n");
+        PmLogPrvRingClose(ring);
+        passed = false;
+    }
+    kill(pid, SIGKILL);
+    (void) waitpid(pid, NULL, 0);
+
+    (void) PmLogPrvRingSetConsumer(false);
+
+    close(ready[ 0 ]);
+    close(ready[ 1 ]);
+    close(go[ 0 ]);
+    close(go[ 1 ]);
+
+    printf("{\"check\":\"ring\",\"result\":\"%s\"}\n", passed ? "pass" : "fail");
+    return passed ? 0 : 1;
+}
+
+
+/***********************************************************************
+ * Driver
+ ***********************************************************************/
+static void SetLevel(bool enabled)
+{
+    PmLogSetContextLevel(gContext, enabled ? kPmLogLevel_Info : kPmLogLevel_Error);
+}
+
+static void Report(const BenchCase *benchCase, bool enabled, int threads,
+    uint64_t totalNs, uint64_t wallNs, double syscalls, double allocs)
+{
+    long    ops = gSettings.ops * threads * gSettings.procs;
+
+    printf("{\"bench\":\"%s\",\"path\":\"%s\",\"mode\":\"%s\","
+           "\"threads\":%d,\"procs\":%d,\"ops\":%ld,"
+           "\"ns_per_op\":%.1f,\"ops_per_sec\":%.0f,",
+           benchCase->name, enabled ? "enabled" : "disabled",
+           gSettings.deferred ? "deferred" : gSettings.async ? "async" : "sync",
+           threads, gSettings.procs, ops,
+           (double) totalNs / ops, ops * 1e9 / wallNs);
+
+    if (syscalls < 0)
+    {
+        printf("\"syscalls_per_op\":null,");
+    }
+    else
+    {
+        printf("\"syscalls_per_op\":%.2f,", syscalls);
+    }
+
+    if (allocs < 0)
+    {
+        printf("\"mallocs_per_op\":null}\n");
+    }
+    else
+    {
+        printf("\"mallocs_per_op\":%.2f}\n", allocs);
+    }
+    fflush(stdout);
+}
+
+static void RunCase(const BenchCase *benchCase, bool enabled)
+{
+    uint64_t    totalNs;
+    uint64_t    wallNs;
+    double      syscalls;
+    double      allocs;
+    int         i;
+
+    SetLevel(enabled);
+
+    syscalls = CountSyscalls(benchCase);
+    allocs = CountAllocs(benchCase);
+
+    for (i = 0; i < gSettings.numThreads; i++)
+    {
+        if (gSettings.procs > 1)
+        {
+            totalNs = RunProcesses(benchCase, gSettings.threads[ i ], &wallNs);
+        }
+        else
+        {
+            totalNs = RunThreads(benchCase, gSettings.threads[ i ], &wallNs);
+        }
+
+        Report(benchCase, enabled, gSettings.threads[ i ], totalNs, wallNs,
+               syscalls, allocs);
+    }
+}
+
+static void RunCases(void)
+{
+    size_t  i;
+
+    if (gSettings.async)
+    {
+        PmLogSetAsyncLogging(true);
+        PmLogSetDeferredFormatting(gSettings.deferred);
+    }
+
+    for (i = 0; i < sizeof(kCases) / sizeof(kCases[ 0 ]); i++)
+    {
+        if ((gSettings.filter != NULL) && (strstr(kCases[ i ].name, gSettings.filter) == NULL))
+        {
+            continue;
+        }
+
+        RunCase(&kCases[ i ], true);
+        if (kCases[ i ].hasDisabledPath)
+        {
+            RunCase(&kCases[ i ], false);
+        }
+    }
+
+    if (gSettings.async)
+    {
+        PmLogSetAsyncLogging(false);
+    }
+}
+
+static void Usage(const char *argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -n, --ops N           calls per thread (default %ld)\n"
+            "  -s, --syscall-ops N   calls in the traced run (default %ld)\n"
+            "  -t, --threads LIST    comma separated thread counts (default 1,4)\n"
+            "  -p, --procs N         processes running at once (default 1)\n"
+            "  -a, --async           enable asynchronous logging\n"
+            "  -d, --deferred        enable asynchronous logging and deferred formatting\n"
+            "  -f, --filter NAME     only run the cases whose name contains NAME\n"
+            "  -r, --ring            check the shared memory ring transport, then exit\n",
+            argv0, gSettings.ops, gSettings.syscallOps);
+}
+
+static bool ParseThreads(char *list)
+{
+    char    *s;
+    int     n;
+
+    gSettings.numThreads = 0;
+    for (s = strtok(list, ","); s != NULL; s = strtok(NULL, ","))
+    {
+        n = atoi(s);
+        if ((n < 1) || (n > MAX_THREADS) ||
+            (gSettings.numThreads == sizeof(gSettings.threads) / sizeof(gSettings.threads[ 0 ])))
+        {
+            return false;
+        }
+        gSettings.threads[ gSettings.numThreads++ ] = n;
+    }
+
+    return gSettings.numThreads > 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option kOptions[] =
+    {
+        { "ops",         required_argument, NULL, 'n' },
+        { "syscall-ops", required_argument, NULL, 's' },
+        { "threads",     required_argument, NULL, 't' },
+        { "procs",       required_argument, NULL, 'p' },
+        { "async",       no_argument,       NULL, 'a' },
+        { "deferred",    no_argument,       NULL, 'd' },
+        { "filter",      required_argument, NULL, 'f' },
+        { "ring",        no_argument,       NULL, 'r' },
+        { "help",        no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    char    dir[] = "/tmp/pmlog-bench.XXXXXX";
+    pid_t   receiver;
+    int     c;
+
+    while ((c = getopt_long(argc, argv, "n:s:t:p:adf:rh", kOptions, NULL)) != -1)
+    {
+        switch (c)
+        {
+            case 'n': gSettings.ops = atol(optarg); break;
+            case 's': gSettings.syscallOps = atol(optarg); break;
+            case 'p': gSettings.procs = atoi(optarg); break;
+            case 'a': gSettings.async = true; break;
+            case 'd': gSettings.async = gSettings.deferred = true; break;
+            case 'f': gSettings.filter = optarg; break;
+            case 'r': gSettings.ring = true; break;
+
+            case 't':
+                if (!ParseThreads(optarg))
+                {
+                    Usage(argv[ 0 ]);
+                    return 1;
+                }
+                break;
+
+            default:
+                Usage(argv[ 0 ]);
+                return (c == 'h') ? 0 : 1;
+        }
+    }
+
+    if ((gSettings.ops < 1) || (gSettings.syscallOps < 1) || (gSettings.procs < 1))
+    {
+        Usage(argv[ 0 ]);
+        return 1;
+    }
+
+    PmLogGetContext(BENCH_CONTEXT, &gContext);
+
+    // the records don't go to syslogd, no receiver is needed
+    if (gSettings.ring)
+    {
+        SetLevel(true);
+        return CheckRing();
+    }
+
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(gSettings.socketPath, sizeof(gSettings.socketPath), "%s/log", dir);
+
+    receiver = StartReceiver();
+
+    if (PmLogPrvTest("SetSyslogPath", gSettings.socketPath) != kPmLogErr_None)
+    {
+        fprintf(stderr, "cannot redirect the records to %s\n", gSettings.socketPath);
+        return 1;
+    }
+
+    BenchStreamSetup();
+
+    RunCases();
+
+    kill(receiver, SIGKILL);
+    (void) waitpid(receiver, NULL, 0);
+
+    unlink(gSettings.socketPath);
+    rmdir(dir);
+
+    return 0;
+}
@@ -0,0 +1,39 @@
+// Copyright (c) 2026 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+// The pmlog::PmLog::Stream case of pmlog-bench
+
+#include "PmLog.h"
+
+#include <utility>
+
+static pmlog::PmLog *gLog;
+
+extern "C" void BenchStreamSetup(void)
+{
+    // shares the "pmlog-bench" context with the C cases
+    static pmlog::PmLog log("pmlog-bench");
+
+    gLog = &log;
+}
+
+extern "C" void BenchStreamOp(void)
+{
+    gLog->info("BENCH_STREAM")
+        << std::make_pair("NAME", "pmlog-bench")
+        << std::make_pair("VALUE", 42)
+        << "free text";
+}
@@ -17,6 +17,10 @@
 #include "PmLog.h"
 #include <utility>
 #include <string>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <locale.h>
 
 namespace pmlog
 {
@@ -28,47 +32,52 @@ PmLog::PmLog(const std::string& ctxName)
 
 PmLog::Stream PmLog::critical(const std::string& msgId)
 {
-#if defined(PMLOGLIB_ENABLE_LOGGING)
     return Stream(context_, msgId, kPmLogLevel_Critical);
-#else
-    return DummyStream();
-#endif
+}
+
+PmLog::Stream PmLog::critical(const char* msgId)
+{
+    return Stream(context_, msgId, kPmLogLevel_Critical);
 }
 
 PmLog::Stream PmLog::error(const std::string& msgId)
 {
-#if defined(PMLOGLIB_ENABLE_LOGGING)
     return Stream(context_, msgId, kPmLogLevel_Error);
-#else
-    return DummyStream();
-#endif
+}
+
+PmLog::Stream PmLog::error(const char* msgId)
+{
+    return Stream(context_, msgId, kPmLogLevel_Error);
 }
 
 PmLog::Stream PmLog::warning(const std::string& msgId)
 {
-#if defined(PMLOGLIB_ENABLE_LOGGING)
     return Stream(context_, msgId, kPmLogLevel_Warning);
-#else
-    return DummyStream();
-#endif
+}
+
+PmLog::Stream PmLog::warning(const char* msgId)
+{
+    return Stream(context_, msgId, kPmLogLevel_Warning);
 }
 
 PmLog::Stream PmLog::info(const std::string& msgId)
 {
-#if defined(PMLOGLIB_ENABLE_LOGGING)
     return Stream(context_, msgId, kPmLogLevel_Info);
-#else
-    return DummyStream();
-#endif
+}
+
+PmLog::Stream PmLog::info(const char* msgId)
+{
+    return Stream(context_, msgId, kPmLogLevel_Info);
 }
 
 PmLog::Stream PmLog::debug(const std::string& msgId)
 {
-#if defined(PMLOGLIB_ENABLE_LOGGING)
     return Stream(context_, msgId, kPmLogLevel_Debug);
-#else
-    return DummyStream();
-#endif
+}
+
+PmLog::Stream PmLog::debug(const char* msgId)
+{
+    return Stream(context_, msgId, kPmLogLevel_Debug);
 }
 
 std::string PmLog::formatError(PmLogErr err)
@@ -76,54 +85,290 @@ std::string PmLog::formatError(PmLogErr err)
     return PmLogGetErrDbgString(err);
 }
 
+namespace detail
+{
+
+struct StreamBuffer
+{
+    std::string msgId;
+    std::string kvpairs;   // "{" followed by the pairs, without the closing '}'
+    std::string messages;
+    StreamBuffer* next;
+};
+
+// Buffers released by the Streams of this thread.  They keep their
+// capacity, so after the first few records nothing is allocated.
+struct StreamPool
+{
+    StreamBuffer* free = nullptr;
+    ~StreamPool();
+};
+
+static thread_local StreamPool tPool;
+// set once tPool is destroyed, Streams living past it free their buffers
+static thread_local bool tPoolGone = false;
+
+StreamPool::~StreamPool()
+{
+    while (free)
+    {
+        StreamBuffer* buffer = free;
+        free = buffer->next;
+        delete buffer;
+    }
+    tPoolGone = true;
+}
+
+static StreamBuffer* AcquireBuffer()
+{
+    StreamBuffer* buffer = tPoolGone ? nullptr : tPool.free;
+    if (buffer)
+    {
+        tPool.free = buffer->next;
+    }
+    else
+    {
+        buffer = new StreamBuffer();
+    }
+    buffer->next = nullptr;
+    buffer->kvpairs.assign(1, '{');
+    return buffer;
+}
+
+static void ReleaseBuffer(StreamBuffer* buffer)
+{
+    if (tPoolGone)
+    {
+        delete buffer;
+        return;
+    }
+    buffer->next = tPool.free;
+    tPool.free = buffer;
+}
+
+} // namespace detail
+
+static const char kDigitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Writes the digits of value backwards, ending at end, two at a time
+static char* FormatDigits(char* end, unsigned long long value)
+{
+    while (value >= 100)
+    {
+        unsigned int pair = static_cast<unsigned int>(value % 100) * 2;
+
+        value /= 100;
+        *--end = kDigitPairs[pair + 1];
+        *--end = kDigitPairs[pair];
+    }
+
+    if (value >= 10)
+    {
+        unsigned int pair = static_cast<unsigned int>(value) * 2;
+
+        *--end = kDigitPairs[pair + 1];
+        *--end = kDigitPairs[pair];
+    }
+    else
+    {
+        *--end = static_cast<char>('0' + value);
+    }
+
+    return end;
+}
+
+void detail::appendUnsigned(std::string& out, unsigned long long value)
+{
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    char* begin = FormatDigits(end, value);
+
+    out.append(begin, end - begin);
+}
+
+void detail::appendInteger(std::string& out, long long value)
+{
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    // negate in unsigned arithmetic, so LLONG_MIN doesn't overflow
+    unsigned long long magnitude = (value < 0)
+        ? 0ULL - static_cast<unsigned long long>(value)
+        : static_cast<unsigned long long>(value);
+    char* begin = FormatDigits(end, magnitude);
+
+    if (value < 0)
+    {
+        *--begin = '-';
+    }
+
+    out.append(begin, end - begin);
+}
+
+void detail::appendDouble(std::string& out, double value)
+{
+    char digits[32];
+    int len;
+
+    // integral values are common and take the integer path
+    if ((value >= -9007199254740992.0) && (value <= 9007199254740992.0) &&
+        (value == static_cast<double>(static_cast<long long>(value))))
+    {
+        appendInteger(out, static_cast<long long>(value));
+        return;
+    }
+
+    // JSON has no representation of NaN or infinity
+    if (!std::isfinite(value))
+    {
+        out.append("null", 4);
+        return;
+    }
+
+    // JSON wants a '.' whatever LC_NUMERIC the application has set
+    static const locale_t cLocale = newlocale(LC_NUMERIC_MASK, "C", static_cast<locale_t>(0));
+    locale_t oldLocale = cLocale ? uselocale(cLocale) : static_cast<locale_t>(0);
+
+    // the shortest of %.15g and %.17g that reads back as the same value
+    len = snprintf(digits, sizeof(digits), "%.15g", value);
+    if (strtod(digits, nullptr) != value)
+    {
+        len = snprintf(digits, sizeof(digits), "%.17g", value);
+    }
+
+    if (oldLocale)
+    {
+        uselocale(oldLocale);
+    }
+
+    out.append(digits, len);
+}
+
 PmLog::Stream::Stream(PmLogContext context, const std::string& msgId, PmLogLevel level)
+    : Stream(context, msgId.c_str(), level)
+{
+}
+
+PmLog::Stream::Stream(PmLogContext context, const char* msgId, PmLogLevel level)
     : parent_ctx_(context)
-    , msgId_(msgId)
     , level_(level)
-    , flushed_(false)
-    , err_(kPmLogErr_None)
+    , flushed_(true)
+    , err_(kPmLogErr_LevelDisabled)
+    , buffer_(nullptr)
+{
+    if (!PMLOGLIB_ENABLE_LOGGING)
+    {
+        err_ = kPmLogErr_LoggingDisabled;
+        return;
+    }
+
+    if (!PmLogIsEnabled(context, level))
+    {
+        return;
+    }
+
+    flushed_ = false;
+    err_ = kPmLogErr_None;
+    buffer_ = detail::AcquireBuffer();
+    buffer_->msgId.assign(msgId);
+}
+
+PmLog::Stream::Stream(Stream&& other)
+    : parent_ctx_(other.parent_ctx_)
+    , level_(other.level_)
+    , flushed_(other.flushed_)
+    , err_(other.err_)
+    , buffer_(other.buffer_)
 {
+    other.flushed_ = true;
+    other.buffer_ = nullptr;
 }
 
 PmLog::Stream::~Stream()
 {
-    flush();
+    if (buffer_)
+    {
+        flush();
+        detail::ReleaseBuffer(buffer_);
+    }
 }
 
-void PmLog::Stream::put(const std::pair<std::string, std::string>& kv)
+void PmLog::Stream::putKey(const char* key, size_t len)
 {
-    if (!kvpairs_.empty())
+    std::string& kvpairs = buffer_->kvpairs;
+
+    if (kvpairs.size() > 1)
     {
-        kvpairs_.push_back(',');
+        kvpairs.push_back(',');
     }
 
-    kvpairs_.append("\"" + kv.first + "\":\"" + kv.second + "\"");
+    kvpairs.push_back('"');
+    kvpairs.append(key, len);
+    kvpairs.append("\":", 2);
 }
 
-void PmLog::Stream::put(const std::pair<std::string, int>& kv)
+void PmLog::Stream::putString(const char* value, size_t len)
 {
-    if (!kvpairs_.empty())
+    std::string& kvpairs = buffer_->kvpairs;
+    size_t start = kvpairs.size() + 1;
+    // room for the value with a few escapes, and the NUL
+    size_t room = len + 16;
+    size_t escaped;
+
+    kvpairs.push_back('"');
+    kvpairs.resize(start + room);
+    escaped = PmLogEscapeJson(&kvpairs[start], room, value, len);
+    if (escaped >= room)
     {
-        kvpairs_.push_back(',');
+        room = escaped + 1;
+        kvpairs.resize(start + room);
+        (void) PmLogEscapeJson(&kvpairs[start], room, value, len);
     }
-
-    kvpairs_.append("\"" + kv.first + "\":" + std::to_string(kv.second));
+    kvpairs.resize(start + escaped);
+    kvpairs.push_back('"');
 }
 
 void PmLog::Stream::put(const std::string& txt)
 {
-    messages_.append(txt);
+    buffer_->messages.append(txt);
+}
+
+void PmLog::Stream::put(const char* txt)
+{
+    buffer_->messages.append(txt);
+}
+
+#if __cplusplus >= 201703L
+void PmLog::Stream::put(std::string_view txt)
+{
+    buffer_->messages.append(txt.data(), txt.size());
+}
+#endif
+
+std::string& PmLog::Stream::kvpairs()
+{
+    return buffer_->kvpairs;
 }
 
-void PmLog::Stream::put(int num)
+std::string& PmLog::Stream::messages()
 {
-    messages_.append(std::to_string(num));
+    return buffer_->messages;
 }
 
 void PmLog::Stream::clear()
 {
-    kvpairs_.clear();
-    messages_.clear();
+    // clear() keeps the capacity for the next record
+    buffer_->kvpairs.resize(1);
+    buffer_->messages.clear();
 }
 
 void PmLog::Stream::flush()
@@ -135,19 +380,19 @@ void PmLog::Stream::flush()
 
     flushed_ = true;
 
-    if (!PmLogIsEnabled(parent_ctx_, level_))
-    {
-        err_ = kPmLogErr_LevelDisabled;
-    }
-    else if (level_ == kPmLogLevel_Debug)
+    // the level was checked when the Stream was created
+    if (level_ == kPmLogLevel_Debug)
     {
-        err_ = PmLogString_(parent_ctx_, level_, nullptr, nullptr, messages_.c_str());
+        err_ = PmLogString_(parent_ctx_, level_, nullptr, nullptr, buffer_->messages.c_str());
     }
     else
     {
+        std::string& kvpairs = buffer_->kvpairs;
+
+        kvpairs.push_back('}');
         err_ = PmLogString_(
             parent_ctx_, level_,
-            msgId_.c_str(), ("{" + kvpairs_ + "}").c_str(), messages_.c_str());
+            buffer_->msgId.c_str(), kvpairs.c_str(), buffer_->messages.c_str());
     }
 
     clear();
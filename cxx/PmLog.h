@@ -22,33 +22,137 @@
 #include "PmLogLib.h"
 #include <string>
 #include <memory>
+#include <type_traits>
+#include <utility>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
 
 namespace pmlog
 {
 
+namespace detail
+{
+// Reusable per-thread storage of a Stream, see PmLog.cpp
+struct StreamBuffer;
+
+// Allocation-free number formatting, appending to out
+void appendInteger(std::string& out, long long value);
+void appendUnsigned(std::string& out, unsigned long long value);
+void appendDouble(std::string& out, double value);
+}
+
+// A key/value pair of a log record, see kv() and PMLOGKV().  It only
+// refers to its key and value, so it is meant to be built within the
+// logging statement.
+template <typename T>
+struct KeyValue
+{
+    const char* key;
+    size_t keyLen;
+    const T& value;
+};
+
+// Builds a key/value pair for a Stream.  Strings (std::string,
+// std::string_view, const char*) are written quoted and escaped with
+// PmLogEscapeJson(), so they may hold any text, bool as true or
+// false, integers of any width, floating point numbers and enums as
+// numbers.  Use PMLOGKV() for a literal key, it is checked at build
+// time; the key given here is only checked when the record is written.
+template <typename T>
+KeyValue<T> kv(const char* key, const T& value)
+{
+    return KeyValue<T>{ key, std::char_traits<char>::length(key), value };
+}
+
+namespace detail
+{
+template <typename T>
+KeyValue<T> literalKv(const char* key, size_t keyLen, const T& value)
+{
+    return KeyValue<T>{ key, keyLen, value };
+}
+}
+
+// Same as kv() for a literal key, which is checked at build time like the
+// keys of PmLogMsg(): a key with an invalid character fails the build.
+//
+//     log.info("APP_LAUNCHED") << PMLOGKV("APP_ID", appId) << PMLOGKV("PID", pid);
+#define PMLOGKV(literal_key, kv_value) \
+    ((void) PmLogMsg_key_has_invalid_character<_PmLogMsgKeysValid(literal_key)>::value, \
+     pmlog::detail::literalKv(literal_key "", sizeof(literal_key) - 1, kv_value))
+
+// The least severe level compiled into the PMLOG_CXX_*() macros below:
+// a record of a less severe level is removed at build time, along with
+// the evaluation of its arguments.  E.g. release builds can drop all the
+// debug records with -DPMLOG_CXX_MIN_LEVEL=kPmLogLevel_Info.  Without
+// PMLOGLIB_ENABLE_LOGGING nothing is compiled in.
+#ifndef PMLOG_CXX_MIN_LEVEL
+#if PMLOGLIB_ENABLE_LOGGING
+#define PMLOG_CXX_MIN_LEVEL kPmLogLevel_Debug
+#else
+#define PMLOG_CXX_MIN_LEVEL kPmLogLevel_None
+#endif
+#endif
+
+// true if records of the given level are compiled in
+constexpr bool compiledIn(PmLogLevel level)
+{
+    return level <= (PMLOG_CXX_MIN_LEVEL);
+}
+
+// Log through a PmLog only if the level is compiled in and enabled in its
+// context, otherwise nothing after the macro is evaluated:
+//
+//     PMLOG_CXX_INFO(log, "APP_LAUNCHED", PMLOGKV("APP_ID", appId)) << "launched";
+//     PMLOG_CXX_DEBUG(log) << "state " << dumpState();
+//
+// The if/else form keeps the macro a single statement which takes the
+// rest of the << chain, and can't capture an else that follows it.
+#define PMLOG_CXX_LOG(log, level, method, ...) \
+    if (!pmlog::compiledIn(level) || !(log).isEnabled(level)) {} else (log).method(__VA_ARGS__)
+
+#define PMLOG_CXX_CRITICAL(log, ...) PMLOG_CXX_LOG(log, kPmLogLevel_Critical, critical, __VA_ARGS__)
+#define PMLOG_CXX_ERROR(log, ...)    PMLOG_CXX_LOG(log, kPmLogLevel_Error, error, __VA_ARGS__)
+#define PMLOG_CXX_WARNING(log, ...)  PMLOG_CXX_LOG(log, kPmLogLevel_Warning, warning, __VA_ARGS__)
+#define PMLOG_CXX_INFO(log, ...)     PMLOG_CXX_LOG(log, kPmLogLevel_Info, info, __VA_ARGS__)
+#define PMLOG_CXX_DEBUG(log)         PMLOG_CXX_LOG(log, kPmLogLevel_Debug, debug, )
+
 class PmLog
 {
     PmLogContext context_;
 
 public:
+    // A Stream formats into a buffer taken from a per-thread pool and
+    // given back when it is destroyed, so logging doesn't allocate once
+    // the pool is warm.  Streams can be moved but not copied.
+    //
+    // The level is checked once, when the Stream is created: a disabled
+    // Stream has no buffer and ignores everything it is given, but its
+    // arguments are still evaluated (see PMLOG_CXX_LOG to avoid that).
     class Stream
     {
         PmLogContext parent_ctx_;
-        std::string msgId_;
         PmLogLevel level_;
         bool flushed_;
         PmLogErr err_;
-        std::string messages_;
-        std::string kvpairs_;
+        detail::StreamBuffer* buffer_;
     public:
         Stream(PmLogContext context, const std::string& msgId, PmLogLevel level);
+        Stream(PmLogContext context, const char* msgId, PmLogLevel level);
+        Stream(Stream&& other);
+        Stream(const Stream&) = delete;
+        Stream& operator = (const Stream&) = delete;
         ~Stream();
 
         template <typename T>
-        Stream& operator << (T e)
+        Stream& operator << (const T& e)
         {
-            flushed_ = false;
-            put(e);
+            if (buffer_)
+            {
+                flushed_ = false;
+                put(e);
+            }
             return *this;
         }
 
@@ -58,20 +162,98 @@ public:
             return *this;
         }
 
+        // appends all the given key/value pairs
+        template <typename... KVs>
+        Stream& add(const KVs&... kvs)
+        {
+            if (buffer_)
+            {
+                flushed_ = false;
+                putAll(kvs...);
+            }
+            return *this;
+        }
+
         PmLogErr errorState() const;
         void flush();
     private:
-        void put(const std::pair<std::string, std::string>& kv);
-        void put(const std::pair<std::string, int>& kv);
+        template <typename K, typename V>
+        void put(const std::pair<K, V>& kv)
+        {
+            putKey(keyData(kv.first), keyLen(kv.first));
+            putValue(kv.second);
+        }
+        template <typename T>
+        void put(const KeyValue<T>& kv)
+        {
+            putKey(kv.key, kv.keyLen);
+            putValue(kv.value);
+        }
         void put(const std::string& txt);
-        void put(int num);
-        void clear();
-    };
+        void put(const char* txt);
+#if __cplusplus >= 201703L
+        void put(std::string_view txt);
+#endif
+        template <typename T>
+        typename std::enable_if<std::is_arithmetic<T>::value>::type put(T num)
+        {
+            appendNumber(messages(), num);
+        }
 
-    struct DummyStream
-    {
-        template <typename T> DummyStream& operator << (T) { return *this; }
-        PmLogErr errorState() const { return kPmLogErr_None; }
+        void putAll() {}
+        template <typename KV, typename... KVs>
+        void putAll(const KV& first, const KVs&... rest)
+        {
+            put(first);
+            putAll(rest...);
+        }
+
+        static const char* keyData(const std::string& key) { return key.data(); }
+        static const char* keyData(const char* key) { return key; }
+        static size_t keyLen(const std::string& key) { return key.size(); }
+        static size_t keyLen(const char* key) { return std::char_traits<char>::length(key); }
+
+        void putKey(const char* key, size_t len);
+        void putString(const char* value, size_t len);
+        void putValue(const std::string& value) { putString(value.data(), value.size()); }
+        void putValue(const char* value) { putString(value, std::char_traits<char>::length(value)); }
+#if __cplusplus >= 201703L
+        void putValue(std::string_view value) { putString(value.data(), value.size()); }
+#endif
+        template <typename T>
+        typename std::enable_if<std::is_arithmetic<T>::value>::type putValue(T value)
+        {
+            appendNumber(kvpairs(), value);
+        }
+        template <typename T>
+        typename std::enable_if<std::is_enum<T>::value>::type putValue(T value)
+        {
+            putValue(static_cast<typename std::underlying_type<T>::type>(value));
+        }
+
+        static void appendNumber(std::string& out, bool value)
+        {
+            value ? out.append("true", 4) : out.append("false", 5);
+        }
+        template <typename T>
+        static typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+        appendNumber(std::string& out, T value)
+        {
+            detail::appendInteger(out, value);
+        }
+        template <typename T>
+        static typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+        appendNumber(std::string& out, T value)
+        {
+            detail::appendUnsigned(out, value);
+        }
+        static void appendNumber(std::string& out, float value) { detail::appendDouble(out, value); }
+        static void appendNumber(std::string& out, double value) { detail::appendDouble(out, value); }
+        static void appendNumber(std::string& out, long double value) { detail::appendDouble(out, value); }
+
+        std::string& kvpairs();
+        std::string& messages();
+        void clear();
     };
 
 public:
@@ -85,7 +267,51 @@ public:
     Stream info(const std::string& msgId     = "DEFAULT");
     Stream debug(const std::string& msgId    = "DEFAULT");
 
+    // same as above, without building a std::string for a literal msgId
+    Stream critical(const char* msgId);
+    Stream error(const char* msgId);
+    Stream warning(const char* msgId);
+    Stream info(const char* msgId);
+    Stream debug(const char* msgId);
+
+    // same as above, with the given key/value pairs already put:
+    //
+    //     log.info("APP_LAUNCHED", PMLOGKV("APP_ID", appId), PMLOGKV("PID", pid)) << "launched";
+    template <typename KV, typename... KVs>
+    Stream critical(const char* msgId, const KV& kv, const KVs&... kvs)
+    {
+        return withKvs(critical(msgId), kv, kvs...);
+    }
+    template <typename KV, typename... KVs>
+    Stream error(const char* msgId, const KV& kv, const KVs&... kvs)
+    {
+        return withKvs(error(msgId), kv, kvs...);
+    }
+    template <typename KV, typename... KVs>
+    Stream warning(const char* msgId, const KV& kv, const KVs&... kvs)
+    {
+        return withKvs(warning(msgId), kv, kvs...);
+    }
+    template <typename KV, typename... KVs>
+    Stream info(const char* msgId, const KV& kv, const KVs&... kvs)
+    {
+        return withKvs(info(msgId), kv, kvs...);
+    }
+
+    bool isEnabled(PmLogLevel level) const
+    {
+        return PMLOGLIB_ENABLE_LOGGING && PmLogIsEnabled(context_, level);
+    }
+
     static std::string formatError(PmLogErr err);
+
+private:
+    template <typename... KVs>
+    static Stream withKvs(Stream&& stream, const KVs&... kvs)
+    {
+        stream.add(kvs...);
+        return std::move(stream);
+    }
 };
 
 void flush(PmLog::Stream* stream);
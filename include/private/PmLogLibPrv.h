@@ -28,6 +28,9 @@
 
 #include "PmLogLib.h"
 
+#include <sys/types.h>
+#include <time.h>
+
 
 #ifdef __cplusplus
 extern "C"
@@ -42,13 +45,62 @@ typedef struct
 {
 	PmLogContextInfo	info;
 	char				component[ PMLOG_MAX_CONTEXT_NAME_LEN + 1 ];
+	int16_t				msgPolicies;	// 1 + index of the first policy, or 0
+	uint32_t			maxMessageSize;	// 0 for the default of 1 KB
 }
 PmLogContext_;
 
 
 // value for globals->signature.  If it does not match the
 // expected value then the client must abort.
-#define PMLOG_SIGNATURE			0x504C6702	// 'PLg' + 0x02
+#define PMLOG_SIGNATURE			0x504C670C	// 'PLg' + 0x0C
+
+
+// Number of slots in the context name hash index.  Must be a power of
+// 2, and is kept well above PMLOG_MAX_NUM_CONTEXTS so probe sequences
+// stay short.
+#define PMLOG_CONTEXT_INDEX_SIZE	1024
+
+
+// Largest "maxMessageSize" a context can be configured with.
+#define PMLOG_MAX_MESSAGE_SIZE		(8 * 1024)
+
+
+// Number of rate limits and samplings that can be configured, over all
+// contexts.
+#define PMLOG_MAX_MSG_POLICIES		256
+
+
+// The rate limit and the sampling of a context, or of one msgid of a
+// context, see PrvMsgPolicyFind in PmLogLib.c.  The rate limit is a
+// token bucket in its GCRA form, see PrvRateLimitAdmit; 1 record in
+// 'period' is logged, see PrvSampleAdmit.  The policies of a context
+// are chained through 'next'.
+typedef struct
+{
+	uint64_t		tat;			// theoretical arrival time, CLOCK_MONOTONIC ns
+	uint64_t		interval;		// ns per record, 1e9 / perSec, 0 if not limited
+	uint64_t		tolerance;		// (burst - 1) * interval
+	uint32_t		suppressed;		// records dropped since the last one let through
+	uint32_t		period;			// 0 if not sampled
+	int16_t			next;			// 1 + index of the next policy, or 0
+	char			msgid[ 32 + 1 ];	// empty for the whole context
+}
+PmLogMsgPolicy;
+
+
+// Counters of a context, see PmLogGetContextStats.  Each context gets
+// a cache line of its own, so that hot contexts logged to by different
+// processes don't share lines.
+typedef struct
+{
+	uint64_t		messages;
+	uint64_t		bytes;
+	uint64_t		levelRejected;	// direct calls only, not the macros
+	uint64_t		invalid;
+	uint64_t		truncated;
+}
+__attribute__((aligned(64))) PmLogContextCounters;
 
 
 // Flag values for per context and global flags
@@ -63,7 +115,8 @@ enum
 // Flag value for format validation of key and value
 enum
 {
-	kPmLogValidateFormatFlag_LogWithClock = 0x0001
+	kPmLogValidateFormatFlag_LogWithClock = 0x0001,
+	kPmLogValidateFormatFlag_PreValidated = 0x0002  /* keys and formats checked at build time */
 };
 
 
@@ -86,13 +139,39 @@ typedef struct
 	int             reserved;
 	int             maxUserContexts;
 	int             numUserContexts;
+
+	// seqlock over the context names and contextIndex: odd while a
+	// context is being added, see PrvRegistryWriteBegin in PmLogLib.c
+	uint32_t        generation;
+
 	int             contextLogging;
         int             devMode;
 
+	// window of the repeat coalescing in ms, 0 to write all the records
+	int32_t         repeatWindowMs;
+
+	// whether the hot path records its latency, see PmLogPrvGetLatency
+	int32_t         latencyHistograms;
+
+	// pid of the process reading the client rings, or 0 if records
+	// go to syslogd, see PmLogPrvRingSetConsumer
+	int32_t         ringConsumer;
+
 	PmLogConsole    consoleConf;
 
 	PmLogContext_   globalContext;
 	PmLogContext_   userContexts[ PMLOG_MAX_NUM_CONTEXTS ];
+
+	// Open-addressing (linear probing) hash index of the user context
+	// names.  Each slot holds 1 + the userContexts index, or 0 if the
+	// slot is empty.  Contexts are never removed, so neither are slots.
+	int16_t         contextIndex[ PMLOG_CONTEXT_INDEX_SIZE ];
+
+	int             numMsgPolicies;
+	PmLogMsgPolicy  msgPolicies[ PMLOG_MAX_MSG_POLICIES ];
+
+	// [0] for globalContext, [1 + i] for userContexts[i]
+	PmLogContextCounters    counters[ 1 + PMLOG_MAX_NUM_CONTEXTS ];
 }
 PmLogGlobals;
 
@@ -129,10 +208,165 @@ void PmLogPrvUnlock(void);
 /**
 @brief  This is a private function to be used only by PmLog components
 		for test and development purposes.
+
+		Commands:
+		"ReadMem"        data: address of the unsigned long to read
+		"SetSyslogPath"  data: path of the datagram socket to send
+		                 the records of this process to, instead
+		                 of /dev/log
+		"RingBadEntry"   data: unused.  Publishes a malformed
+		                 entry in the ring of this process
 **********************************************************************/
 PmLogErr PmLogPrvTest(const char* cmd, void* data);
 
 
+/*********************************************************************/
+/* Shared memory ring transport */
+/**
+@brief  While a consumer is registered, every process that initializes
+		PmLogLib creates a ring in PMLOG_RING_PATH_PREFIX<pid> and
+		writes its records there instead of sending them to syslogd.
+		Processes started before the registration keep using
+		syslogd.  Records go to syslogd as well whenever the ring is
+		full or no reader is attached to it.
+
+		A consumer (pmlogdaemon, or a stand-in in tests) registers
+		with PmLogPrvRingSetConsumer, finds the rings by listing the
+		PMLOG_RING_PATH_PREFIX files, and reads each ring with
+		PmLogPrvRingOpen, PmLogPrvRingRead, PmLogPrvRingWait and
+		PmLogPrvRingClose.  Each ring must be read by one thread.
+**********************************************************************/
+#define PMLOG_RING_PATH_PREFIX	"/dev/shm/pmloglib.ring."
+
+typedef struct PmLogRing PmLogRing;
+
+// one record, as returned by PmLogPrvRingRead
+typedef struct
+{
+	pid_t				pid;		// of the process that logged it
+	const char			*ident;		// its program name
+	int					level;		// syslog level
+	struct timespec		time;		// CLOCK_REALTIME
+	const char			*text;		// the message, '\0' terminated
+	size_t				len;		// of text
+}
+PmLogRingRecord;
+
+
+/*********************************************************************/
+/* PmLogPrvRingSetConsumer */
+/**
+@brief  Registers the calling process as the reader of the rings, or
+		unregisters it.  Only processes initialized after the
+		registration create a ring.  The registration lapses when
+		the process exits: the next process to start clears it.
+
+@return Error code:
+			kPmLogErr_None
+			kPmLogErr_Unknown if the shared memory is not available
+**********************************************************************/
+PmLogErr PmLogPrvRingSetConsumer(bool consume);
+
+
+/*********************************************************************/
+/* PmLogPrvRingOpen */
+/**
+@brief  Maps the ring of the given process and attaches to it, so the
+		process starts writing its records there.  Reading resumes
+		where the previous reader, if any, left off.
+
+@return Error code:
+			kPmLogErr_None
+			kPmLogErr_InvalidParameter
+			kPmLogErr_NoData if the process has no ring
+			kPmLogErr_InvalidData if the file is not a ring
+			kPmLogErr_Unknown
+**********************************************************************/
+PmLogErr PmLogPrvRingOpen(pid_t pid, PmLogRing** ringP);
+
+
+/*********************************************************************/
+/* PmLogPrvRingRead */
+/**
+@brief  Returns the next record of the ring.  The record stays valid
+		until the next call on the ring.  The ring is unmapped if
+		its process has written a malformed entry into it; it only
+		remains to close it then.
+
+@return Error code:
+			kPmLogErr_None
+			kPmLogErr_InvalidParameter
+			kPmLogErr_NoData if there is no record to read
+			kPmLogErr_InvalidData if the ring has been unmapped
+**********************************************************************/
+PmLogErr PmLogPrvRingRead(PmLogRing* ring, PmLogRingRecord* recordP);
+
+
+/*********************************************************************/
+/* PmLogPrvRingWait */
+/**
+@brief  Waits until the ring has a record to read, for at most
+		timeoutMs milliseconds, or forever if timeoutMs is negative.
+		May return early, e.g. when interrupted by a signal.
+
+@return Error code:
+			kPmLogErr_None
+			kPmLogErr_InvalidParameter
+			kPmLogErr_NoData on timeout
+			kPmLogErr_InvalidData if the ring has been unmapped
+**********************************************************************/
+PmLogErr PmLogPrvRingWait(PmLogRing* ring, int timeoutMs);
+
+
+/*********************************************************************/
+/* PmLogPrvRingClose */
+/**
+@brief  Detaches from the ring and unmaps it.  The process goes back
+		to sending its records to syslogd.  If it has exited, the ring
+		is removed.
+**********************************************************************/
+void PmLogPrvRingClose(PmLogRing* ring);
+
+
+// The call sites timed by the latency histograms
+typedef enum
+{
+	kPmLogLatency_String,		// PmLogString_
+	kPmLogLatency_MsgKV,		// _PmLogMsgKV (PmLogMsg)
+	kPmLogLatency_Write,		// PrvLogWrite, the write path of all the APIs
+
+	kPmLogLatency_NumSites
+}
+PmLogLatencySite;
+
+
+// Bucket i counts the calls that took [2^(i-1), 2^i) ns, bucket 0 those
+// under 1 ns, and the last bucket also counts all the longer ones.
+#define PMLOG_LATENCY_BUCKETS		40
+
+typedef struct
+{
+	uint64_t	count;
+	uint64_t	sumNs;
+	uint64_t	buckets[ PMLOG_LATENCY_BUCKETS ];
+}
+PmLogLatencyHistogram;
+
+
+/*********************************************************************/
+/* PmLogPrvGetLatency */
+/**
+@brief  Gets the latency histogram of a call site, merged over all the
+		threads of the calling process.  The histograms are only
+		recorded while "latencyHistograms" is set in default.conf.
+
+@return Error code:
+			kPmLogErr_None
+			kPmLogErr_InvalidParameter
+**********************************************************************/
+PmLogErr PmLogPrvGetLatency(PmLogLatencySite site, PmLogLatencyHistogram* histP);
+
+
 /*********************************************************************/
 /* PmLogPrvReadConfigs */
 /**
@@ -23,7 +23,12 @@
 
 #define _PmLogMsgKV1(ctx, level_suffix, msgid, k1, f1, v1, free_text_fmt, ...) \
     _PmLogMsgKV( \
-        ctx, kPmLogLevel_##level_suffix, 0, msgid, 1, \
+        ctx, kPmLogLevel_##level_suffix, \
+        _PmLogMsgFlags(0, 1, \
+            k1, \
+            f1, \
+            _PmLogMsgFormatSimple(f1)), \
+        msgid, 1, \
         k1, \
         f1, \
         "{"  "\"" k1 "\":" f1 "} " free_text_fmt, \
@@ -31,7 +36,12 @@
 
 #define _PmLogMsgKV2(ctx, level_suffix, msgid, k1, f1, v1, k2, f2, v2, free_text_fmt, ...) \
     _PmLogMsgKV( \
-        ctx, kPmLogLevel_##level_suffix, 0, msgid, 2, \
+        ctx, kPmLogLevel_##level_suffix, \
+        _PmLogMsgFlags(0, 2, \
+            k1 "\001" k2, \
+            f1 "\001" f2, \
+            _PmLogMsgFormatSimple(f1) && _PmLogMsgFormatSimple(f2)), \
+        msgid, 2, \
         k1 "\001" k2, \
         f1 "\001" f2, \
         "{"  "\"" k1 "\":" f1 ","  "\"" k2 "\":" f2 "} " free_text_fmt, \
@@ -39,7 +49,12 @@
 
 #define _PmLogMsgKV3(ctx, level_suffix, msgid, k1, f1, v1, k2, f2, v2, k3, f3, v3, free_text_fmt, ...) \
     _PmLogMsgKV( \
-        ctx, kPmLogLevel_##level_suffix, 0, msgid, 3, \
+        ctx, kPmLogLevel_##level_suffix, \
+        _PmLogMsgFlags(0, 3, \
+            k1 "\001" k2 "\001" k3, \
+            f1 "\001" f2 "\001" f3, \
+            _PmLogMsgFormatSimple(f1) && _PmLogMsgFormatSimple(f2) && _PmLogMsgFormatSimple(f3)), \
+        msgid, 3, \
         k1 "\001" k2 "\001" k3, \
         f1 "\001" f2 "\001" f3, \
         "{"  "\"" k1 "\":" f1 ","  "\"" k2 "\":" f2 ","  "\"" k3 "\":" f3 "} " free_text_fmt, \
@@ -47,7 +62,12 @@
 
 #define _PmLogMsgKV4(ctx, level_suffix, msgid, k1, f1, v1, k2, f2, v2, k3, f3, v3, k4, f4, v4, free_text_fmt, ...) \
     _PmLogMsgKV( \
-        ctx, kPmLogLevel_##level_suffix, 0, msgid, 4, \
+        ctx, kPmLogLevel_##level_suffix, \
+        _PmLogMsgFlags(0, 4, \
+            k1 "\001" k2 "\001" k3 "\001" k4, \
+            f1 "\001" f2 "\001" f3 "\001" f4, \
+            _PmLogMsgFormatSimple(f1) && _PmLogMsgFormatSimple(f2) && _PmLogMsgFormatSimple(f3) && _PmLogMsgFormatSimple(f4)), \
+        msgid, 4, \
         k1 "\001" k2 "\001" k3 "\001" k4, \
         f1 "\001" f2 "\001" f3 "\001" f4, \
         "{"  "\"" k1 "\":" f1 ","  "\"" k2 "\":" f2 ","  "\"" k3 "\":" f3 ","  "\"" k4 "\":" f4 "} " free_text_fmt, \
@@ -55,7 +75,12 @@
 
 #define _PmLogMsgKV5(ctx, level_suffix, msgid, k1, f1, v1, k2, f2, v2, k3, f3, v3, k4, f4, v4, k5, f5, v5, free_text_fmt, ...) \
     _PmLogMsgKV( \
-        ctx, kPmLogLevel_##level_suffix, 0, msgid, 5, \
+        ctx, kPmLogLevel_##level_suffix, \
+        _PmLogMsgFlags(0, 5, \
+            k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5, \
+            f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5, \
+            _PmLogMsgFormatSimple(f1) && _PmLogMsgFormatSimple(f2) && _PmLogMsgFormatSimple(f3) && _PmLogMsgFormatSimple(f4) && _PmLogMsgFormatSimple(f5)), \
+        msgid, 5, \
         k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5, \
         f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5, \
         "{"  "\"" k1 "\":" f1 ","  "\"" k2 "\":" f2 ","  "\"" k3 "\":" f3 ","  "\"" k4 "\":" f4 ","  "\"" k5 "\":" f5 "} " free_text_fmt, \
@@ -63,7 +88,12 @@
 
 #define _PmLogMsgKV6(ctx, level_suffix, msgid, k1, f1, v1, k2, f2, v2, k3, f3, v3, k4, f4, v4, k5, f5, v5, k6, f6, v6, free_text_fmt, ...) \
     _PmLogMsgKV( \
-        ctx, kPmLogLevel_##level_suffix, 0, msgid, 6, \
+        ctx, kPmLogLevel_##level_suffix, \
+        _PmLogMsgFlags(0, 6, \
+            k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5 "\001" k6, \
+            f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5 "\001" f6, \
+            _PmLogMsgFormatSimple(f1) && _PmLogMsgFormatSimple(f2) && _PmLogMsgFormatSimple(f3) && _PmLogMsgFormatSimple(f4) && _PmLogMsgFormatSimple(f5) && _PmLogMsgFormatSimple(f6)), \
+        msgid, 6, \
         k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5 "\001" k6, \
         f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5 "\001" f6, \
         "{"  "\"" k1 "\":" f1 ","  "\"" k2 "\":" f2 ","  "\"" k3 "\":" f3 ","  "\"" k4 "\":" f4 ","  "\"" k5 "\":" f5 ","  "\"" k6 "\":" f6 "} " free_text_fmt, \
@@ -71,7 +101,12 @@
 
 #define _PmLogMsgKV7(ctx, level_suffix, msgid, k1, f1, v1, k2, f2, v2, k3, f3, v3, k4, f4, v4, k5, f5, v5, k6, f6, v6, k7, f7, v7, free_text_fmt, ...) \
     _PmLogMsgKV( \
-        ctx, kPmLogLevel_##level_suffix, 0, msgid, 7, \
+        ctx, kPmLogLevel_##level_suffix, \
+        _PmLogMsgFlags(0, 7, \
+            k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5 "\001" k6 "\001" k7, \
+            f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5 "\001" f6 "\001" f7, \
+            _PmLogMsgFormatSimple(f1) && _PmLogMsgFormatSimple(f2) && _PmLogMsgFormatSimple(f3) && _PmLogMsgFormatSimple(f4) && _PmLogMsgFormatSimple(f5) && _PmLogMsgFormatSimple(f6) && _PmLogMsgFormatSimple(f7)), \
+        msgid, 7, \
         k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5 "\001" k6 "\001" k7, \
         f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5 "\001" f6 "\001" f7, \
         "{"  "\"" k1 "\":" f1 ","  "\"" k2 "\":" f2 ","  "\"" k3 "\":" f3 ","  "\"" k4 "\":" f4 ","  "\"" k5 "\":" f5 ","  "\"" k6 "\":" f6 ","  "\"" k7 "\":" f7 "} " free_text_fmt, \
@@ -79,7 +114,12 @@
 
 #define _PmLogMsgKV8(ctx, level_suffix, msgid, k1, f1, v1, k2, f2, v2, k3, f3, v3, k4, f4, v4, k5, f5, v5, k6, f6, v6, k7, f7, v7, k8, f8, v8, free_text_fmt, ...) \
     _PmLogMsgKV( \
-        ctx, kPmLogLevel_##level_suffix, 0, msgid, 8, \
+        ctx, kPmLogLevel_##level_suffix, \
+        _PmLogMsgFlags(0, 8, \
+            k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5 "\001" k6 "\001" k7 "\001" k8, \
+            f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5 "\001" f6 "\001" f7 "\001" f8, \
+            _PmLogMsgFormatSimple(f1) && _PmLogMsgFormatSimple(f2) && _PmLogMsgFormatSimple(f3) && _PmLogMsgFormatSimple(f4) && _PmLogMsgFormatSimple(f5) && _PmLogMsgFormatSimple(f6) && _PmLogMsgFormatSimple(f7) && _PmLogMsgFormatSimple(f8)), \
+        msgid, 8, \
         k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5 "\001" k6 "\001" k7 "\001" k8, \
         f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5 "\001" f6 "\001" f7 "\001" f8, \
         "{"  "\"" k1 "\":" f1 ","  "\"" k2 "\":" f2 ","  "\"" k3 "\":" f3 ","  "\"" k4 "\":" f4 ","  "\"" k5 "\":" f5 ","  "\"" k6 "\":" f6 ","  "\"" k7 "\":" f7 ","  "\"" k8 "\":" f8 "} " free_text_fmt, \
@@ -87,7 +127,12 @@
 
 #define _PmLogMsgKV9(ctx, level_suffix, msgid, k1, f1, v1, k2, f2, v2, k3, f3, v3, k4, f4, v4, k5, f5, v5, k6, f6, v6, k7, f7, v7, k8, f8, v8, k9, f9, v9, free_text_fmt, ...) \
     _PmLogMsgKV( \
-        ctx, kPmLogLevel_##level_suffix, 0, msgid, 9, \
+        ctx, kPmLogLevel_##level_suffix, \
+        _PmLogMsgFlags(0, 9, \
+            k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5 "\001" k6 "\001" k7 "\001" k8 "\001" k9, \
+            f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5 "\001" f6 "\001" f7 "\001" f8 "\001" f9, \
+            _PmLogMsgFormatSimple(f1) && _PmLogMsgFormatSimple(f2) && _PmLogMsgFormatSimple(f3) && _PmLogMsgFormatSimple(f4) && _PmLogMsgFormatSimple(f5) && _PmLogMsgFormatSimple(f6) && _PmLogMsgFormatSimple(f7) && _PmLogMsgFormatSimple(f8) && _PmLogMsgFormatSimple(f9)), \
+        msgid, 9, \
         k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5 "\001" k6 "\001" k7 "\001" k8 "\001" k9, \
         f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5 "\001" f6 "\001" f7 "\001" f8 "\001" f9, \
         "{"  "\"" k1 "\":" f1 ","  "\"" k2 "\":" f2 ","  "\"" k3 "\":" f3 ","  "\"" k4 "\":" f4 ","  "\"" k5 "\":" f5 ","  "\"" k6 "\":" f6 ","  "\"" k7 "\":" f7 ","  "\"" k8 "\":" f8 ","  "\"" k9 "\":" f9 "} " free_text_fmt, \
@@ -95,7 +140,12 @@
 
 #define _PmLogMsgKV10(ctx, level_suffix, msgid, k1, f1, v1, k2, f2, v2, k3, f3, v3, k4, f4, v4, k5, f5, v5, k6, f6, v6, k7, f7, v7, k8, f8, v8, k9, f9, v9, k10, f10, v10, free_text_fmt, ...) \
     _PmLogMsgKV( \
-        ctx, kPmLogLevel_##level_suffix, 0, msgid, 10, \
+        ctx, kPmLogLevel_##level_suffix, \
+        _PmLogMsgFlags(0, 10, \
+            k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5 "\001" k6 "\001" k7 "\001" k8 "\001" k9 "\001" k10, \
+            f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5 "\001" f6 "\001" f7 "\001" f8 "\001" f9 "\001" f10, \
+            _PmLogMsgFormatSimple(f1) && _PmLogMsgFormatSimple(f2) && _PmLogMsgFormatSimple(f3) && _PmLogMsgFormatSimple(f4) && _PmLogMsgFormatSimple(f5) && _PmLogMsgFormatSimple(f6) && _PmLogMsgFormatSimple(f7) && _PmLogMsgFormatSimple(f8) && _PmLogMsgFormatSimple(f9) && _PmLogMsgFormatSimple(f10)), \
+        msgid, 10, \
         k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5 "\001" k6 "\001" k7 "\001" k8 "\001" k9 "\001" k10, \
         f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5 "\001" f6 "\001" f7 "\001" f8 "\001" f9 "\001" f10, \
         "{"  "\"" k1 "\":" f1 ","  "\"" k2 "\":" f2 ","  "\"" k3 "\":" f3 ","  "\"" k4 "\":" f4 ","  "\"" k5 "\":" f5 ","  "\"" k6 "\":" f6 ","  "\"" k7 "\":" f7 ","  "\"" k8 "\":" f8 ","  "\"" k9 "\":" f9 ","  "\"" k10 "\":" f10 "} " free_text_fmt, \
@@ -103,7 +153,12 @@
 
 #define _PmLogMsgClock0(ctx, level_suffix, msgid, k1, f1, v1, v_ms, free_text_fmt, ...) \
     _PmLogMsgKV( \
-        ctx, kPmLogLevel_##level_suffix, 1, msgid, 1, \
+        ctx, kPmLogLevel_##level_suffix, \
+        _PmLogMsgFlags(1, 1, \
+            k1, \
+            f1, \
+            _PmLogMsgFormatSimple(f1)), \
+        msgid, 1, \
         k1, \
         f1, \
         "{"  "\"" k1 "\":" f1 "} " free_text_fmt, \
@@ -111,7 +166,12 @@
 
 #define _PmLogMsgClock1(ctx, level_suffix, msgid, k1, f1, v1, v_ms, k2, f2, v2, free_text_fmt, ...) \
     _PmLogMsgKV( \
-        ctx, kPmLogLevel_##level_suffix, 1, msgid, 2, \
+        ctx, kPmLogLevel_##level_suffix, \
+        _PmLogMsgFlags(1, 2, \
+            k1 "\001" k2, \
+            f1 "\001" f2, \
+            _PmLogMsgFormatSimple(f1) && _PmLogMsgFormatSimple(f2)), \
+        msgid, 2, \
         k1 "\001" k2, \
         f1 "\001" f2, \
         "{"  "\"" k1 "\":" f1 ","  "\"" k2 "\":" f2 "} " free_text_fmt, \
@@ -119,7 +179,12 @@
 
 #define _PmLogMsgClock2(ctx, level_suffix, msgid, k1, f1, v1, v_ms, k2, f2, v2, k3, f3, v3, free_text_fmt, ...) \
     _PmLogMsgKV( \
-        ctx, kPmLogLevel_##level_suffix, 1, msgid, 3, \
+        ctx, kPmLogLevel_##level_suffix, \
+        _PmLogMsgFlags(1, 3, \
+            k1 "\001" k2 "\001" k3, \
+            f1 "\001" f2 "\001" f3, \
+            _PmLogMsgFormatSimple(f1) && _PmLogMsgFormatSimple(f2) && _PmLogMsgFormatSimple(f3)), \
+        msgid, 3, \
         k1 "\001" k2 "\001" k3, \
         f1 "\001" f2 "\001" f3, \
         "{"  "\"" k1 "\":" f1 ","  "\"" k2 "\":" f2 ","  "\"" k3 "\":" f3 "} " free_text_fmt, \
@@ -127,7 +192,12 @@
 
 #define _PmLogMsgClock3(ctx, level_suffix, msgid, k1, f1, v1, v_ms, k2, f2, v2, k3, f3, v3, k4, f4, v4, free_text_fmt, ...) \
     _PmLogMsgKV( \
-        ctx, kPmLogLevel_##level_suffix, 1, msgid, 4, \
+        ctx, kPmLogLevel_##level_suffix, \
+        _PmLogMsgFlags(1, 4, \
+            k1 "\001" k2 "\001" k3 "\001" k4, \
+            f1 "\001" f2 "\001" f3 "\001" f4, \
+            _PmLogMsgFormatSimple(f1) && _PmLogMsgFormatSimple(f2) && _PmLogMsgFormatSimple(f3) && _PmLogMsgFormatSimple(f4)), \
+        msgid, 4, \
         k1 "\001" k2 "\001" k3 "\001" k4, \
         f1 "\001" f2 "\001" f3 "\001" f4, \
         "{"  "\"" k1 "\":" f1 ","  "\"" k2 "\":" f2 ","  "\"" k3 "\":" f3 ","  "\"" k4 "\":" f4 "} " free_text_fmt, \
@@ -135,7 +205,12 @@
 
 #define _PmLogMsgClock4(ctx, level_suffix, msgid, k1, f1, v1, v_ms, k2, f2, v2, k3, f3, v3, k4, f4, v4, k5, f5, v5, free_text_fmt, ...) \
     _PmLogMsgKV( \
-        ctx, kPmLogLevel_##level_suffix, 1, msgid, 5, \
+        ctx, kPmLogLevel_##level_suffix, \
+        _PmLogMsgFlags(1, 5, \
+            k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5, \
+            f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5, \
+            _PmLogMsgFormatSimple(f1) && _PmLogMsgFormatSimple(f2) && _PmLogMsgFormatSimple(f3) && _PmLogMsgFormatSimple(f4) && _PmLogMsgFormatSimple(f5)), \
+        msgid, 5, \
         k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5, \
         f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5, \
         "{"  "\"" k1 "\":" f1 ","  "\"" k2 "\":" f2 ","  "\"" k3 "\":" f3 ","  "\"" k4 "\":" f4 ","  "\"" k5 "\":" f5 "} " free_text_fmt, \
@@ -143,7 +218,12 @@
 
 #define _PmLogMsgClock5(ctx, level_suffix, msgid, k1, f1, v1, v_ms, k2, f2, v2, k3, f3, v3, k4, f4, v4, k5, f5, v5, k6, f6, v6, free_text_fmt, ...) \
     _PmLogMsgKV( \
-        ctx, kPmLogLevel_##level_suffix, 1, msgid, 6, \
+        ctx, kPmLogLevel_##level_suffix, \
+        _PmLogMsgFlags(1, 6, \
+            k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5 "\001" k6, \
+            f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5 "\001" f6, \
+            _PmLogMsgFormatSimple(f1) && _PmLogMsgFormatSimple(f2) && _PmLogMsgFormatSimple(f3) && _PmLogMsgFormatSimple(f4) && _PmLogMsgFormatSimple(f5) && _PmLogMsgFormatSimple(f6)), \
+        msgid, 6, \
         k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5 "\001" k6, \
         f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5 "\001" f6, \
         "{"  "\"" k1 "\":" f1 ","  "\"" k2 "\":" f2 ","  "\"" k3 "\":" f3 ","  "\"" k4 "\":" f4 ","  "\"" k5 "\":" f5 ","  "\"" k6 "\":" f6 "} " free_text_fmt, \
@@ -151,7 +231,12 @@
 
 #define _PmLogMsgClock6(ctx, level_suffix, msgid, k1, f1, v1, v_ms, k2, f2, v2, k3, f3, v3, k4, f4, v4, k5, f5, v5, k6, f6, v6, k7, f7, v7, free_text_fmt, ...) \
     _PmLogMsgKV( \
-        ctx, kPmLogLevel_##level_suffix, 1, msgid, 7, \
+        ctx, kPmLogLevel_##level_suffix, \
+        _PmLogMsgFlags(1, 7, \
+            k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5 "\001" k6 "\001" k7, \
+            f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5 "\001" f6 "\001" f7, \
+            _PmLogMsgFormatSimple(f1) && _PmLogMsgFormatSimple(f2) && _PmLogMsgFormatSimple(f3) && _PmLogMsgFormatSimple(f4) && _PmLogMsgFormatSimple(f5) && _PmLogMsgFormatSimple(f6) && _PmLogMsgFormatSimple(f7)), \
+        msgid, 7, \
         k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5 "\001" k6 "\001" k7, \
         f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5 "\001" f6 "\001" f7, \
         "{"  "\"" k1 "\":" f1 ","  "\"" k2 "\":" f2 ","  "\"" k3 "\":" f3 ","  "\"" k4 "\":" f4 ","  "\"" k5 "\":" f5 ","  "\"" k6 "\":" f6 ","  "\"" k7 "\":" f7 "} " free_text_fmt, \
@@ -159,7 +244,12 @@
 
 #define _PmLogMsgClock7(ctx, level_suffix, msgid, k1, f1, v1, v_ms, k2, f2, v2, k3, f3, v3, k4, f4, v4, k5, f5, v5, k6, f6, v6, k7, f7, v7, k8, f8, v8, free_text_fmt, ...) \
     _PmLogMsgKV( \
-        ctx, kPmLogLevel_##level_suffix, 1, msgid, 8, \
+        ctx, kPmLogLevel_##level_suffix, \
+        _PmLogMsgFlags(1, 8, \
+            k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5 "\001" k6 "\001" k7 "\001" k8, \
+            f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5 "\001" f6 "\001" f7 "\001" f8, \
+            _PmLogMsgFormatSimple(f1) && _PmLogMsgFormatSimple(f2) && _PmLogMsgFormatSimple(f3) && _PmLogMsgFormatSimple(f4) && _PmLogMsgFormatSimple(f5) && _PmLogMsgFormatSimple(f6) && _PmLogMsgFormatSimple(f7) && _PmLogMsgFormatSimple(f8)), \
+        msgid, 8, \
         k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5 "\001" k6 "\001" k7 "\001" k8, \
         f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5 "\001" f6 "\001" f7 "\001" f8, \
         "{"  "\"" k1 "\":" f1 ","  "\"" k2 "\":" f2 ","  "\"" k3 "\":" f3 ","  "\"" k4 "\":" f4 ","  "\"" k5 "\":" f5 ","  "\"" k6 "\":" f6 ","  "\"" k7 "\":" f7 ","  "\"" k8 "\":" f8 "} " free_text_fmt, \
@@ -167,7 +257,12 @@
 
 #define _PmLogMsgClock8(ctx, level_suffix, msgid, k1, f1, v1, v_ms, k2, f2, v2, k3, f3, v3, k4, f4, v4, k5, f5, v5, k6, f6, v6, k7, f7, v7, k8, f8, v8, k9, f9, v9, free_text_fmt, ...) \
     _PmLogMsgKV( \
-        ctx, kPmLogLevel_##level_suffix, 1, msgid, 9, \
+        ctx, kPmLogLevel_##level_suffix, \
+        _PmLogMsgFlags(1, 9, \
+            k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5 "\001" k6 "\001" k7 "\001" k8 "\001" k9, \
+            f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5 "\001" f6 "\001" f7 "\001" f8 "\001" f9, \
+            _PmLogMsgFormatSimple(f1) && _PmLogMsgFormatSimple(f2) && _PmLogMsgFormatSimple(f3) && _PmLogMsgFormatSimple(f4) && _PmLogMsgFormatSimple(f5) && _PmLogMsgFormatSimple(f6) && _PmLogMsgFormatSimple(f7) && _PmLogMsgFormatSimple(f8) && _PmLogMsgFormatSimple(f9)), \
+        msgid, 9, \
         k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5 "\001" k6 "\001" k7 "\001" k8 "\001" k9, \
         f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5 "\001" f6 "\001" f7 "\001" f8 "\001" f9, \
         "{"  "\"" k1 "\":" f1 ","  "\"" k2 "\":" f2 ","  "\"" k3 "\":" f3 ","  "\"" k4 "\":" f4 ","  "\"" k5 "\":" f5 ","  "\"" k6 "\":" f6 ","  "\"" k7 "\":" f7 ","  "\"" k8 "\":" f8 ","  "\"" k9 "\":" f9 "} " free_text_fmt, \
@@ -175,7 +270,12 @@
 
 #define _PmLogMsgClock9(ctx, level_suffix, msgid, k1, f1, v1, v_ms, k2, f2, v2, k3, f3, v3, k4, f4, v4, k5, f5, v5, k6, f6, v6, k7, f7, v7, k8, f8, v8, k9, f9, v9, k10, f10, v10, free_text_fmt, ...) \
     _PmLogMsgKV( \
-        ctx, kPmLogLevel_##level_suffix, 1, msgid, 10, \
+        ctx, kPmLogLevel_##level_suffix, \
+        _PmLogMsgFlags(1, 10, \
+            k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5 "\001" k6 "\001" k7 "\001" k8 "\001" k9 "\001" k10, \
+            f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5 "\001" f6 "\001" f7 "\001" f8 "\001" f9 "\001" f10, \
+            _PmLogMsgFormatSimple(f1) && _PmLogMsgFormatSimple(f2) && _PmLogMsgFormatSimple(f3) && _PmLogMsgFormatSimple(f4) && _PmLogMsgFormatSimple(f5) && _PmLogMsgFormatSimple(f6) && _PmLogMsgFormatSimple(f7) && _PmLogMsgFormatSimple(f8) && _PmLogMsgFormatSimple(f9) && _PmLogMsgFormatSimple(f10)), \
+        msgid, 10, \
         k1 "\001" k2 "\001" k3 "\001" k4 "\001" k5 "\001" k6 "\001" k7 "\001" k8 "\001" k9 "\001" k10, \
         f1 "\001" f2 "\001" f3 "\001" f4 "\001" f5 "\001" f6 "\001" f7 "\001" f8 "\001" f9 "\001" f10, \
         "{"  "\"" k1 "\":" f1 ","  "\"" k2 "\":" f2 ","  "\"" k3 "\":" f3 ","  "\"" k4 "\":" f4 ","  "\"" k5 "\":" f5 ","  "\"" k6 "\":" f6 ","  "\"" k7 "\":" f7 ","  "\"" k8 "\":" f8 ","  "\"" k9 "\":" f9 ","  "\"" k10 "\":" f10 "} " free_text_fmt, \
@@ -223,7 +323,25 @@ for kind in ('std', 'clock'):
         f.write('free_text_fmt, ...) \\\n')
 
         f.write('    _PmLogMsgKV( \\\n')
-        f.write('        ctx, kPmLogLevel_##level_suffix, {0}, msgid, {1}, \\\n'.format(flags, i))
+        f.write('        ctx, kPmLogLevel_##level_suffix, \\\n')
+
+        # keys and formats are checked at build time where possible,
+        # see _PmLogMsgFlags in PmLogLib.h
+        f.write('        _PmLogMsgFlags({0}, {1}, \\\n'.format(flags, i))
+        f.write('            k1')
+        for j in range(2, i+1):
+            f.write(' "\\001" k{0}'.format(j))
+        f.write(', \\\n')
+        f.write('            f1')
+        for j in range(2, i+1):
+            f.write(' "\\001" f{0}'.format(j))
+        f.write(', \\\n')
+        f.write('            _PmLogMsgFormatSimple(f1)')
+        for j in range(2, i+1):
+            f.write(' && _PmLogMsgFormatSimple(f{0})'.format(j))
+        f.write('), \\\n')
+
+        f.write('        msgid, {0}, \\\n'.format(i))
 
         f.write('        k1')
         for j in range(2, i+1):
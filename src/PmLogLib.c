@@ -15,7 +15,7 @@
 // SPDX-License-Identifier: Apache-2.0
 
 
-// get GNU extensions from dlfcn.h (dladdr)
+// get GNU extensions from dlfcn.h (dladdr), sendmmsg and dup3
 #define _GNU_SOURCE
 
 #include "PmLogLib.h"
@@ -23,16 +23,32 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <inttypes.h>
 #include <dlfcn.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/syscall.h>
 #include <sys/syslog.h>
 #include <sys/shm.h>
+#include <sys/un.h>
 #include <unistd.h>
+#include <linux/futex.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <glib.h>
@@ -83,6 +99,9 @@ static PmLogGlobals defaultSet =
 static PmLogGlobals    *gGlobalsP = &defaultSet;
 static PmLogContext_   *gGlobalContextP = &defaultSet.globalContext;
 
+// exported for the inline level check of PmLogIsEnabled
+const PmLogContextInfo *_PmLogDefaultContextInfo = &defaultSet.globalContext.info;
+
 #define DEBUG_MSG_ID "DBGMSG"
 #define TRUNCATED_MSG_SIZE 128
 
@@ -107,6 +126,7 @@ pid_t gettid(void)
 #define LOG_THREAD_IDS_TAG  "logThreadIds"
 #define LOG_TO_CONSOLE_TAG  "logToConsole"
 #define LOG_LEVEL_TAG       "level"
+#define MAX_MESSAGE_SIZE_TAG "maxMessageSize"
 
 #define BUFFER_LEN 1024
 #define CONFIG_DIR WEBOS_INSTALL_SYSCONFDIR "/pmlog.d"
@@ -117,7 +137,6 @@ pid_t gettid(void)
 #define VALIDATE_INCOMING_LIBPROCESSCONTEXT
 
 #define MAX_PROGRAM_NAME 256
-static bool syslogConnected = false;
 static char progName[MAX_PROGRAM_NAME];
 
 void block_signals(sigset_t *old_set)
@@ -132,2100 +151,7604 @@ void unblock_signals(sigset_t *old_set)
     pthread_sigmask(SIG_SETMASK, old_set, NULL);
 }
 
-void CallSysLog(const char *context, const int level, const char* pidtid, const char* fmt, ...)
-{
-    char buffer[1024] = {0,};
-    va_list args;
-    int index = snprintf(buffer, sizeof(buffer), "%s %s %s ", pidtid, PMLOG_IDENTIFIER, context);
-    if(index < 0)
-    {
-        return;
-    }
-    va_start (args, fmt);
-    g_vsnprintf (buffer + index, sizeof(buffer) - index, fmt, args);
-    va_end (args);
 
-    sigset_t old_set;
-    block_signals(&old_set);
-    syslog(level, "%s", buffer);
-    unblock_signals(&old_set);
+/***********************************************************************
+ * Syslog transport
+ *
+ * Records are sent to syslogd directly instead of through syslog(3).
+ * We keep one connected AF_UNIX datagram socket for the process and
+ * build the RFC 3164 header ("<PRI>Mmm dd hh:mm:ss ident: ") ourselves,
+ * the same way glibc does.  This avoids glibc's internal lock and
+ * re-formatting on every message, and lets the asynchronous writer
+ * hand a whole batch of records to the kernel with one sendmmsg().
+ *
+ * If the socket cannot be connected, records go through syslog(3) as
+ * before; a new connect is attempted at most once a second.  So does
+ * a record whose send fails even after reconnecting, rather than being
+ * dropped.
+ *
+ * Apart from that fallback the path runs with signals unmasked.  A
+ * signal handler that logs while its thread is already inside the
+ * library (tLogDepth > 1) takes a reentrancy-safe path: it sends on the
+ * socket that is already connected, never takes a lock and uses the
+ * last published timestamp.  syslog(3) itself is not reentrant, so the
+ * fallback keeps all signals blocked while it runs, and nested calls
+ * cannot interrupt it.
+ ***********************************************************************/
+#define SYSLOG_SOCKET_PATH  "/dev/log"
+#define SYSLOG_LINE_LEN     (MAX_PROGRAM_NAME + 64 + BUFFER_LEN + PMLOG_MAX_MESSAGE_SIZE)
+#define SYSLOG_SHORT_LEN    (MAX_PROGRAM_NAME + 64 + 2 * BUFFER_LEN)
+#define SYSLOG_HEADER_LEN   (MAX_PROGRAM_NAME + 32)
+#define SYSLOG_MAX_BATCH    32
 
+static struct
+{
+    pthread_mutex_t     lock;       /* taken to (re)connect only */
+    pthread_once_t      once;
+    int                 fd;
+    time_t              nextRetry;
+    char                path[ sizeof(((struct sockaddr_un*) NULL)->sun_path) ];
 }
+gSyslog =
+{
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .once = PTHREAD_ONCE_INIT,
+    .fd   = -1,
+    .path = SYSLOG_SOCKET_PATH
+};
 
-#ifdef DEBUG_ENABLED
-    /***********************************************************************
-     * DbgPrint
-     ***********************************************************************/
-    #define DbgPrint(...) \
-        {                                                                           \
-            fprintf(stdout, COMPONENT_PREFIX __VA_ARGS__);                          \
-            CallSysLog(COMPONENT_PREFIX, "[]", __VA_ARGS__)                         \
-        }
-
-    #define ErrPrint(context, pidtid, ...) \
-        {                                                                           \
-            fprintf(stderr, context __VA_ARGS__);                                   \
-            fprintf(stderr, "\n");                                                  \
-            CallSysLog(context, pidtid, __VA_ARGS__);                               \
-        }
+// number of logging calls in progress on this thread; more than one
+// means we were entered again from a signal handler
+static __thread int tLogDepth;
 
-    #define WarnPrint(context, pidtid, ...) \
-        {                                                                           \
-            fprintf(stderr, context __VA_ARGS__);                                   \
-            fprintf(stderr, "\n");                                                  \
-            CallSysLog(context, pidtid, __VA_ARGS__);                               \
-        }
-#else
-    /***********************************************************************
-     * DbgPrint
-     ***********************************************************************/
-    #define DbgPrint(pidtid, ...)
+// per-thread cache of the formatted timestamp, refreshed once a second;
+// double-buffered so a nested call never reads a half-written string
+static __thread struct
+{
+    time_t  sec;
+    int     current;
+    char    str[ 2 ][ 16 ];
+}
+tSyslogStamp = { -1, 0, { "", "" } };
 
-    /***********************************************************************
-    * ErrPrint
-    ***********************************************************************/
-    #define ErrPrint(context, pidtid, ...) CallSysLog(context, LOG_ERR, pidtid, __VA_ARGS__)
+// see Shared memory ring transport below
+static bool PrvRingWrite(int level, const struct iovec *iov, int iovcnt);
 
-    /***********************************************************************
-    * WarnPrint
-    ***********************************************************************/
-    #define WarnPrint(context, pidtid, ...) CallSysLog(context, LOG_WARNING, pidtid, __VA_ARGS__)
-#endif // DEBUG_ENABLED
+static const char kMonthNames[12][4] =
+{
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
 
-/***********************************************************************
- * DEBUG_LOGGING
- *
- * Because the PmLog global initialization will occur on first use that
- * means it may occur before PmLogDaemon is running.  In which case we
- * can't do logging or print debugging information as it will get
- * dropped.  To work around that we can direct our local logs to a
- * separate file.
- * ?? Later, consider having this integrated into the main bottleneck,
- * e.g. PrvLogWrite.  We can have a field in the shared memory that
- * is a flag set by PmLogDaemon when it is running.  If logging is done
- * before that we can manually append to either a separate or the main
- * log file.  That way we'll be sure not to drop any messages during
- * boot or if PmLogDaemon doesn't run for some reason.
- * To be revisited after the OE build switch is complete.
- ***********************************************************************/
 
-// don't check in with this on!
-//#define DEBUG_LOGGING
+/*********************************************************************/
+/* PrvLogEnter / PrvLogLeave / PrvLogNested */
+/**
+@brief  Bracket a logging call on the current thread.  PrvLogNested
+        tells if the current call interrupted another one.
+**********************************************************************/
+static inline void PrvLogEnter(void)
+{
+    tLogDepth++;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
 
+static inline void PrvLogLeave(void)
+{
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    tLogDepth--;
+}
 
-#ifdef DEBUG_LOGGING
+static inline bool PrvLogNested(void)
+{
+    return tLogDepth > 1;
+}
 
 
 /*********************************************************************/
-/* PrintAppendToFile */
+/* PrvSyslogInit */
 /**
-@brief  Logs the specified formatted text to the specified context.
+@brief  One-time setup of the ident used in the header and of the
+        syslog(3) fallback.  To meet RFC 3164, we need to use limited
+        '__progname' to protect actual message.
 **********************************************************************/
-static void PrintAppendToFile(const char* filePath, const char* fmt, ...)
+static void PrvSyslogInit(void)
 {
-    va_list args;
-    FILE*    f;
-
-    va_start(args, fmt);
+    strncpy(progName, __progname, MAX_PROGRAM_NAME - 1);
+    progName[MAX_PROGRAM_NAME - 1] = 0;
+    openlog(progName, 0, LOG_USER);
+}
 
-    f = fopen(filePath, "a");
-    if (f != NULL)
-    {
-        fprintf(f, "%s: ", __progname);
 
-        vfprintf(f, fmt, args);
+/*********************************************************************/
+/* PrvSyslogConnect */
+/**
+@brief  Connects the syslog socket.  If the socket is already open
+        (reconnect after syslogd restarted) the new connection is
+        dup'ed over the old descriptor, so a concurrent sender never
+        sees a closed or reused descriptor.
+        Must be called with gSyslog.lock held.
+**********************************************************************/
+static bool PrvSyslogConnect(void)
+{
+    struct sockaddr_un  addr;
+    int                 fd;
 
-        (void) fclose(f);
+    fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return false;
     }
 
-    va_end(args);
-}
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    g_strlcpy(addr.sun_path, gSyslog.path, sizeof(addr.sun_path));
 
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1)
+    {
+        close(fd);
+        return false;
+    }
 
-/***********************************************************************
- * DbgPrint
- ***********************************************************************/
-#undef DbgPrint
-#define DbgPrint(...) \
-    {                                                            \
-        const char* path = WEBOS_INSTALL_LOGDIR "/pmlog.log";                \
-        PrintAppendToFile(path, COMPONENT_PREFIX __VA_ARGS__);    \
+    if (gSyslog.fd == -1)
+    {
+        __atomic_store_n(&gSyslog.fd, fd, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        (void) dup3(fd, gSyslog.fd, O_CLOEXEC);
+        close(fd);
     }
 
-/***********************************************************************
- * ErrPrint
- ***********************************************************************/
-#undef ErrPrint
-#define ErrPrint    DbgPrint
+    return true;
+}
 
 
-#endif // DEBUG_LOGGING
+/*********************************************************************/
+/* PrvSyslogGetFd */
+/**
+@brief  Returns the connected syslog socket, or -1 if syslogd can't
+        be reached and syslog(3) has to be used.
+**********************************************************************/
+static int PrvSyslogGetFd(void)
+{
+    int     fd;
+    time_t  now;
 
+    fd = __atomic_load_n(&gSyslog.fd, __ATOMIC_ACQUIRE);
+    if ((fd != -1) || PrvLogNested())
+    {
+        return fd;
+    }
 
-/***********************************************************************
- * GetPidStr
- *
- * Return a formatted string containing the process and thread ids
- * according to the context flags.
- ***********************************************************************/
-void GetPidStr(PmLogContext_ *context,char *ptidStr,long int ptidStrLen)
-{
-    pid_t    pid;
-    pid_t    tid;
+    (void) pthread_once(&gSyslog.once, PrvSyslogInit);
 
-    memset(ptidStr, 0, ptidStrLen);
+    now = time(NULL);
 
-    if ((context->info.flags & kPmLogFlag_LogProcessIds) ||
-        (context->info.flags & kPmLogFlag_LogThreadIds)) {
-        pid = getpid();
-        tid = gettid();
-        if (context->info.flags & kPmLogFlag_LogThreadIds &&
-            (tid != pid)) {
-            snprintf(ptidStr, ptidStrLen, "[%d:%d]", (int) pid,
-                (int) tid);
-        } else {
-            snprintf(ptidStr, ptidStrLen, "[%d]", (int) pid);
+    pthread_mutex_lock(&gSyslog.lock);
+    if ((gSyslog.fd == -1) && (now >= gSyslog.nextRetry))
+    {
+        if (!PrvSyslogConnect())
+        {
+            gSyslog.nextRetry = now + 1;
         }
-    } else {
-        g_strlcpy(ptidStr, "[]", ptidStrLen);
     }
-}
+    fd = gSyslog.fd;
+    pthread_mutex_unlock(&gSyslog.lock);
 
+    return fd;
+}
 
-//#######################################################################
 
-/*********************************************************************
- * validate_msgid
- *
- * Ensure that a provided MSGID meets the following constraints:
- *   The pointer is non-NULL
- *   It is not an empty string
- *   It does not contain a space, '{' or '}'
- *   It consists of less than 32 charaters.
- *
- * Returns kPmLogErr_none on success, else kPmLogErr_InvalidMsgID
- *
- *********************************************************************/
-static PmLogErr validate_msgid(const char *msgid, PmLogContext_ *context_ptr)
+/*********************************************************************/
+/* PrvSyslogReconnect */
+/**
+@brief  Called after a send failed on descriptor fd.  Returns true if
+        the send should be retried.
+**********************************************************************/
+static bool PrvSyslogReconnect(int fd)
 {
-//! This macro can be defined to restrict logging
-//! to whitelist logs
-#ifndef ENABLE_WHITELIST
-    int         msgid_len = 0;
-    const char  *ptr_index = NULL;
-    char        ptidStr[ PIDSTR_LEN ];
+    bool retry = false;
 
-    GetPidStr(context_ptr, ptidStr, sizeof(ptidStr));
+    if ((errno != ECONNREFUSED) && (errno != ENOTCONN) &&
+        (errno != ECONNRESET) && (errno != EPIPE))
+    {
+        return false;
+    }
 
-    if (!msgid) {
-        ErrPrint(context_ptr->component,
-                 ptidStr,
-                 "NULL_MSGID {} NULL MSGID provided for non-debug log");
-        return kPmLogErr_InvalidMsgID;
+    if (PrvLogNested())
+    {
+        return false;
     }
 
-    // Check each character in msgid against our list of invalid ones.
-    for (ptr_index = msgid, msgid_len = 0; *ptr_index != '\0'; ++ptr_index, ++msgid_len) {
-        if (msgid_len >= MSGID_LEN) {
-            ErrPrint(context_ptr->component,
-                     ptidStr,
-                     "LONG_MSGID {\"MSGID\":\"%s\"} MSGID's length is restricted within 32 characters",
-                     msgid);
-            return kPmLogErr_InvalidMsgID;
-        }
+    pthread_mutex_lock(&gSyslog.lock);
+    if (gSyslog.fd == fd)
+    {
+        retry = PrvSyslogConnect();
+    }
+    pthread_mutex_unlock(&gSyslog.lock);
 
-        if (strchr(" {}", *ptr_index) != NULL) {
-            ErrPrint(context_ptr->component,
-                     ptidStr,
-                     "INVALID_MSGID {\"MSGID\":\"%s\"} MSGID contains space, { or }.",
-                     msgid);
-            return kPmLogErr_InvalidMsgID;
+    return retry;
+}
+
+
+/*********************************************************************/
+/* PrvSyslogHeader */
+/**
+@brief  Formats the RFC 3164 header for a message of the given level
+        into line.  Returns the header length.
+**********************************************************************/
+static int PrvSyslogHeader(char *line, size_t lineSize, int level)
+{
+    struct tm   tm;
+    time_t      now;
+    int         next;
+    int         n;
+
+    // localtime_r takes the time zone lock, so only the outer call
+    // refreshes the stamp
+    if (!PrvLogNested())
+    {
+        (void) pthread_once(&gSyslog.once, PrvSyslogInit);
+
+        now = time(NULL);
+        if (now != tSyslogStamp.sec)
+        {
+            next = tSyslogStamp.current ^ 1;
+            localtime_r(&now, &tm);
+            snprintf(tSyslogStamp.str[ next ], sizeof(tSyslogStamp.str[ next ]),
+                     "%s %2d %02d:%02d:%02d", kMonthNames[tm.tm_mon % 12],
+                     tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+            __atomic_signal_fence(__ATOMIC_SEQ_CST);
+            tSyslogStamp.current = next;
+            tSyslogStamp.sec = now;
         }
     }
 
-    if (msgid_len == 0) {
-        return kPmLogErr_EmptyMsgID;
-    }
-#endif
-    return kPmLogErr_None;
+    n = snprintf(line, lineSize, "<%d>%s %s: ",
+                 LOG_MAKEPRI(LOG_USER, level & LOG_PRIMASK),
+                 tSyslogStamp.str[ tSyslogStamp.current ], progName);
+
+    return (n < 0) ? 0 : ((size_t) n >= lineSize ? (int) lineSize - 1 : n);
 }
 
-/***********************************************************************
- * mystrcpy
- *
- * Easy to use wrapper for strcpy to make is safe against buffer
- * overflows and to report any truncations.
- ***********************************************************************/
-static void mystrcpy(char* dst, size_t dstSize, const char* src)
+
+/*********************************************************************/
+/* PrvSyslogSend */
+/**
+@brief  Sends one complete line.  bodyOffset is where the message text
+        starts after the header, for the syslog(3) fallback.
+**********************************************************************/
+static void PrvSyslogSend(int level, const char *line, size_t lineLen,
+        size_t bodyOffset)
 {
-    size_t    srcLen;
+    struct iovec    body = { (char*) line + bodyOffset, lineLen - bodyOffset };
+    int             fd;
 
-    if (dst == NULL)
+    if (PrvRingWrite(level, &body, 1))
     {
-        DbgPrint("mystrcpy null dst\n");
         return;
     }
 
-    if (dstSize < 1)
+    fd = PrvSyslogGetFd();
+    if (fd != -1)
     {
-        DbgPrint("mystrcpy invalid dst size\n");
-        return;
-    }
-
-    dst[ 0 ] = 0;
+        if (send(fd, line, lineLen, MSG_NOSIGNAL) != -1)
+        {
+            return;
+        }
 
-    if (src == NULL)
-    {
-        DbgPrint("mystrcpy null src\n");
-        return;
+        if (PrvSyslogReconnect(fd) && (send(fd, line, lineLen, MSG_NOSIGNAL) != -1))
+        {
+            return;
+        }
     }
 
-    srcLen = strlen(src);
-    if (srcLen >= dstSize)
+    sigset_t old_set;
+    block_signals(&old_set);
+    syslog(level, "%s", line + bodyOffset);
+    unblock_signals(&old_set);
+}
+
+
+/*********************************************************************/
+/* PrvSyslogSendRecord */
+/**
+@brief  Sends one record with a single sendmsg(), gathering the header
+        and the fields from where they are instead of assembling the
+        line first.  Returns the length of the record.
+**********************************************************************/
+static size_t PrvSyslogSendRecord(int level, const char *ptidStr,
+        const char *component, const char *msgid, const char *s)
+{
+    char            header[ SYSLOG_HEADER_LEN ];
+    struct iovec    iov[ 8 ];
+    struct msghdr   msg;
+    size_t          lineLen = 0;
+    int             fd;
+    int             i;
+
+    // "<header>ptid [pmlog] component msgid s", the header in iov[0]
+    iov[ 1 ].iov_base = (char*) ptidStr;
+    iov[ 2 ].iov_base = " " PMLOG_IDENTIFIER " ";
+    iov[ 3 ].iov_base = (char*) component;
+    iov[ 4 ].iov_base = " ";
+    iov[ 5 ].iov_base = (char*) (msgid ? msgid : "");
+    iov[ 6 ].iov_base = " ";
+    iov[ 7 ].iov_base = (char*) s;
+    for (i = 1; i < 8; i++)
     {
-        DbgPrint("mystrcpy buffer overflow\n");
-        srcLen = dstSize - 1;
+        iov[ i ].iov_len = strlen(iov[ i ].iov_base);
+        lineLen += iov[ i ].iov_len;
     }
 
-    memcpy(dst, src, srcLen);
-    dst[ srcLen ] = 0;
-}
+    if (PrvRingWrite(level, iov + 1, 7))
+    {
+        return lineLen;
+    }
 
-/***********************************************************************
- * strtruncate_and_escape
- *
- * Truncate source string to TRUNCATED_MSG_SIZE and return newly
- * allcoated escaped string
- ***********************************************************************/
-static inline gchar *strtruncate_and_escape(const char* source)
-{
-    char buffer[TRUNCATED_MSG_SIZE] = {0};
-    strncpy(buffer, source, TRUNCATED_MSG_SIZE - 1);
-    return g_strescape(buffer, NULL);
+    iov[ 0 ].iov_base = header;
+    iov[ 0 ].iov_len = PrvSyslogHeader(header, sizeof(header), level);
+    lineLen += iov[ 0 ].iov_len;
+
+    fd = PrvSyslogGetFd();
+    if (fd != -1)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 8;
+
+        if (sendmsg(fd, &msg, MSG_NOSIGNAL) != -1)
+        {
+            return lineLen;
+        }
+
+        if (PrvSyslogReconnect(fd) && (sendmsg(fd, &msg, MSG_NOSIGNAL) != -1))
+        {
+            return lineLen;
+        }
+    }
+
+    sigset_t old_set;
+    block_signals(&old_set);
+    syslog(level, "%s %s %s %s %s", ptidStr, PMLOG_IDENTIFIER, component,
+           msgid ? msgid : "", s);
+    unblock_signals(&old_set);
+
+    return lineLen;
 }
 
-/***********************************************************************
- * IntLabel
- *
- * Define a integer value => string label mapping.
- ***********************************************************************/
-typedef struct
+
+/*********************************************************************/
+/* PrvSyslogFormat */
+/**
+@brief  Formats header and text into line.  Returns the line length,
+        and the start of the text in *bodyOffsetP.
+**********************************************************************/
+static size_t PrvSyslogVFormat(char *line, size_t lineSize, size_t *bodyOffsetP,
+        int level, const char *fmt, va_list args)
 {
-    const char* s;
+    int header;
     int n;
-}
-IntLabel;
 
+    header = PrvSyslogHeader(line, lineSize, level);
 
-/***********************************************************************
- * PrvGetIntLabel
- *
- * Look up the string label for a given integer value from the given
- * mapping table.  Return NULL if not found.
- ***********************************************************************/
-const char* PrvGetIntLabel(const IntLabel* labels, int n);
+    n = vsnprintf(line + header, lineSize - header, fmt, args);
+    if (n < 0)
+    {
+        n = 0;
+        line[ header ] = 0;
+    }
+    else if ((size_t) n >= lineSize - header)
+    {
+        n = lineSize - header - 1;
+    }
 
+    *bodyOffsetP = header;
+    return header + n;
+}
 
-/***********************************************************************
- * PrvLabelToInt
- *
- * Look up the integer value matching a given string label from the
- * given mapping table.  Return NULL if not found.
- ***********************************************************************/
-const int* PrvLabelToInt(const IntLabel* labels, const char* s);
+static size_t PrvSyslogFormat(char *line, size_t lineSize, size_t *bodyOffsetP,
+        int level, const char *fmt, ...)
+    __attribute__((format(printf, 5, 6)));
+
+static size_t PrvSyslogFormat(char *line, size_t lineSize, size_t *bodyOffsetP,
+        int level, const char *fmt, ...)
+{
+    va_list args;
+    size_t  n;
 
+    va_start(args, fmt);
+    n = PrvSyslogVFormat(line, lineSize, bodyOffsetP, level, fmt, args);
+    va_end(args);
 
-//#######################################################################
+    return n;
+}
 
 
 /***********************************************************************
- * PrvGetIntLabel
+ * PrvSyslogBatch
  *
- * Look up the string label for a given integer value from the given
- * mapping table.  Return NULL if not found.
+ * Records collected by the asynchronous writer, flushed to the socket
+ * with a single sendmmsg().
  ***********************************************************************/
-const char* PrvGetIntLabel(const IntLabel* labels, int n)
+typedef struct
 {
-    const IntLabel* p;
+    unsigned int    count;
+    int             levels[ SYSLOG_MAX_BATCH ];
+    size_t          bodyOffsets[ SYSLOG_MAX_BATCH ];
+    struct iovec    iov[ SYSLOG_MAX_BATCH ];
+    struct mmsghdr  msgs[ SYSLOG_MAX_BATCH ];
+    char            lines[ SYSLOG_MAX_BATCH ][ SYSLOG_LINE_LEN ];
+}
+PrvSyslogBatch;
 
-    for (p = labels; p->s != NULL; p++)
+
+/*********************************************************************/
+/* PrvSyslogFlush */
+/**
+@brief  Sends all the records collected in the batch.
+**********************************************************************/
+static void PrvSyslogFlush(PrvSyslogBatch *batch)
+{
+    unsigned int    sent = 0;
+    unsigned int    i;
+    bool            retried = false;
+    int             fd;
+    int             n;
+
+    if (batch->count == 0)
     {
-        if (p->n == n)
-        {
-            return p->s;
-        }
+        return;
     }
 
-    return NULL;
-}
+    fd = PrvSyslogGetFd();
+    if (fd != -1)
+    {
+        for (i = 0; i < batch->count; i++)
+        {
+            memset(&batch->msgs[ i ].msg_hdr, 0, sizeof(struct msghdr));
+            batch->msgs[ i ].msg_hdr.msg_iov = &batch->iov[ i ];
+            batch->msgs[ i ].msg_hdr.msg_iovlen = 1;
+        }
 
+        while (sent < batch->count)
+        {
+            n = sendmmsg(fd, batch->msgs + sent, batch->count - sent, MSG_NOSIGNAL);
+            if (n > 0)
+            {
+                sent += n;
+                continue;
+            }
 
-/***********************************************************************
- * PrvLabelToInt
- *
- * Look up the integer value matching a given string label from the
- * given mapping table.  Return NULL if not found.
- ***********************************************************************/
-const int* PrvLabelToInt(const IntLabel* labels, const char* s)
-{
-    const IntLabel* p;
+            // on error retry once, then hand the rest to syslog(3)
+            if (retried || !PrvSyslogReconnect(fd))
+            {
+                break;
+            }
+            retried = true;
+        }
+    }
 
-    for (p = labels; p->s != NULL; p++)
+    if (sent < batch->count)
     {
-        if (strcmp(p->s, s) == 0)
+        sigset_t old_set;
+        block_signals(&old_set);
+        for (i = sent; i < batch->count; i++)
         {
-            return &p->n;
+            syslog(batch->levels[ i ], "%s", batch->lines[ i ] + batch->bodyOffsets[ i ]);
         }
+        unblock_signals(&old_set);
     }
 
-    return NULL;
+    batch->count = 0;
 }
 
 
-//#######################################################################
-
+/*********************************************************************/
+/* PrvSyslogBatchNext */
+/**
+@brief  Returns the line buffer for the next record of the batch,
+        flushing the batch first if it is full.
+**********************************************************************/
+static char* PrvSyslogBatchNext(PrvSyslogBatch *batch)
+{
+    if (batch->count == SYSLOG_MAX_BATCH)
+    {
+        PrvSyslogFlush(batch);
+    }
 
-/***********************************************************************
- * kLogLevelLabels
- *
- * Define string labels for the supported logging levels.
- ***********************************************************************/
-/*
- * Disable 'deprecatd declaration' warning around this table. We are the
- * ones who deprecated the Emergency, Alert, and Notice levels, but they
- * still need to be in this table.
- */
+    return batch->lines[ batch->count ];
+}
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
 
-static const IntLabel kLogLevelLabels[] =
+/*********************************************************************/
+/* PrvSyslogBatchAdd */
+/**
+@brief  Commits the line returned by PrvSyslogBatchNext to the batch.
+        The line goes to the ring of the process instead if it has one.
+**********************************************************************/
+static void PrvSyslogBatchAdd(PrvSyslogBatch *batch, int level,
+        size_t lineLen, size_t bodyOffset)
 {
-    // use the same labels as the syslog standards
-    { "none",        /* -1 */ kPmLogLevel_None },
-    //-----------------------
-    { "emerg",        /*  0 */ kPmLogLevel_Emergency },
-    { "alert",        /*  1 */ kPmLogLevel_Alert     },
-    { "crit",        /*  2 */ kPmLogLevel_Critical  },
-    { "err",        /*  3 */ kPmLogLevel_Error     },
-    { "warning",    /*  4 */ kPmLogLevel_Warning   },
-    { "notice",        /*  5 */ kPmLogLevel_Notice    },
-    { "info",        /*  6 */ kPmLogLevel_Info      },
-    { "debug",        /*  7 */ kPmLogLevel_Debug     },
-    //-----------------------
-    { NULL,            0 }
-};
+    unsigned int    i = batch->count;
+    struct iovec    body = { batch->lines[ i ] + bodyOffset, lineLen - bodyOffset };
 
-#pragma GCC diagnostic pop
+    if (PrvRingWrite(level, &body, 1))
+    {
+        return;
+    }
 
-/***********************************************************************
- * PmLogLevelToString
- *
- * Given a numeric level value, returning the matching symbolic string.
- * -1 (kPmLogLevel_None)      => "none"
- *  0 (kPmLogLevel_Emergency) => "emerg"
- * etc.
- * Returns NULL if the level is not valid.
- ***********************************************************************/
-const char* PmLogLevelToString(PmLogLevel level)
-{
-    const char*    s;
+    batch->count++;
 
-    s = PrvGetIntLabel(kLogLevelLabels, level);
-    return s;
+    batch->levels[ i ] = level;
+    batch->bodyOffsets[ i ] = bodyOffset;
+    batch->iov[ i ].iov_base = batch->lines[ i ];
+    batch->iov[ i ].iov_len = lineLen;
 }
 
 
-/***********************************************************************
- * PmLogStringToLevel
- *
- * Given a symbolic level string, returning the matching numeric value.
- * "none"  => -1 (kPmLogLevel_None)
- * "emerg" =>  0 (kPmLogLevel_Emergency)
- * etc.
- * Returns NULL if the level string is not mateched.
- ***********************************************************************/
-const int* PmLogStringToLevel(const char* levelStr)
+void CallSysLog(const char *context, const int level, const char* pidtid, const char* fmt, ...)
 {
-    const int*    nP;
+    char    line[ SYSLOG_SHORT_LEN ];
+    char    text[ BUFFER_LEN ];
+    size_t  bodyOffset;
+    size_t  lineLen;
+    va_list args;
 
-    nP = PrvLabelToInt(kLogLevelLabels, levelStr);
-    return nP;
+    PrvLogEnter();
+
+    va_start (args, fmt);
+    g_vsnprintf (text, sizeof(text), fmt, args);
+    va_end (args);
+
+    lineLen = PrvSyslogFormat(line, sizeof(line), &bodyOffset, level,
+                              "%s %s %s %s", pidtid, PMLOG_IDENTIFIER, context, text);
+
+    PrvSyslogSend(level, line, lineLen, bodyOffset);
+
+    PrvLogLeave();
 }
 
+#ifdef DEBUG_ENABLED
+    /***********************************************************************
+     * DbgPrint
+     ***********************************************************************/
+    #define DbgPrint(...) \
+        {                                                                           \
+            fprintf(stdout, COMPONENT_PREFIX __VA_ARGS__);                          \
+            CallSysLog(COMPONENT_PREFIX, "[]", __VA_ARGS__)                         \
+        }
 
-//#######################################################################
+    #define ErrPrint(context, pidtid, ...) \
+        {                                                                           \
+            fprintf(stderr, context __VA_ARGS__);                                   \
+            fprintf(stderr, "\n");                                                  \
+            CallSysLog(context, pidtid, __VA_ARGS__);                               \
+        }
+
+    #define WarnPrint(context, pidtid, ...) \
+        {                                                                           \
+            fprintf(stderr, context __VA_ARGS__);                                   \
+            fprintf(stderr, "\n");                                                  \
+            CallSysLog(context, pidtid, __VA_ARGS__);                               \
+        }
+#else
+    /***********************************************************************
+     * DbgPrint
+     ***********************************************************************/
+    #define DbgPrint(pidtid, ...)
+
+    /***********************************************************************
+    * ErrPrint
+    ***********************************************************************/
+    #define ErrPrint(context, pidtid, ...) CallSysLog(context, LOG_ERR, pidtid, __VA_ARGS__)
 
+    /***********************************************************************
+    * WarnPrint
+    ***********************************************************************/
+    #define WarnPrint(context, pidtid, ...) CallSysLog(context, LOG_WARNING, pidtid, __VA_ARGS__)
+#endif // DEBUG_ENABLED
 
 /***********************************************************************
- * kLogFacilityLabels
+ * DEBUG_LOGGING
  *
- * Define string labels for the supported logging facilities.
- ***********************************************************************/
-static const IntLabel kLogFacilityLabels[] =
-{
-    //-----------------------
-    { "kern",        /*  (0<<3) */ LOG_KERN     },
-    { "user",        /*  (1<<3) */ LOG_USER     },
-    { "mail",        /*  (2<<3) */ LOG_MAIL     },
-    { "daemon",        /*  (3<<3) */ LOG_DAEMON   },
-    { "auth",        /*  (4<<3) */ LOG_AUTH     },
-    { "syslog",        /*  (5<<3) */ LOG_SYSLOG   },
-    { "lpr",        /*  (6<<3) */ LOG_LPR      },
-    { "news",        /*  (7<<3) */ LOG_NEWS     },
-    { "uucp",        /*  (8<<3) */ LOG_UUCP     },
-    { "cron",        /*  (9<<3) */ LOG_CRON     },
-    { "authpriv",    /* (10<<3) */ LOG_AUTHPRIV },
-    { "ftp",        /* (11<<3) */ LOG_FTP      },
-    //-----------------------
-    { "local0",        /* (16<<3) */ LOG_LOCAL0   },
-    { "local1",        /* (17<<3) */ LOG_LOCAL1   },
-    { "local2",        /* (18<<3) */ LOG_LOCAL2   },
-    { "local3",        /* (19<<3) */ LOG_LOCAL3   },
-    { "local4",        /* (20<<3) */ LOG_LOCAL4   },
-    { "local5",        /* (21<<3) */ LOG_LOCAL5   },
-    { "local6",        /* (22<<3) */ LOG_LOCAL6   },
-    { "local7",        /* (23<<3) */ LOG_LOCAL7   },
-    //-----------------------
-    { NULL,            0 }
-};
+ * Because the PmLog global initialization will occur on first use that
+ * means it may occur before PmLogDaemon is running.  In which case we
+ * can't do logging or print debugging information as it will get
+ * dropped.  To work around that we can direct our local logs to a
+ * separate file.
+ * ?? Later, consider having this integrated into the main bottleneck,
+ * e.g. PrvLogWrite.  We can have a field in the shared memory that
+ * is a flag set by PmLogDaemon when it is running.  If logging is done
+ * before that we can manually append to either a separate or the main
+ * log file.  That way we'll be sure not to drop any messages during
+ * boot or if PmLogDaemon doesn't run for some reason.
+ * To be revisited after the OE build switch is complete.
+ ***********************************************************************/
 
+// don't check in with this on!
+//#define DEBUG_LOGGING
 
-/***********************************************************************
- * PmLogFacilityToString
- *
- * Given a numeric facility value, returning the matching symbolic string.
- * LOG_KERN => "kern"
- * LOG_USER => "user"
- * etc.
- * Returns NULL if the facility is not valid.
- ***********************************************************************/
-const char* PmLogFacilityToString(int facility)
+
+#ifdef DEBUG_LOGGING
+
+
+/*********************************************************************/
+/* PrintAppendToFile */
+/**
+@brief  Logs the specified formatted text to the specified context.
+**********************************************************************/
+static void PrintAppendToFile(const char* filePath, const char* fmt, ...)
 {
-    const char*    s;
+    va_list args;
+    FILE*    f;
 
-    s = PrvGetIntLabel(kLogFacilityLabels, facility);
-    return s;
+    va_start(args, fmt);
+
+    f = fopen(filePath, "a");
+    if (f != NULL)
+    {
+        fprintf(f, "%s: ", __progname);
+
+        vfprintf(f, fmt, args);
+
+        (void) fclose(f);
+    }
+
+    va_end(args);
 }
 
 
 /***********************************************************************
- * PmLogStringToFacility
- *
- * Given a symbolic facility string, returning the matching numeric value.
- * "kern" => LOG_KERN
- * "user" =>  LOG_USER
- * etc.
- * Returns NULL if the facility string is not matched.
+ * DbgPrint
  ***********************************************************************/
-const int* PmLogStringToFacility(const char* facilityStr)
-{
-    const int* nP;
+#undef DbgPrint
+#define DbgPrint(...) \
+    {                                                            \
+        const char* path = WEBOS_INSTALL_LOGDIR "/pmlog.log";                \
+        PrintAppendToFile(path, COMPONENT_PREFIX __VA_ARGS__);    \
+    }
 
-    nP = PrvLabelToInt(kLogFacilityLabels, facilityStr);
-    return nP;
-}
+/***********************************************************************
+ * ErrPrint
+ ***********************************************************************/
+#undef ErrPrint
+#define ErrPrint    DbgPrint
 
 
-//#######################################################################
+#endif // DEBUG_LOGGING
 
 
 /***********************************************************************
- * PrvGetLevelStr
- *
+ * tPidStr
  *
- * Given a numeric level value, returning the matching symbolic string.
- * -1 (kPmLogLevel_None)      => "none"
- *  0 (kPmLogLevel_Emergency) => "emerg"
- * etc.
- * Return "?" if not recognized (should not occur).
+ * The "[pid]" and "[pid:tid]" prefixes of the calling thread, formatted
+ * on first use.  Only the forking thread survives in a child, so
+ * PrvPidStrChildFork resetting its copy is all fork needs.
  ***********************************************************************/
-static const char* PrvGetLevelStr(int level)
+static __thread struct
 {
-    const char* s;
+    bool    valid;
+    bool    sameIds;    /* tid == pid, i.e. the main thread */
+    char    pid[ PIDSTR_LEN ];
+    char    pidTid[ PIDSTR_LEN ];
+}
+tPidStr;
 
-    s = PmLogLevelToString(level);
-    if (s != NULL)
-    {
-        return s;
-    }
 
-    return "?";
+/***********************************************************************
+ * PrvPidStrChildFork
+ *
+ * pthread_atfork child handler: the cached ids belong to the parent.
+ ***********************************************************************/
+static void PrvPidStrChildFork(void)
+{
+    tPidStr.valid = false;
 }
 
 
 /***********************************************************************
- * PrvParseConfigLevel
+ * GetPidStr
  *
- * "none" => -1 (kPmLogLevel_None)
- * "err"  => LOG_ERR (kPmLogLevel_Error),
- * etc.
- * Return true if parsed OK, else false.
+ * Return a formatted string containing the process and thread ids
+ * according to the context flags.
  ***********************************************************************/
-static bool PrvParseConfigLevel(const char* s, int* levelP)
+void GetPidStr(PmLogContext_ *context,char *ptidStr,long int ptidStrLen)
 {
-    const int* nP;
+    pid_t    pid;
+    pid_t    tid;
 
-    nP = PmLogStringToLevel(s);
-    if (nP != NULL)
-    {
-        *levelP = *nP;
-        return true;
+    if ((context->info.flags & kPmLogFlag_LogProcessIds) ||
+        (context->info.flags & kPmLogFlag_LogThreadIds)) {
+        if (!tPidStr.valid) {
+            pid = getpid();
+            tid = gettid();
+            snprintf(tPidStr.pid, sizeof(tPidStr.pid), "[%d]", (int) pid);
+            snprintf(tPidStr.pidTid, sizeof(tPidStr.pidTid), "[%d:%d]",
+                (int) pid, (int) tid);
+            tPidStr.sameIds = (tid == pid);
+            __atomic_signal_fence(__ATOMIC_SEQ_CST);
+            tPidStr.valid = true;
+        }
+        if (context->info.flags & kPmLogFlag_LogThreadIds &&
+            !tPidStr.sameIds) {
+            g_strlcpy(ptidStr, tPidStr.pidTid, ptidStrLen);
+        } else {
+            g_strlcpy(ptidStr, tPidStr.pid, ptidStrLen);
+        }
+    } else {
+        g_strlcpy(ptidStr, "[]", ptidStrLen);
     }
-
-    *levelP = -1;
-    return false;
 }
 
-/*********************************************************************/
-/* PrvResolveContext */
-/**
-@brief  Resolve a public PmLogContext pointer to the corresponding
-        PmLogContext_ pointer.
-        Also, resolve a NULL pointer to the real pointer of the
-        global context.
-**********************************************************************/
-static inline PmLogContext_* PrvResolveContext(PmLogContext context)
-{
-    return (context == NULL) ? gGlobalContextP : (PmLogContext_*) context;
-}
 
-/*********************************************************************/
-/* PrvIsGlobalContext */
-/**
-@brief  Returns true if the specified context pointer is for the
-        global context.
-**********************************************************************/
-static inline bool PrvIsGlobalContext(const PmLogContext_* contextP)
-{
-    // context should already have been resolved
-    assert(contextP != NULL);
-    return (contextP == gGlobalContextP);
-}
+//#######################################################################
 
-/*********************************************************************/
-/* PrvInitContext */
-/**
-@brief  Read the configuration file for pre-defined contexts and
-        context levels.
-**********************************************************************/
-static bool PrvInitContext(const char* contextName, const char* levelStr,
-    char* errMsg, size_t errMsgBuffSize)
+/*********************************************************************
+ * validate_msgid
+ *
+ * Ensure that a provided MSGID meets the following constraints:
+ *   The pointer is non-NULL
+ *   It is not an empty string
+ *   It does not contain a space, '{' or '}'
+ *   It consists of less than 32 charaters.
+ *
+ * Returns kPmLogErr_none on success, else kPmLogErr_InvalidMsgID
+ *
+ *********************************************************************/
+static PmLogErr validate_msgid(const char *msgid, PmLogContext_ *context_ptr)
 {
-    PmLogErr        logErr;
-    PmLogContext    context;
-    PmLogContext_   *contextP;
-    int                level;
-
-    errMsg[ 0 ] = 0;
+//! This macro can be defined to restrict logging
+//! to whitelist logs
+#ifndef ENABLE_WHITELIST
+    int         msgid_len = 0;
+    const char  *ptr_index = NULL;
+    char        ptidStr[ PIDSTR_LEN ];
 
-    DbgPrint("defining %s => %s\n", contextName, levelStr);
+    GetPidStr(context_ptr, ptidStr, sizeof(ptidStr));
 
-    level = kPmLogLevel_Debug;
-    if (!PrvParseConfigLevel(levelStr, &level))
-    {
-        mystrcpy(errMsg, errMsgBuffSize, "Failed to parse level");
-        return false;
+    if (!msgid) {
+        ErrPrint(context_ptr->component,
+                 ptidStr,
+                 "NULL_MSGID {} NULL MSGID provided for non-debug log");
+        return kPmLogErr_InvalidMsgID;
     }
 
-    context = NULL;
-    logErr = PmLogGetContext(contextName, &context);
-    if (logErr != kPmLogErr_None)
-    {
-        snprintf(errMsg, errMsgBuffSize, "Error getting context: %s",
-            PmLogGetErrDbgString(logErr));
-        return false;
+    // Check each character in msgid against our list of invalid ones.
+    for (ptr_index = msgid, msgid_len = 0; *ptr_index != '\0'; ++ptr_index, ++msgid_len) {
+        if (msgid_len >= MSGID_LEN) {
+            ErrPrint(context_ptr->component,
+                     ptidStr,
+                     "LONG_MSGID {\"MSGID\":\"%s\"} MSGID's length is restricted within 32 characters",
+                     msgid);
+            return kPmLogErr_InvalidMsgID;
+        }
+
+        if (strchr(" {}", *ptr_index) != NULL) {
+            ErrPrint(context_ptr->component,
+                     ptidStr,
+                     "INVALID_MSGID {\"MSGID\":\"%s\"} MSGID contains space, { or }.",
+                     msgid);
+            return kPmLogErr_InvalidMsgID;
+        }
     }
 
-    logErr = PmLogSetContextLevel(context, level);
-    if (logErr != kPmLogErr_None)
-    {
-        snprintf(errMsg, errMsgBuffSize, "Error setting context level: %s",
-            PmLogGetErrDbgString(logErr));
-        return false;
+    if (msgid_len == 0) {
+        return kPmLogErr_EmptyMsgID;
     }
+#endif
+    return kPmLogErr_None;
+}
 
-    /* initializing context flags with global values by default */
-    contextP = PrvResolveContext(context);
-    if (contextP == NULL)
+/***********************************************************************
+ * mystrcpy
+ *
+ * Easy to use wrapper for strcpy to make is safe against buffer
+ * overflows and to report any truncations.
+ ***********************************************************************/
+static void mystrcpy(char* dst, size_t dstSize, const char* src)
+{
+    size_t    srcLen;
+
+    if (dst == NULL)
     {
-        snprintf(errMsg, errMsgBuffSize, "Error setting context flags: %s",
-            PmLogGetErrDbgString(kPmLogErr_ContextNotFound));
-        return false;
+        DbgPrint("mystrcpy null dst\n");
+        return;
     }
 
-    if (gGlobalContextP)
+    if (dstSize < 1)
     {
-        contextP->info.flags = gGlobalContextP->info.flags;
+        DbgPrint("mystrcpy invalid dst size\n");
+        return;
     }
-    return true;
-}
 
-/*********************************************************************/
-/* PrvSetFlag */
-/**
-@brief  Set or clear the flag bit as indicated.
-**********************************************************************/
-static void PrvSetFlag(int* flagsP, int flagValue, bool set)
-{
-    if (set)
+    dst[ 0 ] = 0;
+
+    if (src == NULL)
     {
-        *flagsP = *flagsP | flagValue;
+        DbgPrint("mystrcpy null src\n");
+        return;
     }
-    else
+
+    srcLen = strlen(src);
+    if (srcLen >= dstSize)
     {
-        *flagsP = *flagsP & (~flagValue);
+        DbgPrint("mystrcpy buffer overflow\n");
+        srcLen = dstSize - 1;
     }
+
+    memcpy(dst, src, srcLen);
+    dst[ srcLen ] = 0;
 }
 
 /***********************************************************************
- * PrvSetContextFlag
+ * strtruncate_and_escape
  *
- * @brief                 Sets / resets logging context flag.
- * @param[in] contextP    Pointer to target context.
- * @param[in] flag        Flag to operate on.
- * @param[in] set         Flag value to set or reset.
- * @return................Error code
+ * Truncate source string to TRUNCATED_MSG_SIZE and return newly
+ * allcoated escaped string
  ***********************************************************************/
-PmLogErr PrvSetContextFlag(PmLogContext_ * contextP, int flag, bool set)
+static inline gchar *strtruncate_and_escape(const char* source)
 {
-    if (contextP == NULL)
-    {
-        return kPmLogErr_InvalidContext;
-    }
+    char buffer[TRUNCATED_MSG_SIZE] = {0};
+    strncpy(buffer, source, TRUNCATED_MSG_SIZE - 1);
+    return g_strescape(buffer, NULL);
+}
 
-    PrvSetFlag(&(contextP->info.flags), flag, set);
-    /* we should also mark flags as overridden */
-    PrvSetFlag(&(contextP->info.flags), kPmLogFlag_Overridden, true);
+/***********************************************************************
+ * Shared memory ring transport
+ *
+ * While a consumer (pmlogdaemon) has registered itself with
+ * PmLogPrvRingSetConsumer, each process creates a ring in
+ * PMLOG_RING_PATH_PREFIX<pid> and writes its records there instead of
+ * sending them to syslogd: no syscall and no kernel copy per record.
+ *
+ * The ring has many producers (the threads of the process, signal
+ * handlers included) and one reader.  A producer reserves space by
+ * advancing 'head' with a CAS, writes the entry and publishes it by
+ * setting its state last.  The reader consumes entries in order at
+ * 'tail', and clears them before handing the space back, so a state
+ * word that isn't set always means "not written yet".
+ *
+ * The reader sleeps on a futex on 'waiting'.  Producers only touch it
+ * when the reader has announced that it sleeps.
+ *
+ * Records are sent to syslogd as before if no reader is attached to
+ * the ring, or if it is full.
+ ***********************************************************************/
+#define RING_SIGNATURE      0x504C5201      // 'PLR' + 0x01
+#define RING_SIZE           (256 * 1024)    // power of 2
+#define RING_ALIGN(n)       (((n) + 7) & ~((size_t) 7))
 
-    return kPmLogErr_None;
+enum
+{
+    kRingEntry_Empty     = 0,
+    kRingEntry_Record    = 1,
+    kRingEntry_Padding   = 2    /* skip to the start of the ring */
+};
+
+typedef struct
+{
+    uint32_t    signature;      /* set last when the ring is created */
+    uint32_t    size;           /* of data */
+    int32_t     pid;            /* of the producer */
+    int32_t     consumer;       /* pid of the attached reader, or 0 */
+    uint32_t    waiting;        /* futex word, 1 while the reader sleeps */
+    uint32_t    reserved;
+    char        ident[ MAX_PROGRAM_NAME ];
+    uint64_t    head __attribute__((aligned(64)));  /* producers */
+    uint64_t    tail __attribute__((aligned(64)));  /* reader */
+    char        data[] __attribute__((aligned(64)));
 }
+PrvRingHeader;
 
-static void parse_config_flags(jvalue_ref j_context, const gchar *file_name, const char *context_name)
+typedef struct
 {
-    jvalue_ref    value;
-    bool          ret;
-    bool          flag_value;
-    int           flags = 0;
-    PmLogContext  context;
-    PmLogContext_ *context_ptr;
-    int           err;
-    char          ptidStr[ PIDSTR_LEN ];
+    uint32_t    size;           /* total size of the entry in the ring */
+    uint32_t    state;          /* kRingEntry_*, written last */
+    int32_t     level;
+    uint32_t    len;
+    int64_t     sec;
+    int64_t     nsec;
+    /* followed by the text, '\0' terminated */
+}
+PrvRingEntry;
 
-    err = PmLogGetContext(context_name, &context);
-    if (kPmLogErr_None != err) {
-        DbgPrint("FLG_CONTEXT_ERR {\"file\":\"%s\",\"context\":\"%s\"}",
-                 file_name, context_name);
+/*
+ * Anything in the mapping can be written by the producer, so the reader
+ * keeps its own copy of the header fields it relies on, and checks each
+ * entry before using it.  A ring with a bad entry is unmapped: 'header'
+ * is NULL from then on.
+ */
+struct PmLogRing
+{
+    PrvRingHeader   *header;
+    size_t          mapSize;
+    uint32_t        size;       /* of data, as when the ring was opened */
+    pid_t           pid;
+    uint64_t        tail;
+    uint32_t        pending;    /* size of the entry last returned */
+    char            ident[ MAX_PROGRAM_NAME ];
+    char            path[ 64 ];
+};
+
+// this process' ring, if any
+static struct
+{
+    PrvRingHeader   *header;
+    size_t          mapSize;
+}
+gRing;
+
+
+/*********************************************************************/
+/* PrvRingPath */
+/**
+@brief  Formats the path of the ring of the given process.
+**********************************************************************/
+static void PrvRingPath(char *path, size_t pathSize, pid_t pid)
+{
+    snprintf(path, pathSize, "%s%d", PMLOG_RING_PATH_PREFIX, (int) pid);
+}
+
+
+/*********************************************************************/
+/* PrvRingCreate */
+/**
+@brief  Creates and maps the ring of this process, if a consumer is
+        registered and still running.  The registration of a consumer
+        that has exited is cleared, so processes stop creating rings
+        nobody reads.
+**********************************************************************/
+static void PrvRingCreate(void)
+{
+    PrvRingHeader   *header;
+    char            path[ 64 ];
+    size_t          mapSize;
+    int32_t         consumer;
+    int             fd;
+
+    if (gGlobalsP == NULL)
+    {
         return;
     }
 
-    context_ptr = PrvResolveContext(context);
+    consumer = __atomic_load_n(&gGlobalsP->ringConsumer, __ATOMIC_ACQUIRE);
+    if (consumer <= 0)
+    {
+        return;
+    }
 
-    if (!context_ptr) {
-        ErrPrint(COMPONENT_PREFIX, ptidStr, "FLG_RSVL_ERR {\"file\":\"%s\",\"context\":\"%s\"}",
-                 file_name, context_name);
+    if ((kill(consumer, 0) == -1) && (errno == ESRCH))
+    {
+        (void) __atomic_compare_exchange_n(&gGlobalsP->ringConsumer, &consumer, 0,
+                                           false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
         return;
     }
 
-    GetPidStr(context_ptr, ptidStr, sizeof(ptidStr));
+    PrvRingPath(path, sizeof(path), getpid());
+    mapSize = sizeof(PrvRingHeader) + RING_SIZE;
 
-    ret = jobject_get_exists(j_context, j_cstr_to_buffer(LOG_PROCESS_IDS_TAG), &value);
-    if (ret) { //found logProcessIds
-        if (CONV_OK == jboolean_get(value, &flag_value)) {
-            if (true == flag_value)
-                flags |= kPmLogFlag_LogProcessIds;
-            else
-                flags &= ~kPmLogFlag_LogProcessIds;
-        } else {
-            ErrPrint(COMPONENT_PREFIX, ptidStr, "INV_PSID {\"file\":\"%s\",\"context\":\"%s\"}",
-                     file_name, context_name);
-        }
-    }
+    // a stale ring of an earlier process with our pid may still be
+    // mapped by the reader, so replace the file rather than reuse it
+    (void) unlink(path);
 
-    ret = jobject_get_exists(j_context, j_cstr_to_buffer(LOG_THREAD_IDS_TAG), &value);
-    if (ret) { //found logThreadIds
-        if (CONV_OK == jboolean_get(value, &flag_value)) {
-            if (true == flag_value)
-                flags |= kPmLogFlag_LogThreadIds;
-            else
-                flags &= ~kPmLogFlag_LogThreadIds;
-        } else {
-            ErrPrint(COMPONENT_PREFIX, ptidStr, "INV_THID {\"file\":\"%s\",\"context\":\"%s\"}",
-                     file_name, context_name);
-        }
+    fd = open(path, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+    if (fd == -1)
+    {
+        DbgPrint("ring open error: %s\n", strerror(errno));
+        return;
     }
 
-    ret = jobject_get_exists(j_context, j_cstr_to_buffer(LOG_TO_CONSOLE_TAG), &value);
-    if (ret) { //found logToConsole
-        if (CONV_OK == jboolean_get(value, &flag_value)) {
-            if (true == flag_value)
-                flags |= kPmLogFlag_LogToConsole;
-            else
-                flags &= ~kPmLogFlag_LogToConsole;
-        } else {
-            ErrPrint(COMPONENT_PREFIX, ptidStr, "INV_LOG_TO_CON {\"file\":\"%s\",\"context\":\"%s\"}",
-                     file_name, context_name);
-        }
+    if (ftruncate(fd, mapSize) == -1)
+    {
+        DbgPrint("ring ftruncate error: %s\n", strerror(errno));
+        close(fd);
+        (void) unlink(path);
+        return;
     }
 
-    if (!flags)
+    header = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED)
+    {
+        DbgPrint("ring mmap error: %s\n", strerror(errno));
+        (void) unlink(path);
         return;
-
-    //Set all the flags at once
-    err = PrvSetContextFlag(context_ptr, flags, true);
-    if (err != kPmLogErr_None) {
-        ErrPrint(COMPONENT_PREFIX, ptidStr, "SET_CTX_FLG_ERR {\"file\":\"%s\",\"context\":\"%s\"}",
-                 file_name, context_name);
     }
+
+    header->size = RING_SIZE;
+    header->pid = getpid();
+    mystrcpy(header->ident, sizeof(header->ident), __progname);
+    __atomic_store_n(&header->signature, RING_SIGNATURE, __ATOMIC_RELEASE);
+
+    gRing.header = header;
+    gRing.mapSize = mapSize;
 }
 
-static bool parse_config_overrides(jvalue_ref j_overrides, const gchar *file_name)
+
+/*********************************************************************/
+/* PrvRingChildFork */
+/**
+@brief  fork() child handler.  The child gets a ring of its own.
+**********************************************************************/
+static void PrvRingChildFork(void)
 {
-    for (ssize_t i = 0; i < jarray_size(j_overrides); i++) {
-        jvalue_ref j_override = jarray_get(j_overrides, i);
-        if (!jis_object(j_override)) {
-            ErrPrint(COMPONENT_PREFIX, "[]", "PARSE_ERROR {\"file\":\"%s\",\"index\":%zd} Invalid override (ignoring)",
-                     file_name, i);
-            continue;
-        }
+    if (gRing.header != NULL)
+    {
+        (void) munmap(gRing.header, gRing.mapSize);
+        gRing.header = NULL;
+    }
 
-        jvalue_ref j_value;
-        raw_buffer name;
-        raw_buffer level_str;
-        int           level;
-        bool       valid_level = false;
-        if (jobject_get_exists(j_override, J_CSTR_TO_BUF("name"), &j_value)) {
-            name = jstring_get(j_value);
-        } else { // global overrides
-            name = j_str_to_buffer(NULL, 0);
-        }
+    PrvRingCreate();
+}
 
-        if (jobject_get_exists(j_override, j_cstr_to_buffer(LOG_LEVEL_TAG), &j_value)) {
-            level_str = jstring_get(j_value);
-            valid_level = PrvParseConfigLevel(level_str.m_str, &level);
-            if (!valid_level) {
-                ErrPrint(COMPONENT_PREFIX, "[]", "PARSE_ERROR {\"file\":\"%s\",\"index\":%zu} Invalid log level \"%s\" (ignoring)",
-                         file_name, i, level_str.m_str);
-            }
-        } else { // global overrides
-            level_str = j_str_to_buffer(NULL, 0);
-        }
 
-        if (valid_level) {
-            PmLogErr log_err;
-            const char *context_name;
-            if (name.m_str == NULL) {
-                int contexts_count;
-                context_name = "<all>";
-                log_err = PmLogGetNumContexts(&contexts_count);
-                if (log_err == kPmLogErr_None) {
-                    PmLogContext context;
-                    for (int n = 0; n < contexts_count; ++n) {
-                        log_err = PmLogGetIndContext(n, &context);
-                        if (log_err != kPmLogErr_None) break;
+/*********************************************************************/
+/* PrvRingDestroy */
+/**
+@brief  Removes the ring of this process at exit, unless a reader is
+        attached, which removes it once it has read everything.
+**********************************************************************/
+static void PrvRingDestroy(void)
+{
+    char path[ 64 ];
 
-                        log_err = PmLogSetContextLevel(context, level);
+    if ((gRing.header == NULL) ||
+        (__atomic_load_n(&gRing.header->consumer, __ATOMIC_ACQUIRE) != 0))
+    {
+        return;
+    }
 
-                        if (log_err != kPmLogErr_None) {
-                            // remember at which context we've met an error
-                            context_name = PrvResolveContext(context)->component;
-                            break;
-                        }
-                    }
-                }
-            } else {
-                PmLogContext context;
-                context_name = name.m_str;
-                log_err = PmLogGetContext(context_name, &context);
-                if (log_err == kPmLogErr_None) {
-                    log_err = PmLogSetContextLevel(context, level);
-                }
-            }
-            if (log_err != kPmLogErr_None) {
-                ErrPrint(COMPONENT_PREFIX, "[]", "SET_CTX_LEVEL_FAIL {\"file\":\"%s\", \"index\":%d} Failed to set log level for %s: %s",
-                         file_name, i, context_name, PmLogGetErrDbgString(log_err));
-            }
-        }
+    PrvRingPath(path, sizeof(path), gRing.header->pid);
+    (void) unlink(path);
+}
+
+
+/*********************************************************************/
+/* PrvRingWrite */
+/**
+@brief  Writes one record, the text of which is gathered from iov, into
+        the ring of this process.  Returns false if it has to be sent
+        to syslogd instead.
+**********************************************************************/
+static bool PrvRingWrite(int level, const struct iovec *iov, int iovcnt)
+{
+    PrvRingHeader   *header = gRing.header;
+    PrvRingEntry    *entryP;
+    struct timespec now;
+    uint64_t        head;
+    uint64_t        tail;
+    uint32_t        mask;
+    size_t          size;
+    size_t          contiguous;
+    size_t          padding;
+    size_t          len = 0;
+    char            *text;
+    int             i;
+
+    if ((header == NULL) || (__atomic_load_n(&header->consumer, __ATOMIC_RELAXED) == 0))
+    {
+        return false;
+    }
+
+    for (i = 0; i < iovcnt; i++)
+    {
+        len += iov[ i ].iov_len;
+    }
+
+    size = RING_ALIGN(sizeof(PrvRingEntry) + len + 1);
+    if (size > header->size / 4)
+    {
+        return false;
+    }
+
+    mask = header->size - 1;
+    (void) clock_gettime(CLOCK_REALTIME, &now);
+
+    // an entry never wraps, the rest of the ring is skipped instead
+    head = __atomic_load_n(&header->head, __ATOMIC_RELAXED);
+    do
+    {
+        tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+        contiguous = header->size - (head & mask);
+        padding = (contiguous < size) ? contiguous : 0;
+
+        if (padding + size > header->size - (head - tail))
+        {
+            return false;
+        }
+    }
+    while (!__atomic_compare_exchange_n(&header->head, &head, head + padding + size,
+                                        true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    if (padding != 0)
+    {
+        entryP = (PrvRingEntry*) (header->data + (head & mask));
+        entryP->size = padding;
+        __atomic_store_n(&entryP->state, kRingEntry_Padding, __ATOMIC_RELEASE);
+        head += padding;
+    }
+
+    entryP = (PrvRingEntry*) (header->data + (head & mask));
+    entryP->size = size;
+    entryP->level = level;
+    entryP->len = len;
+    entryP->sec = now.tv_sec;
+    entryP->nsec = now.tv_nsec;
+
+    text = (char*) (entryP + 1);
+    for (i = 0; i < iovcnt; i++)
+    {
+        memcpy(text, iov[ i ].iov_base, iov[ i ].iov_len);
+        text += iov[ i ].iov_len;
+    }
+    *text = '\0';
+
+    // pairs with the reader setting 'waiting' before its last look
+    __atomic_store_n(&entryP->state, kRingEntry_Record, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&header->waiting, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&header->waiting, 0, __ATOMIC_SEQ_CST))
+    {
+        (void) syscall(SYS_futex, &header->waiting, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+
+    return true;
+}
+
+
+/*********************************************************************/
+/* PmLogPrvRingSetConsumer */
+/**
+@brief  Registers or unregisters the calling process as the reader of
+        the rings.
+**********************************************************************/
+PmLogErr PmLogPrvRingSetConsumer(bool consume)
+{
+    if ((gGlobalsP == NULL) || (gGlobalsP == &defaultSet))
+    {
+        return kPmLogErr_Unknown;
+    }
+
+    PmLogPrvLock();
+    gGlobalsP->ringConsumer = consume ? getpid() : 0;
+    PmLogPrvUnlock();
+
+    return kPmLogErr_None;
+}
+
+
+/*********************************************************************/
+/* PmLogPrvRingOpen */
+/**
+@brief  Maps the ring of the given process and attaches to it.
+**********************************************************************/
+PmLogErr PmLogPrvRingOpen(pid_t pid, PmLogRing **ringP)
+{
+    PmLogRing       *ring;
+    PrvRingHeader   *header;
+    struct stat     st;
+    int             fd;
+
+    if (ringP == NULL)
+    {
+        return kPmLogErr_InvalidParameter;
+    }
+    *ringP = NULL;
+
+    ring = calloc(1, sizeof(PmLogRing));
+    if (ring == NULL)
+    {
+        return kPmLogErr_Unknown;
+    }
+
+    PrvRingPath(ring->path, sizeof(ring->path), pid);
+
+    fd = open(ring->path, O_RDWR | O_CLOEXEC);
+    if (fd == -1)
+    {
+        free(ring);
+        return (errno == ENOENT) ? kPmLogErr_NoData : kPmLogErr_Unknown;
+    }
+
+    if ((fstat(fd, &st) == -1) || (st.st_size < (off_t) sizeof(PrvRingHeader)))
+    {
+        close(fd);
+        free(ring);
+        return kPmLogErr_InvalidData;
+    }
+
+    ring->mapSize = st.st_size;
+    header = mmap(NULL, ring->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED)
+    {
+        free(ring);
+        return kPmLogErr_Unknown;
+    }
+
+    // the signature is set last, read it first
+    if (__atomic_load_n(&header->signature, __ATOMIC_ACQUIRE) == RING_SIGNATURE)
+    {
+        ring->size = __atomic_load_n(&header->size, __ATOMIC_RELAXED);
+        ring->tail = __atomic_load_n(&header->tail, __ATOMIC_RELAXED);
+    }
+
+    if ((ring->size < RING_ALIGN(1)) || (ring->size & (ring->size - 1)) ||
+        (sizeof(PrvRingHeader) + ring->size != ring->mapSize) ||
+        (ring->tail != RING_ALIGN(ring->tail)))
+    {
+        (void) munmap(header, ring->mapSize);
+        free(ring);
+        return kPmLogErr_InvalidData;
+    }
+
+    ring->header = header;
+    ring->pid = pid;
+    memcpy(ring->ident, header->ident, sizeof(ring->ident));
+    ring->ident[ sizeof(ring->ident) - 1 ] = '\0';
+    __atomic_store_n(&header->consumer, getpid(), __ATOMIC_RELEASE);
+
+    *ringP = ring;
+    return kPmLogErr_None;
+}
+
+
+/*********************************************************************/
+/* PrvRingRelease */
+/**
+@brief  Clears the entry last returned by PmLogPrvRingRead and hands
+        its space back to the producers.
+**********************************************************************/
+static void PrvRingRelease(PmLogRing *ring)
+{
+    PrvRingHeader *header = ring->header;
+
+    if ((header == NULL) || (ring->pending == 0))
+    {
+        return;
+    }
+
+    memset(header->data + (ring->tail & (ring->size - 1)), 0, ring->pending);
+    ring->tail += ring->pending;
+    ring->pending = 0;
+
+    __atomic_store_n(&header->tail, ring->tail, __ATOMIC_RELEASE);
+}
+
+
+/*********************************************************************/
+/* PrvRingDrop */
+/**
+@brief  Unmaps a ring the producer has written a bad entry into.
+**********************************************************************/
+static void PrvRingDrop(PmLogRing *ring)
+{
+    DbgPrint("ring of %d is corrupted at %" PRIu64 "\n", (int) ring->pid, ring->tail);
+
+    (void) munmap(ring->header, ring->mapSize);
+    ring->header = NULL;
+    ring->pending = 0;
+}
+
+
+/*********************************************************************/
+/* PrvRingPeek */
+/**
+@brief  Returns the entry at the tail if it has been published, else
+        NULL.  *sizeP, *stateP and *lenP are set to the size, state and
+        text length of the entry, checked to lie within the ring.
+        Returns NULL and drops the ring if the entry is bad.
+**********************************************************************/
+static const PrvRingEntry* PrvRingPeek(PmLogRing *ring, uint32_t *sizeP,
+    uint32_t *stateP, uint32_t *lenP)
+{
+    const PrvRingHeader *header = ring->header;
+    const PrvRingEntry  *entryP;
+    uint32_t            offset;
+    uint32_t            size;
+    uint32_t            state;
+    uint32_t            len = 0;
+
+    if ((header == NULL) ||
+        (ring->tail == __atomic_load_n(&header->head, __ATOMIC_ACQUIRE)))
+    {
+        return NULL;
+    }
+
+    // the tail is always 8-byte aligned, so size and state are in the ring
+    offset = ring->tail & (ring->size - 1);
+    entryP = (const PrvRingEntry*) (header->data + offset);
+
+    state = __atomic_load_n(&entryP->state, __ATOMIC_SEQ_CST);
+    if (state == kRingEntry_Empty)
+    {
+        return NULL;
+    }
+
+    // read once: the producer may still change them under us
+    size = __atomic_load_n(&entryP->size, __ATOMIC_RELAXED);
+
+    if ((size == 0) || (size != RING_ALIGN(size)) || (size > ring->size - offset))
+    {
+        PrvRingDrop(ring);
+        return NULL;
+    }
+
+    if (state == kRingEntry_Record)
+    {
+        len = __atomic_load_n(&entryP->len, __ATOMIC_RELAXED);
+
+        if (sizeof(PrvRingEntry) + (uint64_t) len + 1 > size)
+        {
+            PrvRingDrop(ring);
+            return NULL;
+        }
+    }
+    else if (state != kRingEntry_Padding)
+    {
+        PrvRingDrop(ring);
+        return NULL;
+    }
+
+    *sizeP = size;
+    *stateP = state;
+    *lenP = len;
+    return entryP;
+}
+
+
+/*********************************************************************/
+/* PmLogPrvRingRead */
+/**
+@brief  Returns the next record of the ring.
+**********************************************************************/
+PmLogErr PmLogPrvRingRead(PmLogRing *ring, PmLogRingRecord *recordP)
+{
+    const PrvRingEntry  *entryP;
+    uint32_t            size;
+    uint32_t            state;
+    uint32_t            len;
+    char                *text;
+
+    if ((ring == NULL) || (recordP == NULL))
+    {
+        return kPmLogErr_InvalidParameter;
+    }
+
+    PrvRingRelease(ring);
+
+    while ((entryP = PrvRingPeek(ring, &size, &state, &len)) != NULL)
+    {
+        ring->pending = size;
+
+        if (state == kRingEntry_Record)
+        {
+            recordP->pid = ring->pid;
+            recordP->ident = ring->ident;
+            recordP->level = entryP->level;
+            recordP->time.tv_sec = entryP->sec;
+            recordP->time.tv_nsec = entryP->nsec;
+            recordP->len = len;
+
+            // checked by PrvRingPeek to fit in the entry; the terminator
+            // is written again in case the producer has overwritten it
+            text = (char*) (entryP + 1);
+            text[ len ] = '\0';
+            recordP->text = text;
+            return kPmLogErr_None;
+        }
+
+        PrvRingRelease(ring);
+    }
+
+    return (ring->header == NULL) ? kPmLogErr_InvalidData : kPmLogErr_NoData;
+}
+
+
+/*********************************************************************/
+/* PmLogPrvRingWait */
+/**
+@brief  Waits until the ring has a record to read.
+**********************************************************************/
+PmLogErr PmLogPrvRingWait(PmLogRing *ring, int timeoutMs)
+{
+    PrvRingHeader   *header;
+    struct timespec timeout;
+    uint32_t        size;
+    uint32_t        state;
+    uint32_t        len;
+    long            result;
+
+    if (ring == NULL)
+    {
+        return kPmLogErr_InvalidParameter;
+    }
+
+    header = ring->header;
+    if (header == NULL)
+    {
+        return kPmLogErr_InvalidData;
+    }
+
+    PrvRingRelease(ring);
+
+    // announce we are about to sleep, then look once more so a record
+    // published just before the announcement isn't missed
+    __atomic_store_n(&header->waiting, 1, __ATOMIC_SEQ_CST);
+    if (PrvRingPeek(ring, &size, &state, &len) != NULL)
+    {
+        __atomic_store_n(&header->waiting, 0, __ATOMIC_RELAXED);
+        return kPmLogErr_None;
+    }
+
+    if (ring->header == NULL)
+    {
+        // the bad entry is read again, and reported, by PmLogPrvRingRead
+        return kPmLogErr_None;
+    }
+
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+
+    result = syscall(SYS_futex, &header->waiting, FUTEX_WAIT, 1,
+                     (timeoutMs < 0) ? NULL : &timeout, NULL, 0);
+
+    __atomic_store_n(&header->waiting, 0, __ATOMIC_RELAXED);
+
+    if ((result == -1) && (errno == ETIMEDOUT))
+    {
+        return kPmLogErr_NoData;
+    }
+
+    return kPmLogErr_None;
+}
+
+
+/*********************************************************************/
+/* PmLogPrvRingClose */
+/**
+@brief  Detaches from the ring and unmaps it.  The ring is removed if
+        its process has exited.
+**********************************************************************/
+void PmLogPrvRingClose(PmLogRing *ring)
+{
+    int32_t consumer;
+
+    if (ring == NULL)
+    {
+        return;
+    }
+
+    if (ring->header != NULL)
+    {
+        PrvRingRelease(ring);
+
+        consumer = getpid();
+        (void) __atomic_compare_exchange_n(&ring->header->consumer, &consumer, 0,
+                                           false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+
+        (void) munmap(ring->header, ring->mapSize);
+    }
+
+    if ((kill(ring->pid, 0) == -1) && (errno == ESRCH))
+    {
+        (void) unlink(ring->path);
+    }
+
+    free(ring);
+}
+
+
+/***********************************************************************
+ * IntLabel
+ *
+ * Define a integer value => string label mapping.
+ ***********************************************************************/
+typedef struct
+{
+    const char* s;
+    int n;
+}
+IntLabel;
+
+
+/***********************************************************************
+ * PrvGetIntLabel
+ *
+ * Look up the string label for a given integer value from the given
+ * mapping table.  Return NULL if not found.
+ ***********************************************************************/
+const char* PrvGetIntLabel(const IntLabel* labels, int n);
+
+
+/***********************************************************************
+ * PrvLabelToInt
+ *
+ * Look up the integer value matching a given string label from the
+ * given mapping table.  Return NULL if not found.
+ ***********************************************************************/
+const int* PrvLabelToInt(const IntLabel* labels, const char* s);
+
+
+//#######################################################################
+
+
+/***********************************************************************
+ * PrvGetIntLabel
+ *
+ * Look up the string label for a given integer value from the given
+ * mapping table.  Return NULL if not found.
+ ***********************************************************************/
+const char* PrvGetIntLabel(const IntLabel* labels, int n)
+{
+    const IntLabel* p;
+
+    for (p = labels; p->s != NULL; p++)
+    {
+        if (p->n == n)
+        {
+            return p->s;
+        }
+    }
+
+    return NULL;
+}
+
+
+/***********************************************************************
+ * PrvLabelToInt
+ *
+ * Look up the integer value matching a given string label from the
+ * given mapping table.  Return NULL if not found.
+ ***********************************************************************/
+const int* PrvLabelToInt(const IntLabel* labels, const char* s)
+{
+    const IntLabel* p;
+
+    for (p = labels; p->s != NULL; p++)
+    {
+        if (strcmp(p->s, s) == 0)
+        {
+            return &p->n;
+        }
+    }
+
+    return NULL;
+}
+
+
+//#######################################################################
+
+
+/***********************************************************************
+ * kLogLevelLabels
+ *
+ * Define string labels for the supported logging levels.
+ ***********************************************************************/
+/*
+ * Disable 'deprecatd declaration' warning around this table. We are the
+ * ones who deprecated the Emergency, Alert, and Notice levels, but they
+ * still need to be in this table.
+ */
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+
+static const IntLabel kLogLevelLabels[] =
+{
+    // use the same labels as the syslog standards
+    { "none",        /* -1 */ kPmLogLevel_None },
+    //-----------------------
+    { "emerg",        /*  0 */ kPmLogLevel_Emergency },
+    { "alert",        /*  1 */ kPmLogLevel_Alert     },
+    { "crit",        /*  2 */ kPmLogLevel_Critical  },
+    { "err",        /*  3 */ kPmLogLevel_Error     },
+    { "warning",    /*  4 */ kPmLogLevel_Warning   },
+    { "notice",        /*  5 */ kPmLogLevel_Notice    },
+    { "info",        /*  6 */ kPmLogLevel_Info      },
+    { "debug",        /*  7 */ kPmLogLevel_Debug     },
+    //-----------------------
+    { NULL,            0 }
+};
+
+#pragma GCC diagnostic pop
+
+/***********************************************************************
+ * PmLogLevelToString
+ *
+ * Given a numeric level value, returning the matching symbolic string.
+ * -1 (kPmLogLevel_None)      => "none"
+ *  0 (kPmLogLevel_Emergency) => "emerg"
+ * etc.
+ * Returns NULL if the level is not valid.
+ ***********************************************************************/
+const char* PmLogLevelToString(PmLogLevel level)
+{
+    const char*    s;
+
+    s = PrvGetIntLabel(kLogLevelLabels, level);
+    return s;
+}
+
+
+/***********************************************************************
+ * PmLogStringToLevel
+ *
+ * Given a symbolic level string, returning the matching numeric value.
+ * "none"  => -1 (kPmLogLevel_None)
+ * "emerg" =>  0 (kPmLogLevel_Emergency)
+ * etc.
+ * Returns NULL if the level string is not mateched.
+ ***********************************************************************/
+const int* PmLogStringToLevel(const char* levelStr)
+{
+    const int*    nP;
+
+    nP = PrvLabelToInt(kLogLevelLabels, levelStr);
+    return nP;
+}
+
+
+//#######################################################################
+
+
+/***********************************************************************
+ * kLogFacilityLabels
+ *
+ * Define string labels for the supported logging facilities.
+ ***********************************************************************/
+static const IntLabel kLogFacilityLabels[] =
+{
+    //-----------------------
+    { "kern",        /*  (0<<3) */ LOG_KERN     },
+    { "user",        /*  (1<<3) */ LOG_USER     },
+    { "mail",        /*  (2<<3) */ LOG_MAIL     },
+    { "daemon",        /*  (3<<3) */ LOG_DAEMON   },
+    { "auth",        /*  (4<<3) */ LOG_AUTH     },
+    { "syslog",        /*  (5<<3) */ LOG_SYSLOG   },
+    { "lpr",        /*  (6<<3) */ LOG_LPR      },
+    { "news",        /*  (7<<3) */ LOG_NEWS     },
+    { "uucp",        /*  (8<<3) */ LOG_UUCP     },
+    { "cron",        /*  (9<<3) */ LOG_CRON     },
+    { "authpriv",    /* (10<<3) */ LOG_AUTHPRIV },
+    { "ftp",        /* (11<<3) */ LOG_FTP      },
+    //-----------------------
+    { "local0",        /* (16<<3) */ LOG_LOCAL0   },
+    { "local1",        /* (17<<3) */ LOG_LOCAL1   },
+    { "local2",        /* (18<<3) */ LOG_LOCAL2   },
+    { "local3",        /* (19<<3) */ LOG_LOCAL3   },
+    { "local4",        /* (20<<3) */ LOG_LOCAL4   },
+    { "local5",        /* (21<<3) */ LOG_LOCAL5   },
+    { "local6",        /* (22<<3) */ LOG_LOCAL6   },
+    { "local7",        /* (23<<3) */ LOG_LOCAL7   },
+    //-----------------------
+    { NULL,            0 }
+};
+
+
+/***********************************************************************
+ * PmLogFacilityToString
+ *
+ * Given a numeric facility value, returning the matching symbolic string.
+ * LOG_KERN => "kern"
+ * LOG_USER => "user"
+ * etc.
+ * Returns NULL if the facility is not valid.
+ ***********************************************************************/
+const char* PmLogFacilityToString(int facility)
+{
+    const char*    s;
+
+    s = PrvGetIntLabel(kLogFacilityLabels, facility);
+    return s;
+}
+
+
+/***********************************************************************
+ * PmLogStringToFacility
+ *
+ * Given a symbolic facility string, returning the matching numeric value.
+ * "kern" => LOG_KERN
+ * "user" =>  LOG_USER
+ * etc.
+ * Returns NULL if the facility string is not matched.
+ ***********************************************************************/
+const int* PmLogStringToFacility(const char* facilityStr)
+{
+    const int* nP;
+
+    nP = PrvLabelToInt(kLogFacilityLabels, facilityStr);
+    return nP;
+}
+
+
+//#######################################################################
+
+
+/***********************************************************************
+ * PrvGetLevelStr
+ *
+ *
+ * Given a numeric level value, returning the matching symbolic string.
+ * -1 (kPmLogLevel_None)      => "none"
+ *  0 (kPmLogLevel_Emergency) => "emerg"
+ * etc.
+ * Return "?" if not recognized (should not occur).
+ ***********************************************************************/
+static const char* PrvGetLevelStr(int level)
+{
+    const char* s;
+
+    s = PmLogLevelToString(level);
+    if (s != NULL)
+    {
+        return s;
+    }
+
+    return "?";
+}
+
+
+/***********************************************************************
+ * PrvParseConfigLevel
+ *
+ * "none" => -1 (kPmLogLevel_None)
+ * "err"  => LOG_ERR (kPmLogLevel_Error),
+ * etc.
+ * Return true if parsed OK, else false.
+ ***********************************************************************/
+static bool PrvParseConfigLevel(const char* s, int* levelP)
+{
+    const int* nP;
+
+    nP = PmLogStringToLevel(s);
+    if (nP != NULL)
+    {
+        *levelP = *nP;
+        return true;
+    }
+
+    *levelP = -1;
+    return false;
+}
+
+/*********************************************************************/
+/* PrvResolveContext */
+/**
+@brief  Resolve a public PmLogContext pointer to the corresponding
+        PmLogContext_ pointer.
+        Also, resolve a NULL pointer to the real pointer of the
+        global context.
+**********************************************************************/
+static inline PmLogContext_* PrvResolveContext(PmLogContext context)
+{
+    return (context == NULL) ? gGlobalContextP : (PmLogContext_*) context;
+}
+
+/*********************************************************************/
+/* PrvIsGlobalContext */
+/**
+@brief  Returns true if the specified context pointer is for the
+        global context.
+**********************************************************************/
+static inline bool PrvIsGlobalContext(const PmLogContext_* contextP)
+{
+    // context should already have been resolved
+    assert(contextP != NULL);
+    return (contextP == gGlobalContextP);
+}
+
+/*********************************************************************/
+/* PrvHashContextName */
+/**
+@brief  FNV-1a hash of the first len characters of a context name.
+**********************************************************************/
+static inline uint32_t PrvHashContextName(const char* name, size_t len)
+{
+    uint32_t    hash = 2166136261u;
+    size_t      i;
+
+    for (i = 0; i < len; i++)
+    {
+        hash ^= (uint8_t) name[ i ];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+/*********************************************************************/
+/* PrvIndexLookup */
+/**
+@brief  Looks up the user context whose name is the first len
+        characters of name, hash being PrvHashContextName of them.
+        Returns NULL if there is none.
+        Globals must be locked.
+**********************************************************************/
+static PmLogContext_* PrvIndexLookup(const char* name, size_t len,
+    uint32_t hash)
+{
+    uint32_t        slot;
+    int             entry;
+    PmLogContext_*  contextP;
+
+    for (slot = hash & (PMLOG_CONTEXT_INDEX_SIZE - 1); ;
+         slot = (slot + 1) & (PMLOG_CONTEXT_INDEX_SIZE - 1))
+    {
+        entry = gGlobalsP->contextIndex[ slot ];
+        if ((entry <= 0) || (entry > gGlobalsP->numUserContexts))
+        {
+            return NULL;
+        }
+
+        contextP = &gGlobalsP->userContexts[ entry - 1 ];
+        if ((strncmp(contextP->component, name, len) == 0) &&
+            (contextP->component[ len ] == 0))
+        {
+            return contextP;
+        }
+    }
+}
+
+
+/*********************************************************************/
+/* PrvIndexInsert */
+/**
+@brief  Adds userContexts[ i ] to the name index.
+        Globals must be locked.
+**********************************************************************/
+static void PrvIndexInsert(int i)
+{
+    const char* name = gGlobalsP->userContexts[ i ].component;
+    uint32_t    slot;
+
+    slot = PrvHashContextName(name, strlen(name)) & (PMLOG_CONTEXT_INDEX_SIZE - 1);
+
+    // the index is larger than the table, so there is always a free slot
+    while (gGlobalsP->contextIndex[ slot ] != 0)
+    {
+        slot = (slot + 1) & (PMLOG_CONTEXT_INDEX_SIZE - 1);
+    }
+
+    gGlobalsP->contextIndex[ slot ] = (int16_t) (i + 1);
+}
+
+
+/*********************************************************************/
+/* PrvLookupContext */
+/**
+@brief  Returns the context with the given name, global context
+        included, or NULL if there is none.
+        Globals must be locked, or the result checked with
+        PrvRegistryReadValid (see PrvLookupContextUnlocked).
+**********************************************************************/
+static PmLogContext_* PrvLookupContext(const char* contextName)
+{
+    size_t  len;
+
+    if (strcmp(contextName, gGlobalsP->globalContext.component) == 0)
+    {
+        return &gGlobalsP->globalContext;
+    }
+
+    len = strlen(contextName);
+
+    return PrvIndexLookup(contextName, len, PrvHashContextName(contextName, len));
+}
+
+
+/*********************************************************************/
+/* PrvInitContext */
+/**
+@brief  Read the configuration file for pre-defined contexts and
+        context levels.
+**********************************************************************/
+static bool PrvInitContext(const char* contextName, const char* levelStr,
+    char* errMsg, size_t errMsgBuffSize)
+{
+    PmLogErr        logErr;
+    PmLogContext    context;
+    PmLogContext_   *contextP;
+    int                level;
+
+    errMsg[ 0 ] = 0;
+
+    DbgPrint("defining %s => %s\n", contextName, levelStr);
+
+    level = kPmLogLevel_Debug;
+    if (!PrvParseConfigLevel(levelStr, &level))
+    {
+        mystrcpy(errMsg, errMsgBuffSize, "Failed to parse level");
+        return false;
+    }
+
+    context = NULL;
+    logErr = PmLogGetContext(contextName, &context);
+    if (logErr != kPmLogErr_None)
+    {
+        snprintf(errMsg, errMsgBuffSize, "Error getting context: %s",
+            PmLogGetErrDbgString(logErr));
+        return false;
+    }
+
+    logErr = PmLogSetContextLevel(context, level);
+    if (logErr != kPmLogErr_None)
+    {
+        snprintf(errMsg, errMsgBuffSize, "Error setting context level: %s",
+            PmLogGetErrDbgString(logErr));
+        return false;
+    }
+
+    /* initializing context flags with global values by default */
+    contextP = PrvResolveContext(context);
+    if (contextP == NULL)
+    {
+        snprintf(errMsg, errMsgBuffSize, "Error setting context flags: %s",
+            PmLogGetErrDbgString(kPmLogErr_ContextNotFound));
+        return false;
+    }
+
+    if (gGlobalContextP)
+    {
+        contextP->info.flags = gGlobalContextP->info.flags;
+    }
+    return true;
+}
+
+/*********************************************************************/
+/* PrvSetFlag */
+/**
+@brief  Set or clear the flag bit as indicated.
+**********************************************************************/
+static void PrvSetFlag(int* flagsP, int flagValue, bool set)
+{
+    if (set)
+    {
+        *flagsP = *flagsP | flagValue;
+    }
+    else
+    {
+        *flagsP = *flagsP & (~flagValue);
+    }
+}
+
+/***********************************************************************
+ * PrvSetContextFlag
+ *
+ * @brief                 Sets / resets logging context flag.
+ * @param[in] contextP    Pointer to target context.
+ * @param[in] flag        Flag to operate on.
+ * @param[in] set         Flag value to set or reset.
+ * @return................Error code
+ ***********************************************************************/
+PmLogErr PrvSetContextFlag(PmLogContext_ * contextP, int flag, bool set)
+{
+    if (contextP == NULL)
+    {
+        return kPmLogErr_InvalidContext;
+    }
+
+    PrvSetFlag(&(contextP->info.flags), flag, set);
+    /* we should also mark flags as overridden */
+    PrvSetFlag(&(contextP->info.flags), kPmLogFlag_Overridden, true);
+
+    return kPmLogErr_None;
+}
+
+/***********************************************************************
+ * Message policies
+ *
+ * The rate limit and the sampling of a context, or of one msgid of a
+ * context, share one PmLogMsgPolicy entry in the shared globals, so
+ * they are shared by all the processes logging to the context.  The
+ * entries of a context are chained from it.  For each of the two, a
+ * msgid takes precedence over the whole context: a msgid that is only
+ * sampled still falls under the rate limit of its context.
+ *
+ * Entries are only ever appended, and published by their index once
+ * filled in.  Before a config is reloaded all of them are cleared, and
+ * the ones still configured are set again, with atomic stores.
+ ***********************************************************************/
+typedef enum
+{
+    kMsgPolicy_RateLimit,
+    kMsgPolicy_Sample
+}
+PrvMsgPolicyKind;
+
+typedef void (*PrvMsgPolicyParser)(jvalue_ref j_entry, const gchar *file_name,
+        const char *context_name, PmLogContext_ *contextP);
+
+
+/*********************************************************************/
+/* PrvMsgPolicyHas */
+/**
+@brief  Tells if the entry sets the policy of the given kind.
+**********************************************************************/
+static inline bool PrvMsgPolicyHas(const PmLogMsgPolicy *policyP,
+        PrvMsgPolicyKind kind)
+{
+    if (kind == kMsgPolicy_RateLimit)
+    {
+        return __atomic_load_n(&policyP->interval, __ATOMIC_RELAXED) != 0;
+    }
+
+    return __atomic_load_n(&policyP->period, __ATOMIC_RELAXED) != 0;
+}
+
+
+/*********************************************************************/
+/* PrvMsgPolicyFind */
+/**
+@brief  Returns the entry holding the policy of the given kind that
+        applies to msgid in the context, or NULL.  msgid may be NULL
+        for debug records.
+**********************************************************************/
+static PmLogMsgPolicy* PrvMsgPolicyFind(const PmLogContext_ *contextP,
+        const char *msgid, PrvMsgPolicyKind kind)
+{
+    PmLogMsgPolicy  *policyP;
+    PmLogMsgPolicy  *contextPolicyP = NULL;
+    int             i;
+
+    for (i = __atomic_load_n(&contextP->msgPolicies, __ATOMIC_ACQUIRE); i != 0;
+         i = __atomic_load_n(&policyP->next, __ATOMIC_ACQUIRE))
+    {
+        policyP = &gGlobalsP->msgPolicies[ i - 1 ];
+
+        if (!PrvMsgPolicyHas(policyP, kind))
+        {
+            continue;
+        }
+
+        if (policyP->msgid[0] == '\0')
+        {
+            contextPolicyP = policyP;
+        }
+        else if ((msgid != NULL) && (strcmp(policyP->msgid, msgid) == 0))
+        {
+            return policyP;
+        }
+    }
+
+    return contextPolicyP;
+}
+
+
+/*********************************************************************/
+/* PrvMsgPolicySet */
+/**
+@brief  Sets the policy of the given kind of the context, or of msgid
+        in the context if msgid isn't empty, from the matching fields
+        of fromP.
+**********************************************************************/
+static PmLogErr PrvMsgPolicySet(PmLogContext_ *contextP, const char *msgid,
+        PrvMsgPolicyKind kind, const PmLogMsgPolicy *fromP)
+{
+    PmLogMsgPolicy  *policyP;
+    int16_t         *linkP;
+
+    if (strlen(msgid) > MSGID_LEN)
+    {
+        return kPmLogErr_InvalidParameter;
+    }
+
+    if ((gGlobalsP == NULL) || (gGlobalsP == &defaultSet))
+    {
+        return kPmLogErr_Unknown;
+    }
+
+    PmLogPrvLock();
+
+    // update the existing entry, if any, when the config is reloaded
+    for (linkP = &contextP->msgPolicies; *linkP != 0; linkP = &policyP->next)
+    {
+        policyP = &gGlobalsP->msgPolicies[ *linkP - 1 ];
+        if (strcmp(policyP->msgid, msgid) == 0)
+        {
+            break;
+        }
+    }
+
+    if (*linkP == 0)
+    {
+        if (gGlobalsP->numMsgPolicies >= PMLOG_MAX_MSG_POLICIES)
+        {
+            PmLogPrvUnlock();
+            return kPmLogErr_TooMuchData;
+        }
+
+        policyP = &gGlobalsP->msgPolicies[ gGlobalsP->numMsgPolicies ];
+        memset(policyP, 0, sizeof(*policyP));
+        mystrcpy(policyP->msgid, sizeof(policyP->msgid), msgid);
+    }
+
+    // the entry may be in use if the config is being reloaded
+    if (kind == kMsgPolicy_RateLimit)
+    {
+        __atomic_store_n(&policyP->tolerance, fromP->tolerance, __ATOMIC_RELAXED);
+        __atomic_store_n(&policyP->interval, fromP->interval, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_store_n(&policyP->period, fromP->period, __ATOMIC_RELAXED);
+    }
+
+    if (*linkP == 0)
+    {
+        gGlobalsP->numMsgPolicies++;
+        __atomic_store_n(linkP, gGlobalsP->numMsgPolicies, __ATOMIC_RELEASE);
+    }
+
+    PmLogPrvUnlock();
+
+    return kPmLogErr_None;
+}
+
+
+/*********************************************************************/
+/* PrvMsgPolicyClearAll */
+/**
+@brief  Clears the policies of all the entries, before the config is
+        reloaded, so that the ones removed from it no longer apply.
+**********************************************************************/
+static void PrvMsgPolicyClearAll(void)
+{
+    PmLogMsgPolicy  *policyP;
+    int             i;
+
+    if ((gGlobalsP == NULL) || (gGlobalsP == &defaultSet))
+    {
+        return;
+    }
+
+    PmLogPrvLock();
+
+    for (i = 0; i < gGlobalsP->numMsgPolicies; i++)
+    {
+        policyP = &gGlobalsP->msgPolicies[ i ];
+        __atomic_store_n(&policyP->interval, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&policyP->tolerance, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&policyP->period, 0, __ATOMIC_RELAXED);
+    }
+
+    PmLogPrvUnlock();
+}
+
+
+/*********************************************************************/
+/* parse_config_msg_policies */
+/**
+@brief  Parses the optional 'tag' of a context entry, either a single
+        policy or an array of them, each with parse.
+**********************************************************************/
+static void parse_config_msg_policies(jvalue_ref j_context, const gchar *file_name,
+        const char *context_name, const char *tag, PrvMsgPolicyParser parse)
+{
+    jvalue_ref      j_policies;
+    PmLogContext    context;
+    PmLogContext_   *contextP;
+    ssize_t         i;
+
+    if (!jobject_get_exists(j_context, j_cstr_to_buffer(tag), &j_policies))
+    {
+        return;
+    }
+
+    if (PmLogGetContext(context_name, &context) != kPmLogErr_None)
+    {
+        return;
+    }
+    contextP = PrvResolveContext(context);
+
+    if (jis_array(j_policies))
+    {
+        for (i = 0; i < jarray_size(j_policies); i++)
+        {
+            parse(jarray_get(j_policies, i), file_name, context_name, contextP);
+        }
+    }
+    else
+    {
+        parse(j_policies, file_name, context_name, contextP);
+    }
+}
+
+
+/***********************************************************************
+ * Rate limiting
+ *
+ * A context, or one msgid of a context, can be limited to 'burst'
+ * records at once and 'perSec' records a second on average, with
+ *
+ *     "rateLimit" : { "burst" : 20, "perSec" : 5 }
+ *
+ * in its pmlog.d entry, or an array of such objects with an optional
+ * "msgid" each.  A limit for a msgid takes precedence over the one for
+ * the whole context.
+ *
+ * Each limit is a token bucket in its GCRA form: a single "theoretical
+ * arrival time", advanced with one CAS per admitted record.  Rejected
+ * records are counted, and the count is logged with the next record
+ * let through.
+ ***********************************************************************/
+#define RATE_LIMIT_TAG      "rateLimit"
+#define NSEC_PER_SEC        1000000000ull
+
+
+/*********************************************************************/
+/* PrvNowNs */
+/**
+@brief  Returns CLOCK_MONOTONIC in nanoseconds.
+**********************************************************************/
+static inline uint64_t PrvNowNs(void)
+{
+    struct timespec now;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+
+/*********************************************************************/
+/* PrvRateLimitSet */
+/**
+@brief  Sets the limit of the context, or of msgid in the context if
+        msgid isn't empty.
+**********************************************************************/
+static PmLogErr PrvRateLimitSet(PmLogContext_ *contextP, const char *msgid,
+        uint32_t burst, double perSec)
+{
+    PmLogMsgPolicy  limit;
+    double          quotient;
+    uint64_t        maxInterval;
+
+    if ((burst == 0) || !(perSec > 0))
+    {
+        return kPmLogErr_InvalidParameter;
+    }
+
+    // keep 1e9 / perSec within [1, UINT64_MAX / (burst + 1)], so that
+    // neither the tolerance nor tat + interval can overflow; an
+    // interval of 0 would disable the limit
+    quotient = (double) NSEC_PER_SEC / perSec;
+    maxInterval = UINT64_MAX / ((uint64_t) burst + 1);
+
+    if (!(quotient >= 1))
+    {
+        limit.interval = 1;
+    }
+    else if (quotient >= (double) maxInterval)
+    {
+        limit.interval = maxInterval;
+    }
+    else
+    {
+        limit.interval = MIN((uint64_t) quotient, maxInterval);
+    }
+
+    limit.tolerance = (burst - 1) * limit.interval;
+
+    return PrvMsgPolicySet(contextP, msgid, kMsgPolicy_RateLimit, &limit);
+}
+
+
+/*********************************************************************/
+/* PrvRateLimitAdmitSlow */
+/**
+@brief  Takes a token from the bucket that applies to msgid, if any.
+        Returns kPmLogErr_RateLimited if the record must be dropped.
+**********************************************************************/
+static PmLogErr PrvRateLimitAdmitSlow(PmLogContext_ *contextP,
+        const char *ptidStr, const char *msgid)
+{
+    PmLogMsgPolicy  *limitP;
+    uint64_t        now;
+    uint64_t        tat;
+    uint64_t        start;
+    uint64_t        interval;
+    uint64_t        tolerance;
+    uint32_t        suppressed;
+
+    limitP = PrvMsgPolicyFind(contextP, msgid, kMsgPolicy_RateLimit);
+    if (limitP == NULL)
+    {
+        return kPmLogErr_None;
+    }
+
+    interval = __atomic_load_n(&limitP->interval, __ATOMIC_RELAXED);
+    tolerance = __atomic_load_n(&limitP->tolerance, __ATOMIC_RELAXED);
+
+    now = PrvNowNs();
+    tat = __atomic_load_n(&limitP->tat, __ATOMIC_RELAXED);
+    do
+    {
+        // the bucket is empty if the next record isn't due within the
+        // burst tolerance
+        start = (tat > now) ? tat : now;
+        if (start - now > tolerance)
+        {
+            __atomic_add_fetch(&limitP->suppressed, 1, __ATOMIC_RELAXED);
+            return kPmLogErr_RateLimited;
+        }
+    }
+    while (!__atomic_compare_exchange_n(&limitP->tat, &tat, start + interval,
+                                        true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    if (__atomic_load_n(&limitP->suppressed, __ATOMIC_RELAXED) != 0)
+    {
+        suppressed = __atomic_exchange_n(&limitP->suppressed, 0, __ATOMIC_RELAXED);
+        if (suppressed != 0)
+        {
+            WarnPrint(contextP->component, ptidStr,
+                      "RATE_LIMITED {\"MSGID\":\"%s\",\"SUPPRESSED\":%u} Records dropped by the rate limit",
+                      limitP->msgid[0] ? limitP->msgid : "*", suppressed);
+        }
+    }
+
+    return kPmLogErr_None;
+}
+
+
+/*********************************************************************/
+/* PrvRateLimitAdmit */
+/**
+@brief  Checks the rate limits of the context, before any formatting
+        is done.
+**********************************************************************/
+static inline PmLogErr PrvRateLimitAdmit(PmLogContext_ *contextP,
+        const char *ptidStr, const char *msgid)
+{
+    if (__atomic_load_n(&contextP->msgPolicies, __ATOMIC_RELAXED) == 0)
+    {
+        return kPmLogErr_None;
+    }
+
+    return PrvRateLimitAdmitSlow(contextP, ptidStr, msgid);
+}
+
+
+/*********************************************************************/
+/* PrvParseRateLimit */
+/**
+@brief  Parses one "rateLimit" object of a context entry and applies
+        it.
+**********************************************************************/
+static void PrvParseRateLimit(jvalue_ref j_limit, const gchar *file_name,
+        const char *context_name, PmLogContext_ *contextP)
+{
+    jvalue_ref  value;
+    raw_buffer  msgid = { NULL, 0 };
+    int32_t     burst = 0;
+    double      perSec = 0;
+    PmLogErr    err = kPmLogErr_InvalidParameter;
+
+    if (!jis_object(j_limit) ||
+        !jobject_get_exists(j_limit, J_CSTR_TO_BUF("burst"), &value) ||
+        (jnumber_get_i32(value, &burst) != CONV_OK) || (burst < 1) ||
+        !jobject_get_exists(j_limit, J_CSTR_TO_BUF("perSec"), &value) ||
+        (jnumber_get_f64(value, &perSec) != CONV_OK))
+    {
+        goto Exit;
+    }
+
+    if (jobject_get_exists(j_limit, J_CSTR_TO_BUF("msgid"), &value))
+    {
+        msgid = jstring_get(value);
+        if (msgid.m_str == NULL)
+        {
+            goto Exit;
+        }
+    }
+
+    err = PrvRateLimitSet(contextP, msgid.m_str ? msgid.m_str : "", burst, perSec);
+
+Exit:
+    if (err != kPmLogErr_None)
+    {
+        ErrPrint(COMPONENT_PREFIX, "[]", "INV_RATE_LIMIT {\"file\":\"%s\",\"context\":\"%s\",\"err\":\"%s\"}",
+                 file_name, context_name, PmLogGetErrDbgString(err));
+    }
+
+    if (msgid.m_str != NULL)
+    {
+        jstring_free_buffer(msgid);
+    }
+}
+
+
+/***********************************************************************
+ * Sampling
+ *
+ * A context, or one msgid of a context, can be sampled instead of
+ * being logged in full, with
+ *
+ *     "sample" : 100
+ *
+ * in its pmlog.d entry to keep 1 record in 100 (or "sample" : 0.01,
+ * the same as a fraction), or an object { "msgid" : ..., "rate" : ... }
+ * or an array of either.  See Message policies above for how a msgid
+ * and its context combine.
+ *
+ * The decision is taken before any formatting, with a per-thread PRNG.
+ * The records kept carry a "SAMPLE_WEIGHT" key holding the sampling
+ * period, so the counts can be scaled back up downstream.  The records
+ * dropped are not errors: the functions return kPmLogErr_None for them.
+ ***********************************************************************/
+#define SAMPLE_TAG          "sample"
+
+static __thread uint32_t tSampleSeed;
+
+
+/*********************************************************************/
+/* PrvSampleRandom */
+/**
+@brief  Returns the next number of the calling thread's xorshift32
+        sequence.
+**********************************************************************/
+static inline uint32_t PrvSampleRandom(void)
+{
+    uint32_t x = tSampleSeed;
+
+    if (x == 0)
+    {
+        // the address of the seed tells the threads apart
+        x = (uint32_t) PrvNowNs() ^ (uint32_t) (uintptr_t) &tSampleSeed;
+        if (x == 0)
+        {
+            x = 1;
+        }
+    }
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    tSampleSeed = x;
+
+    return x;
+}
+
+
+/*********************************************************************/
+/* PrvSampleAdmit */
+/**
+@brief  Returns the weight of the record if it is to be logged, 1 when
+        it isn't sampled, or 0 if it is to be dropped.
+**********************************************************************/
+static inline uint32_t PrvSampleAdmit(const PmLogContext_ *contextP,
+        const char *msgid)
+{
+    const PmLogMsgPolicy    *samplingP;
+    uint32_t                period;
+
+    if (__atomic_load_n(&contextP->msgPolicies, __ATOMIC_RELAXED) == 0)
+    {
+        return 1;
+    }
+
+    samplingP = PrvMsgPolicyFind(contextP, msgid, kMsgPolicy_Sample);
+    if (samplingP == NULL)
+    {
+        return 1;
+    }
+
+    period = __atomic_load_n(&samplingP->period, __ATOMIC_RELAXED);
+    if ((period > 1) && (PrvSampleRandom() % period != 0))
+    {
+        return 0;
+    }
+
+    return period;
+}
+
+
+/*********************************************************************/
+/* PrvSampleTag */
+/**
+@brief  Adds the "SAMPLE_WEIGHT" key to the JSON object at the start of
+        the line, in place.  The line is left as it is if it is full.
+**********************************************************************/
+static void PrvSampleTag(char *lineStr, size_t lineSize, uint32_t weight)
+{
+    char        tagStr[32];
+    const char  *p;
+    size_t      lineLen;
+    int         tagLen;
+
+    if ((weight <= 1) || (lineStr[0] != '{'))
+    {
+        return;
+    }
+
+    for (p = lineStr + 1; isspace((unsigned char) *p); p++)
+    {
+    }
+
+    tagLen = snprintf(tagStr, sizeof(tagStr), "\"SAMPLE_WEIGHT\":%u%s",
+                      weight, (*p == '}') ? "" : ",");
+
+    lineLen = strlen(lineStr);
+    if (lineLen + tagLen >= lineSize)
+    {
+        return;
+    }
+
+    memmove(lineStr + 1 + tagLen, lineStr + 1, lineLen);
+    memcpy(lineStr + 1, tagStr, tagLen);
+}
+
+
+/*********************************************************************/
+/* PrvParseSample */
+/**
+@brief  Parses one "sample" entry of a context entry and applies it.
+        The rate is either a period (>= 1) or a fraction (< 1).
+**********************************************************************/
+static void PrvParseSample(jvalue_ref j_sample, const gchar *file_name,
+        const char *context_name, PmLogContext_ *contextP)
+{
+    jvalue_ref      value = j_sample;
+    jvalue_ref      j_msgid;
+    raw_buffer      msgid = { NULL, 0 };
+    double          rate = 0;
+    PmLogMsgPolicy  sampling;
+    PmLogErr        err = kPmLogErr_InvalidParameter;
+
+    if (jis_object(j_sample))
+    {
+        if (!jobject_get_exists(j_sample, J_CSTR_TO_BUF("rate"), &value))
+        {
+            goto Exit;
+        }
+
+        if (jobject_get_exists(j_sample, J_CSTR_TO_BUF("msgid"), &j_msgid))
+        {
+            msgid = jstring_get(j_msgid);
+            if (msgid.m_str == NULL)
+            {
+                goto Exit;
+            }
+        }
+    }
+
+    if ((jnumber_get_f64(value, &rate) != CONV_OK) || !(rate > 0) ||
+        !(rate < UINT32_MAX))
+    {
+        goto Exit;
+    }
+
+    if (rate < 1)
+    {
+        rate = 1 / rate;
+    }
+
+    // a period of 1 logs them all
+    sampling.period = (rate < UINT32_MAX) ? (uint32_t) (rate + 0.5) : UINT32_MAX;
+    err = PrvMsgPolicySet(contextP, msgid.m_str ? msgid.m_str : "",
+                          kMsgPolicy_Sample, &sampling);
+
+Exit:
+    if (err != kPmLogErr_None)
+    {
+        ErrPrint(COMPONENT_PREFIX, "[]", "INV_SAMPLE {\"file\":\"%s\",\"context\":\"%s\",\"err\":\"%s\"}",
+                 file_name, context_name, PmLogGetErrDbgString(err));
+    }
+
+    if (msgid.m_str != NULL)
+    {
+        jstring_free_buffer(msgid);
+    }
+}
+
+
+/*********************************************************************/
+/* parse_config_message_size */
+/**
+@brief  Parses the optional "maxMessageSize" of a context entry, the
+        size messages of the context may grow to before they are
+        truncated.  See Message buffers below.
+**********************************************************************/
+static void parse_config_message_size(jvalue_ref j_context, const gchar *file_name,
+        const char *context_name)
+{
+    jvalue_ref      value;
+    PmLogContext    context;
+    PmLogContext_   *contextP;
+    int32_t         size;
+
+    if (!jobject_get_exists(j_context, j_cstr_to_buffer(MAX_MESSAGE_SIZE_TAG), &value))
+    {
+        return;
+    }
+
+    if ((jnumber_get_i32(value, &size) != CONV_OK) ||
+        (size < BUFFER_LEN) || (size > PMLOG_MAX_MESSAGE_SIZE))
+    {
+        ErrPrint(COMPONENT_PREFIX, "[]", "INV_MSG_SIZE {\"file\":\"%s\",\"context\":\"%s\"}",
+                 file_name, context_name);
+        return;
+    }
+
+    if (PmLogGetContext(context_name, &context) != kPmLogErr_None)
+    {
+        return;
+    }
+    contextP = PrvResolveContext(context);
+
+    __atomic_store_n(&contextP->maxMessageSize, (uint32_t) size, __ATOMIC_RELAXED);
+}
+
+
+static void parse_config_flags(jvalue_ref j_context, const gchar *file_name, const char *context_name)
+{
+    jvalue_ref    value;
+    bool          ret;
+    bool          flag_value;
+    int           flags = 0;
+    PmLogContext  context;
+    PmLogContext_ *context_ptr;
+    int           err;
+    char          ptidStr[ PIDSTR_LEN ];
+
+    err = PmLogGetContext(context_name, &context);
+    if (kPmLogErr_None != err) {
+        DbgPrint("FLG_CONTEXT_ERR {\"file\":\"%s\",\"context\":\"%s\"}",
+                 file_name, context_name);
+        return;
+    }
+
+    context_ptr = PrvResolveContext(context);
+
+    if (!context_ptr) {
+        ErrPrint(COMPONENT_PREFIX, ptidStr, "FLG_RSVL_ERR {\"file\":\"%s\",\"context\":\"%s\"}",
+                 file_name, context_name);
+        return;
+    }
+
+    GetPidStr(context_ptr, ptidStr, sizeof(ptidStr));
+
+    ret = jobject_get_exists(j_context, j_cstr_to_buffer(LOG_PROCESS_IDS_TAG), &value);
+    if (ret) { //found logProcessIds
+        if (CONV_OK == jboolean_get(value, &flag_value)) {
+            if (true == flag_value)
+                flags |= kPmLogFlag_LogProcessIds;
+            else
+                flags &= ~kPmLogFlag_LogProcessIds;
+        } else {
+            ErrPrint(COMPONENT_PREFIX, ptidStr, "INV_PSID {\"file\":\"%s\",\"context\":\"%s\"}",
+                     file_name, context_name);
+        }
+    }
+
+    ret = jobject_get_exists(j_context, j_cstr_to_buffer(LOG_THREAD_IDS_TAG), &value);
+    if (ret) { //found logThreadIds
+        if (CONV_OK == jboolean_get(value, &flag_value)) {
+            if (true == flag_value)
+                flags |= kPmLogFlag_LogThreadIds;
+            else
+                flags &= ~kPmLogFlag_LogThreadIds;
+        } else {
+            ErrPrint(COMPONENT_PREFIX, ptidStr, "INV_THID {\"file\":\"%s\",\"context\":\"%s\"}",
+                     file_name, context_name);
+        }
+    }
+
+    ret = jobject_get_exists(j_context, j_cstr_to_buffer(LOG_TO_CONSOLE_TAG), &value);
+    if (ret) { //found logToConsole
+        if (CONV_OK == jboolean_get(value, &flag_value)) {
+            if (true == flag_value)
+                flags |= kPmLogFlag_LogToConsole;
+            else
+                flags &= ~kPmLogFlag_LogToConsole;
+        } else {
+            ErrPrint(COMPONENT_PREFIX, ptidStr, "INV_LOG_TO_CON {\"file\":\"%s\",\"context\":\"%s\"}",
+                     file_name, context_name);
+        }
+    }
+
+    if (!flags)
+        return;
+
+    //Set all the flags at once
+    err = PrvSetContextFlag(context_ptr, flags, true);
+    if (err != kPmLogErr_None) {
+        ErrPrint(COMPONENT_PREFIX, ptidStr, "SET_CTX_FLG_ERR {\"file\":\"%s\",\"context\":\"%s\"}",
+                 file_name, context_name);
+    }
+}
+
+static bool parse_config_overrides(jvalue_ref j_overrides, const gchar *file_name)
+{
+    for (ssize_t i = 0; i < jarray_size(j_overrides); i++) {
+        jvalue_ref j_override = jarray_get(j_overrides, i);
+        if (!jis_object(j_override)) {
+            ErrPrint(COMPONENT_PREFIX, "[]", "PARSE_ERROR {\"file\":\"%s\",\"index\":%zd} Invalid override (ignoring)",
+                     file_name, i);
+            continue;
+        }
+
+        jvalue_ref j_value;
+        raw_buffer name;
+        raw_buffer level_str;
+        int           level;
+        bool       valid_level = false;
+        if (jobject_get_exists(j_override, J_CSTR_TO_BUF("name"), &j_value)) {
+            name = jstring_get(j_value);
+        } else { // global overrides
+            name = j_str_to_buffer(NULL, 0);
+        }
+
+        if (jobject_get_exists(j_override, j_cstr_to_buffer(LOG_LEVEL_TAG), &j_value)) {
+            level_str = jstring_get(j_value);
+            valid_level = PrvParseConfigLevel(level_str.m_str, &level);
+            if (!valid_level) {
+                ErrPrint(COMPONENT_PREFIX, "[]", "PARSE_ERROR {\"file\":\"%s\",\"index\":%zu} Invalid log level \"%s\" (ignoring)",
+                         file_name, i, level_str.m_str);
+            }
+        } else { // global overrides
+            level_str = j_str_to_buffer(NULL, 0);
+        }
+
+        if (valid_level) {
+            PmLogErr log_err;
+            const char *context_name;
+            if (name.m_str == NULL) {
+                int contexts_count;
+                context_name = "<all>";
+                log_err = PmLogGetNumContexts(&contexts_count);
+                if (log_err == kPmLogErr_None) {
+                    PmLogContext context;
+                    for (int n = 0; n < contexts_count; ++n) {
+                        log_err = PmLogGetIndContext(n, &context);
+                        if (log_err != kPmLogErr_None) break;
+
+                        log_err = PmLogSetContextLevel(context, level);
+
+                        if (log_err != kPmLogErr_None) {
+                            // remember at which context we've met an error
+                            context_name = PrvResolveContext(context)->component;
+                            break;
+                        }
+                    }
+                }
+            } else {
+                PmLogContext context;
+                context_name = name.m_str;
+                log_err = PmLogGetContext(context_name, &context);
+                if (log_err == kPmLogErr_None) {
+                    log_err = PmLogSetContextLevel(context, level);
+                }
+            }
+            if (log_err != kPmLogErr_None) {
+                ErrPrint(COMPONENT_PREFIX, "[]", "SET_CTX_LEVEL_FAIL {\"file\":\"%s\", \"index\":%d} Failed to set log level for %s: %s",
+                         file_name, i, context_name, PmLogGetErrDbgString(log_err));
+            }
+        }
 
         jstring_free_buffer(name);
         jstring_free_buffer(level_str);
     }
-    return true;
+    return true;
+}
+
+static bool parse_json_file(const char *file_name)
+{
+    int         index;
+    bool        found_context = false;
+    bool        have_valid_overrides = false;
+    JSchemaInfo schemainfo;
+    jvalue_ref  parsed;
+    jvalue_ref  contexts_array;
+    bool        ret;
+    jvalue_ref  value;
+
+    jschema_info_init(&schemainfo, jschema_all(), NULL, NULL);
+    parsed = jdom_parse_file(file_name, &schemainfo, DOMOPT_INPUT_NOCHANGE);
+    if (jis_null(parsed)) {
+        j_release(&parsed);
+        ErrPrint(COMPONENT_PREFIX, "[]", "JSON_PARSE_ERR {\"file\":\"%s\"}", file_name);
+        return false;
+    }
+
+        if(g_str_has_suffix(file_name, "default.conf")) {
+                if (jobject_get_exists(parsed, j_cstr_to_buffer("contextLogging"), &value)) {
+                        bool flag;
+                        if (CONV_OK == jboolean_get(value, &flag)) {
+                                gGlobalsP->contextLogging = flag;
+                        }
+                        else {
+                                ErrPrint(COMPONENT_PREFIX, "[]", "INV_CTXFLAG {\"file\":\"%s\"}", file_name);
+                        }
+                }
+                if (jobject_get_exists(parsed, j_cstr_to_buffer("latencyHistograms"), &value)) {
+                        bool flag;
+                        if (CONV_OK == jboolean_get(value, &flag)) {
+                                gGlobalsP->latencyHistograms = flag;
+                        }
+                        else {
+                                ErrPrint(COMPONENT_PREFIX, "[]", "INV_LATENCY_FLAG {\"file\":\"%s\"}", file_name);
+                        }
+                }
+                if (jobject_get_exists(parsed, j_cstr_to_buffer("repeatWindowMs"), &value)) {
+                        int32_t window;
+                        if ((CONV_OK == jnumber_get_i32(value, &window)) && (window >= 0)) {
+                                gGlobalsP->repeatWindowMs = window;
+                        }
+                        else {
+                                ErrPrint(COMPONENT_PREFIX, "[]", "INV_REPEAT_WINDOW {\"file\":\"%s\"}", file_name);
+                        }
+                }
+        }
+
+    ret = jobject_get_exists(parsed, j_cstr_to_buffer("contexts"), &contexts_array);
+    if (ret) { // found contexts array
+        for (index = 0; index < jarray_size(contexts_array); index++) {
+
+            jvalue_ref j_context;
+
+            j_context = jarray_get(contexts_array, index);
+            if (!jis_null(j_context)) {
+
+                raw_buffer    name;
+                raw_buffer    level;
+                char          err_msg[80];
+
+                name.m_str = NULL;
+                level.m_str = NULL;
+
+                ret = jobject_get_exists(j_context, j_cstr_to_buffer("name"), &value);
+                if (ret) { //found name
+                    found_context = true;
+                    name = jstring_get(value);
+                    if (!name.m_str) {
+                        ErrPrint(COMPONENT_PREFIX, "[]", "CTX_NAME_ERR {\"index\":%d,\"file\":\"%s\"}",
+                                 index, file_name);
+                        goto context_end;
+                    }
+                } else {
+                    ErrPrint(COMPONENT_PREFIX, "[]", "NO_CTX_NAME {\"index\":%d,\"file\":\"%s\"}",
+                             index, file_name);
+                    goto context_end;
+                }
+
+                ret = jobject_get_exists(j_context, j_cstr_to_buffer(LOG_LEVEL_TAG), &value);
+                if (ret) { //found level
+                    level = jstring_get(value);
+                    if (!level.m_str) {
+                        ErrPrint(COMPONENT_PREFIX, "[]", "NO_CTX_LVL {\"context\":\"%s\",\"file\":\"%s\"}",
+                                 name.m_str, file_name);
+                        goto context_end;
+                    }
+                } else {
+                    ErrPrint(COMPONENT_PREFIX, "[]", "CTX_LVL_MISSING {\"context\":\"%s\",\"file\":\"%s\"}",
+                             name.m_str, file_name);
+                    goto context_end;
+                }
+
+                if (!PrvInitContext(name.m_str, level.m_str, err_msg, sizeof(err_msg))) {
+                    DbgPrint("PrvInitContext failed for %s:%s: %s\n",
+                             file_name, name.m_str, err_msg);
+                    ErrPrint(COMPONENT_PREFIX, "[]", "INIT_CTX_ERR {\"file\":\"%s\",\"context\":\"%s\",\"err\":\"%s\"}",
+                             file_name, name.m_str, err_msg);
+                        goto context_end;
+                }
+
+                // parse optional flags (Ex. LOG_PROCESS_IDS_TAG) for the given context
+                parse_config_flags(j_context, file_name, name.m_str);
+
+                // parse the optional rate limits for the given context
+                parse_config_msg_policies(j_context, file_name, name.m_str,
+                                          RATE_LIMIT_TAG, PrvParseRateLimit);
+
+                // parse the optional sampling for the given context
+                parse_config_msg_policies(j_context, file_name, name.m_str,
+                                          SAMPLE_TAG, PrvParseSample);
+
+                // parse the optional message size for the given context
+                parse_config_message_size(j_context, file_name, name.m_str);
+
+            context_end:
+                jstring_free_buffer(name);
+                jstring_free_buffer(level);
+            } // if current entry in CONTEXTS array is valid
+        } // for loop for traversing CONTEXTS array
+    } // if we found a CONTEXTS array
+
+    jvalue_ref overrides;
+    ret = jobject_get_exists(parsed, j_cstr_to_buffer("overrides"), &overrides);
+    if (ret && parse_config_overrides(overrides, file_name)) {
+        have_valid_overrides = true;
+    }
+
+    j_release(&parsed);
+
+    if (!found_context && !have_valid_overrides) {
+        ErrPrint(COMPONENT_PREFIX, "[]", "CTX_MISSING {\"file\":\"%s\"}", file_name);
+        return false;
+    }
+
+    return true;
+}
+
+#define DEFAULT_CONFIG "default.conf"
+bool PmLogPrvReadConfigs(bool (*fn_ptr) (const char *file_name))
+{
+    GDir *dir;
+    GError *error = NULL;
+    const char *file_name;
+    gchar *full_path = NULL;
+    bool found_default_conf = false;
+
+    dir = g_dir_open(CONFIG_DIR, 0, &error);
+    if (!dir) {
+        ErrPrint(COMPONENT_PREFIX, "[]", "DIR_OPEN_ERR {\"Error\":\"%s\"}", error->message);
+        g_error_free(error);
+        return false;
+    }
+
+    // default.conf should be the first one
+    full_path = g_build_filename(CONFIG_DIR, DEFAULT_CONFIG, NULL);
+    if (g_file_test(full_path, G_FILE_TEST_IS_REGULAR)) {
+        found_default_conf = true;
+        // execute caller supplied function
+        fn_ptr(full_path);
+    }
+    g_free(full_path);
+    full_path = NULL;
+
+//! This macro can be defined to restrict logging
+//! to whitelist logs
+#ifndef ENABLE_WHITELIST // Parse only default.conf in production
+    if (gGlobalsP->contextLogging)  // Do not parse individual context conf files if context logging is disabled in development builds
+    {
+        while ((file_name = g_dir_read_name(dir))) {
+            // ignore hidden files or files without ".conf" suffix
+            if ('.' == file_name[0] ||
+                !g_str_has_suffix (file_name, ".conf")) {
+                continue;
+            }
+
+            if (!g_strcmp0(file_name, DEFAULT_CONFIG)) {
+                // we parsed this file already
+                continue;
+            }
+
+            // Construct full path for parsing selected conf file
+            // Ex: /etc/pmlog.d/default.conf = /etc/pmlog.d + default.conf
+            full_path = g_build_filename(CONFIG_DIR, file_name, NULL);
+
+            // execute caller supplied function
+            fn_ptr(full_path);
+
+            g_free(full_path);
+        }
+    }
+#endif
+
+    g_dir_close(dir);
+
+    // Last phase - overrides.
+    // It should be always last as long as override for all components walks
+    // through already-defined-contexts.
+    if (g_file_test(OVERRIDES_CONF, G_FILE_TEST_IS_REGULAR)) {
+        // execute caller supplied function
+        fn_ptr(OVERRIDES_CONF);
+    }
+
+    return found_default_conf;
+}
+
+/*********************************************************************/
+/* kHexChars */
+/**
+@brief  Lookup for hex nybble output.
+**********************************************************************/
+static const char kHexChars[16] =
+{
+    '0', '1', '2', '3', '4', '5', '6', '7',
+    '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'
+};
+
+// fork() handlers of the asynchronous writer, defined below
+static void PrvAsyncPrepareFork(void);
+static void PrvAsyncParentFork(void);
+static void PrvAsyncChildFork(void);
+static void PrvLockChildFork(void);
+static void PrvLatencyPrepareFork(void);
+static void PrvLatencyParentFork(void);
+static void PrvLatencyChildFork(void);
+static void PrvRepeatChildFork(void);
+
+/*********************************************************************/
+/* init_function */
+/**
+@brief  Library constructor executes automatically in the loading
+    process before any other library API is called.
+**********************************************************************/
+static void __attribute ((constructor)) init_function(void)
+{
+    const char* kPmLogLibSoFilePath = WEBOS_INSTALL_LIBDIR "/libPmLogLib.so";
+
+    key_t       key;
+    int         shmid;
+    char*       data;
+    size_t      shmSize;
+    bool        needInit;
+    Dl_info     dlInfo;
+    int         result;
+    const char* libFilePath;
+    mode_t      mode;
+    PmLogContext_* theContextP = NULL;
+
+    pthread_atfork(PrvAsyncPrepareFork, PrvAsyncParentFork, PrvAsyncChildFork);
+    pthread_atfork(NULL, NULL, PrvPidStrChildFork);
+    pthread_atfork(NULL, NULL, PrvLockChildFork);
+    pthread_atfork(NULL, NULL, PrvRingChildFork);
+    pthread_atfork(PrvLatencyPrepareFork, PrvLatencyParentFork, PrvLatencyChildFork);
+    pthread_atfork(NULL, NULL, PrvRepeatChildFork);
+
+    // get/create the PmLogLib lock
+
+    DbgPrint("Opening lock\n");
+
+    mode = umask(0);
+        lock_fd = open("/dev/shm/pmloglib.lock", O_CREAT|O_RDWR , 0666);
+    umask(mode);
+    if (lock_fd == -1)
+    {
+        DbgPrint("open error: %s\n", strerror(errno));
+        return;
+    }
+
+    // determine this library's file path dynamically
+    libFilePath = NULL;
+
+    memset(&dlInfo, 0, sizeof(dlInfo));
+    result = dladdr(init_function, &dlInfo);
+    if (result)
+    {
+        libFilePath = dlInfo.dli_fname;
+        DbgPrint("libFilePath: %s\n", libFilePath);
+    }
+    else
+    {
+        DbgPrint("dladdr err: %s\n", strerror(errno));
+    }
+
+    // if lookup failed for some reason, fall back to expected
+    if (libFilePath == NULL)
+    {
+        libFilePath = kPmLogLibSoFilePath;
+    }
+
+    DbgPrint("getting shm key\n");
+
+    key = ftok(libFilePath, 'A');
+    if (key == -1)
+    {
+        DbgPrint("ftok error: %s\n", strerror(errno));
+        return;
+    }
+
+    // lock the globals
+    PmLogPrvLock();
+
+    shmSize = sizeof(PmLogGlobals);
+    DbgPrint("Getting shm size=%u\n", shmSize);
+
+    // if shm is guaranteed initialized to 0, we can use
+    // that to tell whether it needs initializing or not.
+    // Otherwise, we can do a shmget without the IPC_CREAT,
+    // and if returns errno == ENOENT we know it needs creation
+    // and initialization.
+
+    shmid = shmget(key, shmSize, 0666 | IPC_CREAT);
+    if (shmid == -1)
+    {
+        DbgPrint("shmget error: %s\n", strerror(errno));
+        PmLogPrvUnlock();
+        return;
+    }
+
+    data = (char*) shmat(shmid, NULL, 0 /* SHM_RDONLY */);
+    if (data == (char*) -1)
+    {
+        DbgPrint("shmat error: %s\n", strerror(errno));
+        PmLogPrvUnlock();
+        return;
+    }
+
+    gShmData = (uint8_t*) data;
+
+    // same as gShmData, but typecast for use
+    gGlobalsP = (PmLogGlobals*) gShmData;
+    gGlobalContextP = &gGlobalsP->globalContext;
+    _PmLogDefaultContextInfo = &gGlobalContextP->info;
+
+    needInit = false;
+
+    // use header as initialization flag
+    if (gGlobalsP->signature == 0)
+    {
+            DbgPrint("initializing shared mem\n");
+            memcpy(gGlobalsP, &defaultSet, shmSize);
+            //set default library context
+            theContextP = &gGlobalsP->userContexts[0];
+            gGlobalsP->numUserContexts++;
+            mystrcpy(theContextP->component, sizeof(theContextP->component), kPmLogDefaultLibContextName);
+            theContextP->info.enabledLevel = kPmLogLevel_Info;
+            theContextP->info.flags = 0;
+            PrvIndexInsert(0);
+            needInit = true;
+        }
+    else if (gGlobalsP->signature == PMLOG_SIGNATURE)
+    {
+        DbgPrint("accessing shared mem\n");
+    }
+    else
+    {
+        DbgPrint("unrecognized shared mem\n");
+
+        gGlobalsP = NULL;
+        gGlobalContextP = NULL;
+        _PmLogDefaultContextInfo = &defaultSet.globalContext.info;
+    }
+
+    // release the globals lock
+    PmLogPrvUnlock();
+
+    // initialize contexts if this is the first time
+    if (needInit)
+    {
+        PmLogPrvReadConfigs(parse_json_file);
+    }
+
+    PrvRingCreate();
+}
+
+
+/*********************************************************************/
+/* PmLogPrvGlobals */
+/**
+@brief  Returns the pointer to the globals.
+**********************************************************************/
+PmLogGlobals* PmLogPrvGlobals(void)
+{
+    return gGlobalsP;
+}
+
+
+/***********************************************************************
+ * gLock
+ *
+ * lockf() locks belong to the process, so they don't keep the threads
+ * of one process apart.  The mutex does; the file lock is only taken
+ * by the outermost PmLogPrvLock() of the thread holding the mutex.
+ ***********************************************************************/
+static struct
+{
+    pthread_mutex_t mutex;
+    int             depth;
+}
+gLock = { PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP, 0 };
+
+
+/*********************************************************************/
+/* PrvLockChildFork */
+/**
+@brief  pthread_atfork child handler.  File locks are not inherited,
+        and the thread that might have held the mutex is gone.
+**********************************************************************/
+static void PrvLockChildFork(void)
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&gLock.mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    gLock.depth = 0;
+}
+
+
+/*********************************************************************/
+/* PmLogPrvLock */
+/**
+@brief  Acquires the lock for write access to the PmLog shared
+        memory context.  This should be held as briefly as possible,
+        then released by calling PmLogPrvUnlock.
+**********************************************************************/
+void PmLogPrvLock(void)
+{
+    pthread_mutex_lock(&gLock.mutex);
+
+    if ((gLock.depth++ == 0) && (lockf(lock_fd, F_LOCK, 0) == -1))
+    {
+        DbgPrint("lock error: %s\n", strerror(errno));
+    }
+}
+
+
+/*********************************************************************/
+/* PmLogPrvUnlock */
+/**
+@brief  Releases the lock for write access to the PmLog shared
+        memory context, as previously acquired via PmLogPrvLock.
+**********************************************************************/
+void PmLogPrvUnlock(void)
+{
+    if ((--gLock.depth == 0) && (lockf(lock_fd, F_ULOCK, 0) == -1))
+    {
+        DbgPrint("unlock error: %s\n", strerror(errno));
+    }
+
+    pthread_mutex_unlock(&gLock.mutex);
+}
+
+
+/***********************************************************************
+ * Registry generation
+ *
+ * PmLogGlobals.generation is a seqlock over the context names and
+ * their index: it is odd while a context is being added.  Lookups read
+ * the table without the lock and are only trusted if the generation
+ * was even and unchanged across the read; otherwise they are redone
+ * under the lock.  Writers hold the lock, so there is one at a time.
+ ***********************************************************************/
+
+/*********************************************************************/
+/* PrvRegistryWriteBegin / PrvRegistryWriteEnd */
+/**
+@brief  Bracket a change of the context names or index.
+        Globals must be locked.  A generation left odd by a process
+        that died while writing stays odd until the next writer ends.
+**********************************************************************/
+static inline void PrvRegistryWriteBegin(void)
+{
+    uint32_t gen = __atomic_load_n(&gGlobalsP->generation, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&gGlobalsP->generation, gen | 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void PrvRegistryWriteEnd(void)
+{
+    uint32_t gen = __atomic_load_n(&gGlobalsP->generation, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&gGlobalsP->generation, (gen | 1) + 1, __ATOMIC_RELEASE);
+}
+
+
+/*********************************************************************/
+/* PrvRegistryReadBegin / PrvRegistryReadValid */
+/**
+@brief  Bracket an unlocked read of the context names or index.
+        PrvRegistryReadValid tells if what was read can be trusted.
+**********************************************************************/
+static inline uint32_t PrvRegistryReadBegin(void)
+{
+    return __atomic_load_n(&gGlobalsP->generation, __ATOMIC_ACQUIRE);
+}
+
+static inline bool PrvRegistryReadValid(uint32_t gen)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return ((gen & 1) == 0) &&
+        (__atomic_load_n(&gGlobalsP->generation, __ATOMIC_RELAXED) == gen);
+}
+
+
+/*********************************************************************/
+/* PrvLookupContextUnlocked */
+/**
+@brief  PrvLookupContext without taking the lock.  Returns false if
+        no consistent view of the registry could be had, in which case
+        the caller must look up again with the globals locked.
+**********************************************************************/
+#define REGISTRY_READ_TRIES 4
+
+static bool PrvLookupContextUnlocked(const char* contextName,
+    PmLogContext_** contextPP)
+{
+    PmLogContext_*  contextP;
+    uint32_t        gen;
+    int             i;
+
+    for (i = 0; i < REGISTRY_READ_TRIES; i++)
+    {
+        gen = PrvRegistryReadBegin();
+        if (gen & 1)
+        {
+            // a context is being added right now
+            continue;
+        }
+
+        contextP = PrvLookupContext(contextName);
+
+        if (PrvRegistryReadValid(gen))
+        {
+            *contextPP = contextP;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*********************************************************************/
+/* PrvExportContext */
+/**
+@brief  Convert a private PmLogContext_ pointer to the corresponding
+        public PmLogContext pointer.
+**********************************************************************/
+static inline PmLogContext PrvExportContext(const PmLogContext_* contextP)
+{
+    return (contextP == NULL) ? NULL : &contextP->info;
+}
+
+
+/*********************************************************************/
+/* PrvIsValidLevel */
+/**
+@brief  Checks if the level is recognized.
+**********************************************************************/
+static inline bool PrvIsValidLevel(PmLogLevel level)
+{
+/*
+ * Temporarily suppress the deprecation warnings for this block, as we
+ * are the deprecators
+ */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    return
+        (level >= kPmLogLevel_Emergency) &&
+        (level <= kPmLogLevel_Debug);
+#pragma GCC diagnostic pop
+}
+
+
+/*********************************************************************/
+/* PrvValidateContextName */
+/**
+@brief  Returns true if and only if the given string is a valid
+        context name, i.e. meets the requirements for length
+        and valid characters.
+**********************************************************************/
+static PmLogErr PrvValidateContextName(const char* contextName)
+{
+    size_t    n;
+    size_t    i;
+    char    c;
+
+    // the global context name is a special case
+    if (strcmp(contextName, kPmLogGlobalContextName) == 0)
+    {
+        return kPmLogErr_None;
+    }
+
+    if (strcmp(contextName, kPmLogDefaultLibContextName) == 0)
+    {
+        return kPmLogErr_None;
+    }
+
+    n = strlen(contextName);
+    if ((n < 1) || (n > PMLOG_MAX_CONTEXT_NAME_LEN))
+    {
+        return kPmLogErr_InvalidContextName;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        c = contextName[ i ];
+
+        if ((c >= 'A') && (c <= 'Z'))
+            continue;
+
+        if ((c >= 'a') && (c <= 'z'))
+            continue;
+
+        if ((c >= '0') && (c <= '9'))
+            continue;
+
+        if ((c == '.') ||
+            (c == '-') ||
+            (c == '_'))
+            continue;
+
+        return kPmLogErr_InvalidContextName;
+    }
+
+    return kPmLogErr_None;
+}
+
+
+/*********************************************************************/
+/* PmLogGetNumContexts */
+/**
+@brief  Returns the number of defined contexts, including the global
+        context.
+
+@return Error code:
+            kPmLogErr_None
+            kPmLogErr_InvalidParameter
+**********************************************************************/
+PmLogErr PmLogGetNumContexts(int* pNumContexts)
+{
+    if (pNumContexts == NULL)
+    {
+        return kPmLogErr_InvalidParameter;
+    }
+
+    *pNumContexts = 0;
+
+    if (gGlobalsP == NULL)
+    {
+        return kPmLogErr_Unknown;
+    }
+
+    *pNumContexts = 1 + gGlobalsP->numUserContexts;
+    return kPmLogErr_None;
+}
+
+
+/*********************************************************************/
+/* PmLogGetIndContext */
+/**
+@brief  Returns the context by index where index = 0..numContexts - 1.
+
+@return Error code:
+            kPmLogErr_None
+            kPmLogErr_InvalidParameter
+**********************************************************************/
+PmLogErr PmLogGetIndContext(int contextIndex, PmLogContext* pContext)
+{
+    PmLogContext_*    theContextP;
+
+    if (pContext != NULL)
+    {
+        *pContext = NULL;
+    }
+
+    if ((contextIndex < 0) || (contextIndex > gGlobalsP->numUserContexts))
+    {
+        return kPmLogErr_InvalidContextIndex;
+    }
+
+    if (pContext == NULL)
+    {
+        return kPmLogErr_InvalidParameter;
+    }
+
+    if (contextIndex == 0)
+    {
+        theContextP = &gGlobalsP->globalContext;
+    }
+    else
+    {
+        theContextP = &gGlobalsP->userContexts[ contextIndex - 1 ];
+    }
+
+    *pContext = PrvExportContext(theContextP);
+    return kPmLogErr_None;
+}
+
+
+/*********************************************************************/
+/* PmLogFindContext */
+/**
+@brief  Returns the logging context for the named context, or
+        NULL if the context does not exist.
+
+@return Error code:
+            kPmLogErr_None
+            kPmLogErr_InvalidParameter
+            kPmLogErr_InvalidContext
+            kPmLogErr_InvalidContextName
+**********************************************************************/
+PmLogErr PmLogFindContext(const char* contextName, PmLogContext* pContext)
+{
+    PmLogErr        logErr;
+    PmLogContext_*    theContextP;
+
+    if (pContext == NULL)
+    {
+        return kPmLogErr_InvalidParameter;
+    }
+
+    *pContext = NULL;
+
+    if (gGlobalsP == NULL)
+    {
+        return kPmLogErr_Unknown;
+    }
+
+    if (contextName == NULL)
+    {
+        return kPmLogErr_InvalidParameter;
+    }
+
+    logErr = PrvValidateContextName(contextName);
+    if (logErr != kPmLogErr_None)
+    {
+        return logErr;
+    }
+
+    if (!PrvLookupContextUnlocked(contextName, &theContextP))
+    {
+        // lock the globals
+        PmLogPrvLock();
+
+        theContextP = PrvLookupContext(contextName);
+
+        // release the globals lock
+        PmLogPrvUnlock();
+    }
+
+    if (theContextP != NULL)
+    {
+        *pContext = PrvExportContext(theContextP);
+        return kPmLogErr_None;
+    }
+
+    return kPmLogErr_ContextNotFound;
+}
+
+
+/*********************************************************************/
+/* PrvGetContextDefaults */
+/**
+@brief  Look up the default settings for the context.  If the
+        component is part of a hierarchy, search up the ancestor
+        chain and use the settings of the first ancestor found.
+        Otherwise, use the settings from the global context.
+**********************************************************************/
+static const PmLogContextInfo* PrvGetContextDefaults(const char* contextName)
+{
+    // Note: this function is called only by PmLogGetContext when
+    // the context globals are locked.
+
+    const PmLogContext_*    contextP;
+    uint32_t                hashes[ PMLOG_MAX_CONTEXT_NAME_LEN + 1 ];
+    size_t                  lens[ PMLOG_MAX_CONTEXT_NAME_LEN + 1 ];
+    int                     numParents;
+    uint32_t                hash;
+    size_t                  i;
+
+    // hash the name once, remembering the hash of each parent path
+    // (the prefix before each '.') along the way
+    numParents = 0;
+    hash = 2166136261u;
+    for (i = 0; (contextName[ i ] != 0) && (i < PMLOG_MAX_CONTEXT_NAME_LEN); i++)
+    {
+        if (contextName[ i ] == '.')
+        {
+            hashes[ numParents ] = hash;
+            lens[ numParents ] = i;
+            numParents++;
+        }
+
+        hash ^= (uint8_t) contextName[ i ];
+        hash *= 16777619u;
+    }
+
+    // if a registered context matches a parent path, nearest first,
+    // use its level as the default for the child
+    while (numParents > 0)
+    {
+        numParents--;
+
+        contextP = PrvIndexLookup(contextName, lens[ numParents ], hashes[ numParents ]);
+        if (contextP != NULL)
+        {
+            return &contextP->info;
+        }
+    }
+
+    // otherwise use the global level as the default
+    return &gGlobalContextP->info;
+}
+
+
+/*********************************************************************/
+/* PmLogGetContext */
+/**
+@brief  Returns/creates the logging context for the named context.
+
+        If contextName is NULL, returns the global context.
+
+        Context names must be 1..31 characters long, and each
+        character must be one of A-Z, a-z, 0-9, '_', '-', '.'.
+
+        Component hierarchies can be indicated using '.' as the path
+        separator.
+        E.g. "FOO.BAR" would indicate the "BAR" subcomponent
+        of the "FOO" component.
+
+@return Error code:
+            kPmLogErr_None
+            kPmLogErr_InvalidParameter
+            kPmLogErr_InvalidContext
+            kPmLogErr_InvalidContextName
+**********************************************************************/
+PmLogErr PmLogGetContext(const char* contextName, PmLogContext* pContext)
+{
+    PmLogErr                logErr;
+    PmLogContext_*            theContextP;
+    const PmLogContextInfo*    defaultsP;
+
+    if (pContext == NULL)
+    {
+        return kPmLogErr_InvalidParameter;
+    }
+
+    *pContext = NULL;
+
+    if (gGlobalsP == NULL)
+    {
+        return kPmLogErr_Unknown;
+    }
+
+    if (contextName == NULL)
+    {
+        *pContext = PrvExportContext(gGlobalContextP);
+        return kPmLogErr_None;
+    }
+
+    logErr = PrvValidateContextName(contextName);
+    if (logErr != kPmLogErr_None)
+    {
+        return logErr;
+    }
+
+    logErr = kPmLogErr_None;
+
+    // existing contexts are found without the lock
+    if (PrvLookupContextUnlocked(contextName, &theContextP) &&
+        (theContextP != NULL))
+    {
+        *pContext = PrvExportContext(theContextP);
+        return kPmLogErr_None;
+    }
+
+    // lock the globals
+    PmLogPrvLock();
+
+    // look for a match on the context name
+    theContextP = PrvLookupContext(contextName);
+
+    // if context not found, add it
+    if (theContextP == NULL)
+    {
+        if (gGlobalsP->numUserContexts >= gGlobalsP->maxUserContexts)
+        {
+            DbgPrint("no more contexts available, fallback to global context\n");
+        }
+        else
+        {
+            DbgPrint("adding context %s\n", contextName);
+
+            defaultsP = PrvGetContextDefaults(contextName);
+
+            PrvRegistryWriteBegin();
+
+            theContextP = &gGlobalsP->userContexts[ gGlobalsP->numUserContexts ];
+            gGlobalsP->numUserContexts++;
+
+            mystrcpy(theContextP->component, sizeof(theContextP->component),
+                contextName);
+
+            theContextP->info.enabledLevel = defaultsP->enabledLevel;
+            theContextP->info.flags = defaultsP->flags;
+
+            PrvIndexInsert(gGlobalsP->numUserContexts - 1);
+
+            PrvRegistryWriteEnd();
+        }
+    }
+
+    // release the globals lock
+    PmLogPrvUnlock();
+
+    if (theContextP != NULL)
+    {
+        *pContext = PrvExportContext(theContextP);
+
+        return kPmLogErr_None;
+    }
+
+    // in case of error, return the global context pointer
+    *pContext = PrvExportContext(gGlobalContextP);
+    return logErr;
+}
+
+static int GetCurrentProcessName(char *dst, int size)
+{
+    FILE* f = fopen("/proc/self/cmdline", "rt");
+    if (f) {
+        int read = fread(dst, 1, size-1, f);
+        dst[read] = 0;
+        for(int i = 0 ; i < read ; i++) {
+            if (dst[i] == 0)
+                dst[i] = ' ';
+        }
+        fclose(f);
+        return read;
+    }
+    return 0;
+}
+
+#ifdef VALIDATE_INCOMING_LIBPROCESSCONTEXT
+void PmLogSetLibContext(PmLogContext libContext)
+{
+    bool invalid_value = (libContext == NULL);
+
+    if (!invalid_value)
+    {
+        PmLogPrvLock();
+
+        if (PrvExportContext(&gGlobalsP->globalContext) != libContext)
+        {
+            // a user context must point at the start of a used table entry
+            const PmLogContext_* contextP = (const PmLogContext_*) libContext;
+            ptrdiff_t offset = (const char*) contextP - (const char*) gGlobalsP->userContexts;
+            bool found = (offset >= 0) &&
+                (offset < (ptrdiff_t) (gGlobalsP->numUserContexts * sizeof(PmLogContext_))) &&
+                (offset % sizeof(PmLogContext_) == 0);
+            invalid_value = invalid_value || !found;
+        }
+
+        PmLogPrvUnlock();
+    }
+
+    if (invalid_value) {
+        char procName[1024];
+        int length = GetCurrentProcessName(procName, sizeof(procName));
+        WarnPrint("UNKNOWN", "[]", "Invalid context was passed to PmLogSetLibContext. Value: %p. Process: %.*s", libContext, length, procName);
+    } else {
+        libProcessContext = libContext;
+    }
+}
+#else
+void PmLogSetLibContext(PmLogContext libContext)
+{
+    libProcessContext = libContext;
+}
+#endif
+
+PmLogContext PmLogGetLibContext(void)
+{
+    if (libProcessContext == kPmLogDefaultContext)
+    {
+        return PrvExportContext(&gGlobalsP->userContexts[0]);
+    }
+
+    return libProcessContext;
+}
+
+void PmLogSetDevMode(bool isDevMode)
+{
+    PmLogPrvLock();
+    gGlobalsP->devMode = isDevMode;
+    PmLogPrvUnlock();
+}
+
+
+/*********************************************************************/
+/* PmLogGetContextInline */
+/**
+@brief  Returns the logging context for the named context.
+**********************************************************************/
+PmLogContext PmLogGetContextInline(const char* contextName)
+{
+    PmLogErr        logErr;
+    PmLogContext    context;
+
+    context = NULL;
+    logErr = PmLogGetContext(contextName, &context);
+    if (logErr == kPmLogErr_None)
+    {
+        return context;
+    }
+
+    return kPmLogGlobalContext;
+}
+
+
+/*********************************************************************/
+/* PmLogGetContextName */
+/**
+@brief  Returns the name of the specified context into the specified
+        string buffer.
+
+@return Error code:
+            kPmLogErr_None
+            kPmLogErr_InvalidParameter
+**********************************************************************/
+PmLogErr PmLogGetContextName(PmLogContext context, char* contextName,
+    size_t contextNameBuffSize)
+{
+    PmLogContext_*    contextP;
+
+    // clear out result in case of error
+    if ((contextName != NULL) && (contextNameBuffSize > 0))
+    {
+        contextName[ 0 ] = 0;
+    }
+
+    contextP = PrvResolveContext(context);
+    if (contextP == NULL)
+    {
+        return kPmLogErr_InvalidContext;
+    }
+
+    if ((contextName == NULL) || (contextNameBuffSize <= 1))
+    {
+        return kPmLogErr_InvalidParameter;
+    }
+
+    mystrcpy(contextName, contextNameBuffSize, contextP->component);
+
+    if (contextNameBuffSize < strlen(contextP->component) + 1)
+    {
+        return kPmLogErr_BufferTooSmall;
+    }
+
+    return kPmLogErr_None;
+}
+
+
+/*********************************************************************/
+/* PmLogGetContextLevel */
+/**
+@brief  Gets the logging level for the specified context.
+        May be used for the global context.  This should generally not
+        be used by the components doing logging themselves.
+        Instead just use the PmLogPrint etc. APIs which will do
+        inline enabled checks.
+
+@return Error code:
+            kPmLogErr_None
+            kPmLogErr_InvalidParameter
+**********************************************************************/
+PmLogErr PmLogGetContextLevel(PmLogContext context, PmLogLevel* levelP)
+{
+    PmLogContext_*    contextP;
+
+    // clear out result in case of error
+    if (levelP != NULL)
+    {
+        *levelP = kPmLogLevel_Debug;
+    }
+
+    contextP = PrvResolveContext(context);
+    if (contextP == NULL)
+    {
+        return kPmLogErr_InvalidContext;
+    }
+
+    if (levelP == NULL)
+    {
+        return kPmLogErr_InvalidParameter;
+    }
+
+    *levelP = contextP->info.enabledLevel;
+
+    return kPmLogErr_None;
+}
+
+
+/*********************************************************************/
+/* PmLogSetContextLevel */
+/**
+@brief  Sets the logging level for the specified context.
+        May be used for the global context.
+**********************************************************************/
+PmLogErr PmLogSetContextLevel(PmLogContext context, PmLogLevel level)
+{
+    PmLogContext_*    contextP;
+    int             fd;
+        struct flock    fl;
+
+    contextP = PrvResolveContext(context);
+    if (contextP == NULL)
+    {
+        return kPmLogErr_InvalidContext;
+    }
+
+    if ((level != kPmLogLevel_None) && !PrvIsValidLevel(level))
+    {
+        return kPmLogErr_InvalidLevel;
+    }
+
+    // dummy reference to avoid unused function warning
+    // when DbgPrint is compiled out
+    (void) &PrvGetLevelStr;
+    DbgPrint("SetContextLevel %s => %s\n", contextP->component,
+        PrvGetLevelStr(level));
+
+    // write which process calls this function for debugging
+    if(gGlobalsP->devMode)
+    {
+        fd = open("/tmp/PmLogSetContextLevel.log", O_WRONLY | O_CREAT | O_NOCTTY |O_APPEND | O_NONBLOCK, 0644);
+        if (fd >= 0)
+        {
+            /* get advisory file lock (write => exclusive lock) */
+            memset(&fl, 0, sizeof(fl));
+            fl.l_type = F_WRLCK;
+            if (fcntl(fd, F_SETLKW, &fl) == 0)
+            {
+                char procName[512] ={0, };
+                char debuglog[1024] ={0, };
+                GetCurrentProcessName(procName, sizeof(procName));
+                g_snprintf(debuglog, sizeof(debuglog), "PROCINFO:%s COMPONENT:%s ORIGINLEVEL:%d INPUTLEVEL:%d\n", procName, contextP->component, contextP->info.enabledLevel, level);
+                write(fd, debuglog, strlen(debuglog));
+            }
+
+            /* release advisory file lock */
+            memset(&fl, 0, sizeof(fl));
+            fl.l_type = F_UNLCK;
+            if(fcntl(fd, F_SETLKW, &fl)  == -1)
+            {
+                DbgPrint("fcntl return error. code : %s\n", strerror(errno));
+            }
+
+            close(fd);
+        }
+    }
+    contextP->info.enabledLevel = level;
+    return kPmLogErr_None;
+}
+
+
+/*********************************************************************/
+/* PrvCheckContext */
+/**
+@brief  Validate the context and check whether logging is enabled.
+**********************************************************************/
+static PmLogErr PrvCheckContext(const PmLogContext_* contextP,
+    PmLogLevel level)
+{
+    // context should already have been resolved
+    assert(contextP != NULL);
+
+    if (!PrvIsValidLevel(level))
+    {
+        return kPmLogErr_InvalidLevel;
+    }
+
+    if (level > contextP->info.enabledLevel)
+    {
+        return kPmLogErr_LevelDisabled;
+    }
+
+    return kPmLogErr_None;
+}
+
+
+/*********************************************************************/
+/* PrvLogToConsole */
+/**
+@brief  Echos the logged info + message to the output.
+**********************************************************************/
+static void PrvLogToConsole(FILE* out, const char* identStr,
+    const char* ptidStr, const char* componentStr, const char* s)
+{
+    size_t        sLen;
+    const char* endStr;
+
+    sLen = strlen(s);
+
+    if ((sLen > 0) && (s[sLen - 1] == '\n'))
+    {
+        endStr = "";
+    }
+    else
+    {
+        endStr = "\n";
+    }
+
+    fprintf(out, "%s%s%s%s%s", identStr, ptidStr, componentStr, s, endStr);
+}
+
+
+/***********************************************************************
+ * Latency histograms
+ *
+ * When "latencyHistograms" is set in default.conf, the time spent in
+ * PmLogString_, _PmLogMsgKV and PrvLogWrite is recorded in log2
+ * histograms.  Each thread records into its own, so the hot path only
+ * takes two clock reads and a few plain stores.  PmLogPrvGetLatency
+ * merges the histograms of all the threads of the process on demand;
+ * those of the threads that exited are folded into gLatency.retired.
+ * The histograms of a thread are mapped with mmap() on its first
+ * sample, which may be taken in a signal handler that interrupted
+ * malloc.
+ ***********************************************************************/
+typedef struct PrvLatencyThread
+{
+    PmLogLatencyHistogram       hist[ kPmLogLatency_NumSites ];
+    struct PrvLatencyThread     *next;
+}
+PrvLatencyThread;
+
+static struct
+{
+    pthread_mutex_t         lock;
+    pthread_once_t          once;
+    pthread_key_t           key;
+    PrvLatencyThread        *threads;
+    PmLogLatencyHistogram   retired[ kPmLogLatency_NumSites ];
+}
+gLatency =
+{
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .once = PTHREAD_ONCE_INIT
+};
+
+static __thread PrvLatencyThread *tLatency;
+
+
+/*********************************************************************/
+/* PrvLatencyMerge */
+/**
+@brief  Adds the histogram at srcP to the one at dstP.
+**********************************************************************/
+static void PrvLatencyMerge(PmLogLatencyHistogram *dstP,
+        const PmLogLatencyHistogram *srcP)
+{
+    int i;
+
+    dstP->count += __atomic_load_n(&srcP->count, __ATOMIC_RELAXED);
+    dstP->sumNs += __atomic_load_n(&srcP->sumNs, __ATOMIC_RELAXED);
+    for (i = 0; i < PMLOG_LATENCY_BUCKETS; i++)
+    {
+        dstP->buckets[ i ] += __atomic_load_n(&srcP->buckets[ i ], __ATOMIC_RELAXED);
+    }
+}
+
+
+/*********************************************************************/
+/* PrvLatencyThreadExit */
+/**
+@brief  pthread key destructor, folds the histograms of an exiting
+        thread into the retired ones.
+**********************************************************************/
+static void PrvLatencyThreadExit(void *arg)
+{
+    PrvLatencyThread    *threadP = arg;
+    PrvLatencyThread    **linkP;
+    int                 site;
+
+    pthread_mutex_lock(&gLatency.lock);
+
+    for (linkP = &gLatency.threads; *linkP != NULL; linkP = &(*linkP)->next)
+    {
+        if (*linkP == threadP)
+        {
+            *linkP = threadP->next;
+            break;
+        }
+    }
+
+    for (site = 0; site < kPmLogLatency_NumSites; site++)
+    {
+        PrvLatencyMerge(&gLatency.retired[ site ], &threadP->hist[ site ]);
+    }
+
+    pthread_mutex_unlock(&gLatency.lock);
+
+    tLatency = NULL;
+    (void) munmap(threadP, sizeof(*threadP));
+}
+
+
+static void PrvLatencyInitKey(void)
+{
+    (void) pthread_key_create(&gLatency.key, PrvLatencyThreadExit);
+}
+
+
+/*********************************************************************/
+/* PrvLatencyPrepareFork / PrvLatencyParentFork / PrvLatencyChildFork */
+/**
+@brief  fork() handlers.  Only the forking thread survives in the
+        child: the histograms of the others are folded into the
+        retired ones, as if they had exited.
+**********************************************************************/
+static void PrvLatencyPrepareFork(void)
+{
+    pthread_mutex_lock(&gLatency.lock);
+}
+
+static void PrvLatencyParentFork(void)
+{
+    pthread_mutex_unlock(&gLatency.lock);
+}
+
+static void PrvLatencyChildFork(void)
+{
+    PrvLatencyThread    *threadP;
+    int                 site;
+
+    while ((threadP = gLatency.threads) != NULL)
+    {
+        gLatency.threads = threadP->next;
+        if (threadP == tLatency)
+        {
+            continue;
+        }
+
+        for (site = 0; site < kPmLogLatency_NumSites; site++)
+        {
+            PrvLatencyMerge(&gLatency.retired[ site ], &threadP->hist[ site ]);
+        }
+        (void) munmap(threadP, sizeof(*threadP));
+    }
+
+    if (tLatency != NULL)
+    {
+        tLatency->next = NULL;
+        gLatency.threads = tLatency;
+    }
+
+    pthread_mutex_unlock(&gLatency.lock);
+}
+
+
+/*********************************************************************/
+/* PrvLatencyStart */
+/**
+@brief  Returns the start time of a timed call, or 0 if the histograms
+        are off.  Called before the context is resolved, so the shared
+        memory may be unusable.
+**********************************************************************/
+static inline uint64_t PrvLatencyStart(void)
+{
+    if ((gGlobalsP == NULL) ||
+        !__atomic_load_n(&gGlobalsP->latencyHistograms, __ATOMIC_RELAXED))
+    {
+        return 0;
+    }
+
+    return PrvNowNs();
+}
+
+
+/*********************************************************************/
+/* PrvLatencyRecord */
+/**
+@brief  Records the time since start, unless start is 0, in the site's
+        histogram of the calling thread.
+**********************************************************************/
+static void PrvLatencyRecord(PmLogLatencySite site, uint64_t start)
+{
+    PmLogLatencyHistogram   *histP;
+    PrvLatencyThread        *threadP = tLatency;
+    uint64_t                ns;
+    int                     bucket;
+
+    if (start == 0)
+    {
+        return;
+    }
+
+    ns = PrvNowNs() - start;
+
+    if (threadP == NULL)
+    {
+        // a signal handler can't take the lock, it skips the sample
+        if (PrvLogNested())
+        {
+            return;
+        }
+
+        threadP = mmap(NULL, sizeof(*threadP), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (threadP == MAP_FAILED)
+        {
+            return;
+        }
+
+        (void) pthread_once(&gLatency.once, PrvLatencyInitKey);
+        (void) pthread_setspecific(gLatency.key, threadP);
+
+        pthread_mutex_lock(&gLatency.lock);
+        threadP->next = gLatency.threads;
+        gLatency.threads = threadP;
+        pthread_mutex_unlock(&gLatency.lock);
+
+        tLatency = threadP;
+    }
+
+    bucket = (ns == 0) ? 0 : 64 - __builtin_clzll(ns);
+    if (bucket >= PMLOG_LATENCY_BUCKETS)
+    {
+        bucket = PMLOG_LATENCY_BUCKETS - 1;
+    }
+
+    // only this thread writes, the stores just need to be untorn
+    histP = &threadP->hist[ site ];
+    __atomic_store_n(&histP->count, histP->count + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&histP->sumNs, histP->sumNs + ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&histP->buckets[ bucket ], histP->buckets[ bucket ] + 1,
+                     __ATOMIC_RELAXED);
+}
+
+
+/*********************************************************************/
+/* PmLogPrvGetLatency */
+/**
+@brief  Returns the histogram of the site merged over all the threads
+        of the process.
+**********************************************************************/
+PmLogErr PmLogPrvGetLatency(PmLogLatencySite site, PmLogLatencyHistogram *histP)
+{
+    const PrvLatencyThread *threadP;
+
+    if ((site < 0) || (site >= kPmLogLatency_NumSites) || (histP == NULL))
+    {
+        return kPmLogErr_InvalidParameter;
+    }
+
+    memset(histP, 0, sizeof(*histP));
+
+    pthread_mutex_lock(&gLatency.lock);
+
+    PrvLatencyMerge(histP, &gLatency.retired[ site ]);
+    for (threadP = gLatency.threads; threadP != NULL; threadP = threadP->next)
+    {
+        PrvLatencyMerge(histP, &threadP->hist[ site ]);
+    }
+
+    pthread_mutex_unlock(&gLatency.lock);
+
+    return kPmLogErr_None;
+}
+
+
+/***********************************************************************
+ * Context counters
+ *
+ * Each context has a line of relaxed atomic counters in the shared
+ * globals, parallel to the contexts themselves: counters[0] for the
+ * global context and counters[1 + i] for userContexts[i].  They are
+ * read with PmLogGetContextStats, or logged for all the contexts with
+ * the "!loglib dumpstats" command.
+ *
+ * levelRejected only counts the records rejected by the level inside
+ * the library, i.e. direct calls to PmLogString_ and _PmLogMsgKV.  The
+ * PmLogMsg, PmLogString and C++ Stream macros check the level inline
+ * and never call in for a disabled level, so their records aren't
+ * counted.
+ ***********************************************************************/
+
+/*********************************************************************/
+/* PrvCountersGet */
+/**
+@brief  Returns the counters of the context.
+**********************************************************************/
+static inline PmLogContextCounters* PrvCountersGet(const PmLogContext_ *contextP)
+{
+    if ((contextP >= gGlobalsP->userContexts) &&
+        (contextP < gGlobalsP->userContexts + PMLOG_MAX_NUM_CONTEXTS))
+    {
+        return &gGlobalsP->counters[ 1 + (contextP - gGlobalsP->userContexts) ];
+    }
+
+    return &gGlobalsP->counters[ 0 ];
+}
+
+
+/*********************************************************************/
+/* PrvCountersAdd */
+/**
+@brief  Counts a record of lineLen bytes written out.
+**********************************************************************/
+static inline void PrvCountersAdd(const PmLogContext_ *contextP, size_t lineLen)
+{
+    PmLogContextCounters *countersP = PrvCountersGet(contextP);
+
+    __atomic_add_fetch(&countersP->messages, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&countersP->bytes, lineLen, __ATOMIC_RELAXED);
+}
+
+
+/*********************************************************************/
+/* PrvCountersTruncated */
+/**
+@brief  Counts a record truncated to fit BUFFER_LEN.
+**********************************************************************/
+static inline void PrvCountersTruncated(const PmLogContext_ *contextP)
+{
+    __atomic_add_fetch(&PrvCountersGet(contextP)->truncated, 1, __ATOMIC_RELAXED);
+}
+
+
+/*********************************************************************/
+/* PrvCountersCountErr */
+/**
+@brief  Counts the record if it was rejected with err.
+**********************************************************************/
+static inline void PrvCountersCountErr(const PmLogContext_ *contextP, PmLogErr err)
+{
+    switch (err)
+    {
+        case kPmLogErr_None:
+            break;
+
+        case kPmLogErr_LevelDisabled:
+            __atomic_add_fetch(&PrvCountersGet(contextP)->levelRejected, 1, __ATOMIC_RELAXED);
+            break;
+
+        case kPmLogErr_InvalidMsgID:
+        case kPmLogErr_InvalidFormat:
+        case kPmLogErr_FormatStringFailed:
+            __atomic_add_fetch(&PrvCountersGet(contextP)->invalid, 1, __ATOMIC_RELAXED);
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/*********************************************************************/
+/* PmLogGetContextStats */
+/**
+@brief  Returns the counters of the specified context, summed over all
+        the processes logging to it.
+**********************************************************************/
+PmLogErr PmLogGetContextStats(PmLogContext context, PmLogContextStats *statsP)
+{
+    const PmLogContext_         *contextP;
+    const PmLogContextCounters  *countersP;
+
+    if (statsP == NULL)
+    {
+        return kPmLogErr_InvalidParameter;
+    }
+
+    memset(statsP, 0, sizeof(*statsP));
+
+    contextP = PrvResolveContext(context);
+    if (contextP == NULL)
+    {
+        return kPmLogErr_InvalidContext;
+    }
+
+    countersP = PrvCountersGet(contextP);
+
+    statsP->messages      = __atomic_load_n(&countersP->messages, __ATOMIC_RELAXED);
+    statsP->bytes         = __atomic_load_n(&countersP->bytes, __ATOMIC_RELAXED);
+    statsP->levelRejected = __atomic_load_n(&countersP->levelRejected, __ATOMIC_RELAXED);
+    statsP->invalid       = __atomic_load_n(&countersP->invalid, __ATOMIC_RELAXED);
+    statsP->truncated     = __atomic_load_n(&countersP->truncated, __ATOMIC_RELAXED);
+
+    return kPmLogErr_None;
+}
+
+
+/*********************************************************************/
+/* PrvCountersDump */
+/**
+@brief  Logs the counters of every context that has been used.
+**********************************************************************/
+static void PrvCountersDump(void)
+{
+    const PmLogContext_         *contextP;
+    const PmLogContextCounters  *countersP;
+    uint64_t                    messages;
+    uint64_t                    levelRejected;
+    uint64_t                    invalid;
+    int                         i;
+
+    for (i = -1; i < gGlobalsP->numUserContexts; i++)
+    {
+        contextP = (i < 0) ? &gGlobalsP->globalContext : &gGlobalsP->userContexts[ i ];
+        countersP = PrvCountersGet(contextP);
+
+        messages = __atomic_load_n(&countersP->messages, __ATOMIC_RELAXED);
+        levelRejected = __atomic_load_n(&countersP->levelRejected, __ATOMIC_RELAXED);
+        invalid = __atomic_load_n(&countersP->invalid, __ATOMIC_RELAXED);
+
+        if ((messages == 0) && (levelRejected == 0) && (invalid == 0))
+        {
+            continue;
+        }
+
+        CallSysLog(COMPONENT_PREFIX, LOG_INFO, "[]",
+                   "CONTEXT_STATS {\"CONTEXT\":\"%s\",\"MESSAGES\":%" PRIu64 ",\"BYTES\":%" PRIu64
+                   ",\"LEVEL_REJECTED\":%" PRIu64 ",\"INVALID\":%" PRIu64 ",\"TRUNCATED\":%" PRIu64 "}",
+                   contextP->component, messages,
+                   __atomic_load_n(&countersP->bytes, __ATOMIC_RELAXED), levelRejected, invalid,
+                   __atomic_load_n(&countersP->truncated, __ATOMIC_RELAXED));
+    }
+}
+
+
+/***********************************************************************
+ * HandleLogLibCommand
+ ***********************************************************************/
+static bool HandleLogLibCommand(const char* msg)
+{
+    const char*  kLogLibCmdPrefix    = "!loglib ";
+    const size_t kLogLibCmdPrefixLen = 8;
+    int contextsNumber, contextIndex;
+    PmLogContext  context;
+    PmLogContext_ *contextP;
+    PmLogErr      logErr;
+
+    if (strncmp(msg, kLogLibCmdPrefix, kLogLibCmdPrefixLen) != 0)
+    {
+        return false;
+    }
+
+    msg += kLogLibCmdPrefixLen;
+
+    if (strcmp(msg, "loadconf") == 0)
+    {
+        DbgPrint("HandleLogLibCommand: re-loading global config\n");
+        PrvMsgPolicyClearAll();
+        PmLogPrvReadConfigs(parse_json_file);
+
+        /* updating all context flags that preserved defaults */
+        logErr = PmLogGetNumContexts(&contextsNumber);
+        if (logErr != kPmLogErr_None)
+        {
+            DbgPrint("No contexts found. Error no: %d", logErr);
+            return false;
+        }
+        for (contextIndex = 0; contextIndex < contextsNumber; ++contextIndex)
+        {
+            logErr = PmLogGetIndContext(contextIndex, &context);
+            if(logErr != kPmLogErr_None)
+            {
+                DbgPrint("Context no %d not found. Error no: %d", contextIndex, logErr);
+                continue;
+            }
+            contextP = PrvResolveContext(context);
+            if ((contextP) && (gGlobalContextP) &&
+                !(contextP->info.flags & kPmLogFlag_Overridden))
+            {
+                contextP->info.flags = gGlobalContextP->info.flags;
+            }
+        }
+        return true;
+    }
+
+    if (strcmp(msg, "dumpstats") == 0)
+    {
+        PrvCountersDump();
+        return true;
+    }
+
+    return false;
+}
+
+/*********************************************************************/
+/* PrvLogEmit */
+/**
+@brief  Writes one record to syslog and, if the context asks for it,
+        echoes it to the console.  If batch is given the record is only
+        added to it, and goes out with the next PrvSyslogFlush.
+**********************************************************************/
+static void PrvLogEmit(PmLogContext_ *contextP, PmLogLevel level,
+        const char *ptidStr, const char *msgid, const char *s,
+        PrvSyslogBatch *batch)
+{
+    const char  *identStr;
+    const char  *componentStr = contextP->component;
+    char        *line;
+    size_t      lineLen;
+    size_t      bodyOffset;
+
+    identStr = __progname;
+
+    if (batch != NULL)
+    {
+        // the record has to outlive its slot in the thread's ring
+        line = PrvSyslogBatchNext(batch);
+        lineLen = PrvSyslogFormat(line, SYSLOG_LINE_LEN, &bodyOffset, level, "%s %s %s %s %s",
+                                  ptidStr, PMLOG_IDENTIFIER, componentStr, msgid ? msgid : "", s);
+        PrvSyslogBatchAdd(batch, level, lineLen, bodyOffset);
+    }
+    else
+    {
+        lineLen = PrvSyslogSendRecord(level, ptidStr, componentStr, msgid, s);
+    }
+
+    PrvCountersAdd(contextP, lineLen);
+
+    if (contextP->info.flags & kPmLogFlag_LogToConsole)
+    {
+        const PmLogConsole* consoleConfP = &gGlobalsP->consoleConf;
+
+        if (ptidStr[0] == 0)
+        {
+            ptidStr = ": ";
+        }
+
+        if ((level >= consoleConfP->stdErrMinLevel) &&
+            (level <= consoleConfP->stdErrMaxLevel))
+        {
+            PrvLogToConsole(stderr, identStr, ptidStr, componentStr, s);
+        }
+
+        if ((level >= consoleConfP->stdOutMinLevel) &&
+            (level <= consoleConfP->stdOutMaxLevel))
+        {
+            PrvLogToConsole(stdout, identStr, ptidStr, componentStr, s);
+        }
+    }
+}
+
+
+/***********************************************************************
+ * Asynchronous logging
+ *
+ * When enabled with PmLogSetAsyncLogging, PrvLogWrite copies each
+ * record into a ring buffer owned by the calling thread and returns
+ * immediately.  A writer thread owned by the library drains all the
+ * rings and calls PrvLogEmit, so the syslog socket is never touched on
+ * the caller's thread.
+ *
+ * Each ring has exactly one producer (its thread) and one consumer
+ * (the writer thread), so the hot path needs no locks: the producer
+ * publishes records by advancing 'head', the writer frees them by
+ * advancing 'tail'.  If a ring is full its thread waits for the writer
+ * to make room: writing the record synchronously would put it ahead of
+ * the thread's queued ones.  It sleeps on a futex on 'tail', and sets
+ * 'waiting' so that the writer only makes the wake up call then.
+ *
+ * A thread sets 'producing' before it looks at gAsync.enabled and
+ * clears it once its record is published, so disabling can wait for
+ * the records that were being added as it cleared the flag.  Threads
+ * that log meanwhile sleep on a futex on gAsync.draining.
+ *
+ * The writer sleeps on an eventfd.  Producers only write to it when
+ * the writer has announced that it is idle, so a busy writer costs the
+ * callers no syscalls at all.
+ ***********************************************************************/
+#define ASYNC_RING_SIZE         (64 * 1024)     // per thread, power of 2
+#define ASYNC_RING_MASK         (ASYNC_RING_SIZE - 1)
+#define ASYNC_MAX_RECORD_SIZE   (ASYNC_RING_SIZE / 4)
+#define ASYNC_ALIGN(n)          (((n) + 7) & ~((size_t) 7))
+
+enum
+{
+    kAsyncRecord_Text     = 1,
+    kAsyncRecord_Padding  = 2,  /* skip to the start of the ring */
+    kAsyncRecord_Deferred = 3   /* PmLogMsg format and raw arguments */
+};
+
+typedef struct
+{
+    uint32_t        size;       /* total size of the record in the ring */
+    uint32_t        kind;
+    PmLogContext_   *contextP;
+    int32_t         level;
+    uint16_t        ptidLen;
+    uint16_t        msgidLen;
+    uint32_t        textLen;    /* the format for deferred records */
+    uint32_t        kvCount;    /* deferred records only */
+    /* followed by ptid, msgid and text, each '\0' terminated, and
+       for deferred records by the arguments, see PrvDeferredCapture */
+}
+PrvAsyncRecord;
+
+typedef struct PrvAsyncRing
+{
+    struct PrvAsyncRing *next;
+    uint32_t            head;       /* advanced by the owning thread */
+    uint32_t            tail;       /* advanced by the writer thread */
+    uint32_t            waiting;    /* owning thread sleeps for room */
+    int                 producing;  /* owning thread is adding a record */
+    int                 orphaned;   /* owning thread has exited */
+    char                data[ ASYNC_RING_SIZE ] __attribute__((aligned(8)));
+}
+PrvAsyncRing;
+
+static struct
+{
+    pthread_mutex_t     controlLock;    /* serializes enable/disable */
+    pthread_mutex_t     ringsLock;      /* protects the rings list */
+    pthread_once_t      keyOnce;
+    pthread_key_t       ringKey;
+    PrvAsyncRing        *rings;
+    PrvAsyncRing        *staleRings;    /* inherited over fork() */
+    pthread_t           writer;
+    int                 eventFd;
+    int                 enabled;
+    int                 deferred;       /* PmLogSetDeferredFormatting */
+    int                 running;
+    int                 stop;
+    int                 writerIdle;
+    int                 draining;       /* being disabled, see PrvAsyncWaitDrained */
+    int                 needRestart;
+}
+gAsync =
+{
+    .controlLock = PTHREAD_MUTEX_INITIALIZER,
+    .ringsLock   = PTHREAD_MUTEX_INITIALIZER,
+    .keyOnce     = PTHREAD_ONCE_INIT,
+    .eventFd     = -1
+};
+
+static __thread PrvAsyncRing *tAsyncRing = NULL;
+static __thread bool tAsyncWriter = false;
+
+// see Repeat coalescing below
+static void PrvRepeatThreadExit(void *arg);
+static void PrvRepeatWriterTick(void);
+
+
+/*********************************************************************/
+/* PrvAsyncReleaseRing */
+/**
+@brief  Thread exit handler.  Hands the ring over to the writer thread,
+        which frees it once everything in it has been written.
+**********************************************************************/
+static void PrvAsyncReleaseRing(void *data)
+{
+    PrvAsyncRing *ring = (PrvAsyncRing*) data;
+
+    // a run of repeats is reported behind the thread's records
+    PrvRepeatThreadExit(NULL);
+
+    __atomic_store_n(&ring->orphaned, 1, __ATOMIC_RELEASE);
+}
+
+static void PrvAsyncCreateKey(void)
+{
+    (void) pthread_key_create(&gAsync.ringKey, PrvAsyncReleaseRing);
+}
+
+
+/*********************************************************************/
+/* PrvAsyncGetRing */
+/**
+@brief  Returns the ring of the calling thread, allocating and
+        registering it on first use.  Returns NULL if out of memory.
+**********************************************************************/
+static PrvAsyncRing* PrvAsyncGetRing(void)
+{
+    PrvAsyncRing *ring = tAsyncRing;
+
+    if (ring != NULL)
+    {
+        return ring;
+    }
+
+    (void) pthread_once(&gAsync.keyOnce, PrvAsyncCreateKey);
+
+    ring = (PrvAsyncRing*) calloc(1, sizeof(PrvAsyncRing));
+    if (ring == NULL)
+    {
+        return NULL;
+    }
+
+    (void) pthread_setspecific(gAsync.ringKey, ring);
+
+    pthread_mutex_lock(&gAsync.ringsLock);
+    ring->next = gAsync.rings;
+    gAsync.rings = ring;
+    pthread_mutex_unlock(&gAsync.ringsLock);
+
+    tAsyncRing = ring;
+    return ring;
+}
+
+
+/*********************************************************************/
+/* PrvAsyncWakeWriter */
+/**
+@brief  Wakes the writer thread if it is waiting for records.
+**********************************************************************/
+static void PrvAsyncWakeWriter(bool force)
+{
+    uint64_t one = 1;
+
+    if (__atomic_exchange_n(&gAsync.writerIdle, 0, __ATOMIC_SEQ_CST) || force)
+    {
+        if (write(gAsync.eventFd, &one, sizeof(one)) == -1)
+        {
+            DbgPrint("eventfd write error: %s\n", strerror(errno));
+        }
+    }
+}
+
+
+/*********************************************************************/
+/* PrvAsyncBeginEnqueue */
+/**
+@brief  Returns the ring of the calling thread, marked as being added
+        to, if asynchronous logging is on.  Returns NULL if the record
+        has to be written synchronously.  A non-NULL ring must be
+        handed to PrvAsyncEndEnqueue.
+**********************************************************************/
+static PrvAsyncRing* PrvAsyncBeginEnqueue(void)
+{
+    PrvAsyncRing *ring;
+
+    // the writer can't wait for itself to make room
+    if (tAsyncWriter)
+    {
+        return NULL;
+    }
+
+    ring = PrvAsyncGetRing();
+    if (ring == NULL)
+    {
+        return NULL;
+    }
+
+    // pairs with PmLogSetAsyncLogging clearing 'enabled' before it
+    // looks at the flag
+    __atomic_store_n(&ring->producing, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&gAsync.enabled, __ATOMIC_SEQ_CST))
+    {
+        __atomic_store_n(&ring->producing, 0, __ATOMIC_RELEASE);
+        return NULL;
+    }
+
+    return ring;
+}
+
+
+/*********************************************************************/
+/* PrvAsyncEndEnqueue */
+/**
+@brief  Ends PrvAsyncBeginEnqueue, after the record has been published
+        or given up on.
+**********************************************************************/
+static void PrvAsyncEndEnqueue(PrvAsyncRing *ring)
+{
+    __atomic_store_n(&ring->producing, 0, __ATOMIC_RELEASE);
+}
+
+
+/*********************************************************************/
+/* PrvAsyncWaitForRoom */
+/**
+@brief  Waits until the ring has room for needed bytes.  Space is
+        made by the writer thread, or by PmLogSetAsyncLogging once
+        the writer has stopped.  Returns the tail.
+**********************************************************************/
+static uint32_t PrvAsyncWaitForRoom(PrvAsyncRing *ring, size_t needed)
+{
+    uint32_t tail;
+
+    for (;;)
+    {
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (needed <= ASYNC_RING_SIZE - (uint32_t) (ring->head - tail))
+        {
+            return tail;
+        }
+
+        // pairs with PrvAsyncDrainRing advancing 'tail' before it looks
+        __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+        if (needed <= ASYNC_RING_SIZE - (uint32_t) (ring->head - tail))
+        {
+            __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+            return tail;
+        }
+
+        PrvAsyncWakeWriter(false);
+        (void) syscall(SYS_futex, &ring->tail, FUTEX_WAIT_PRIVATE, tail, NULL, NULL, 0);
+    }
+}
+
+
+/*********************************************************************/
+/* PrvAsyncWaitDrained */
+/**
+@brief  Waits, while asynchronous logging is being disabled, until
+        everything queued has been written.  A record written
+        synchronously before that would overtake the ones its thread
+        has queued.
+**********************************************************************/
+static void PrvAsyncWaitDrained(void)
+{
+    while (!tAsyncWriter && __atomic_load_n(&gAsync.draining, __ATOMIC_SEQ_CST))
+    {
+        (void) syscall(SYS_futex, &gAsync.draining, FUTEX_WAIT_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+
+/*********************************************************************/
+/* PrvAsyncEnqueue */
+/**
+@brief  Copies a record into the calling thread's ring, waiting for
+        room if it is full.  Returns false if the record has to be
+        written synchronously instead.
+**********************************************************************/
+static bool PrvAsyncEnqueue(PmLogContext_ *contextP, PmLogLevel level,
+        const char *ptidStr, const char *msgid, const char *s)
+{
+    PrvAsyncRing    *ring;
+    PrvAsyncRecord  *recordP;
+    size_t          ptidLen;
+    size_t          msgidLen;
+    size_t          textLen;
+    size_t          size;
+    size_t          contiguous;
+    size_t          needed;
+    uint32_t        head;
+    char            *p;
+
+    if (msgid == NULL)
+    {
+        msgid = "";
+    }
+
+    ptidLen = strlen(ptidStr);
+    msgidLen = strlen(msgid);
+    textLen = strlen(s);
+
+    // messages are at most PMLOG_MAX_MESSAGE_SIZE, so this is only a
+    // safety net
+    size = ASYNC_ALIGN(sizeof(PrvAsyncRecord) + ptidLen + 1 + msgidLen + 1 + textLen + 1);
+    if ((size > ASYNC_MAX_RECORD_SIZE) || (ptidLen > UINT16_MAX) || (msgidLen > UINT16_MAX))
+    {
+        return false;
+    }
+
+    ring = PrvAsyncBeginEnqueue();
+    if (ring == NULL)
+    {
+        return false;
+    }
+
+    head = ring->head;
+
+    // a record never wraps, the rest of the ring is skipped instead
+    contiguous = ASYNC_RING_SIZE - (head & ASYNC_RING_MASK);
+    needed = (contiguous < size) ? contiguous + size : size;
+
+    (void) PrvAsyncWaitForRoom(ring, needed);
+
+    if (contiguous < size)
+    {
+        recordP = (PrvAsyncRecord*) (ring->data + (head & ASYNC_RING_MASK));
+        recordP->size = contiguous;
+        recordP->kind = kAsyncRecord_Padding;
+        head += contiguous;
+    }
+
+    recordP = (PrvAsyncRecord*) (ring->data + (head & ASYNC_RING_MASK));
+    recordP->size = size;
+    recordP->kind = kAsyncRecord_Text;
+    recordP->contextP = contextP;
+    recordP->level = level;
+    recordP->ptidLen = ptidLen;
+    recordP->msgidLen = msgidLen;
+    recordP->textLen = textLen;
+
+    p = (char*) (recordP + 1);
+    memcpy(p, ptidStr, ptidLen + 1);
+    p += ptidLen + 1;
+    memcpy(p, msgid, msgidLen + 1);
+    p += msgidLen + 1;
+    memcpy(p, s, textLen + 1);
+
+    __atomic_store_n(&ring->head, head + size, __ATOMIC_SEQ_CST);
+    PrvAsyncEndEnqueue(ring);
+
+    PrvAsyncWakeWriter(false);
+    return true;
+}
+
+
+// records being collected for the next sendmmsg, writer thread only;
+// allocated with the writer, its lines are too big for a static
+static PrvSyslogBatch *gAsyncBatch;
+
+// see Deferred formatting below
+static bool PrvDeferredRender(const PrvAsyncRecord *recordP, char *s);
+
+
+/*********************************************************************/
+/* PrvAsyncDrainRing */
+/**
+@brief  Adds everything queued in the ring to the writer's batch.
+        Called from the writer thread only.  Returns true if anything
+        was written.
+**********************************************************************/
+static bool PrvAsyncDrainRing(PrvAsyncRing *ring)
+{
+    PrvSyslogBatch          *batch = gAsyncBatch;
+    const PrvAsyncRecord    *recordP;
+    const char              *ptidStr;
+    const char              *msgid;
+    const char              *s;
+    char                    deferredStr[ BUFFER_LEN ];
+    uint32_t                head;
+    uint32_t                tail;
+
+    tail = ring->tail;
+    head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+
+    if (tail == head)
+    {
+        return false;
+    }
+
+    while (tail != head)
+    {
+        recordP = (const PrvAsyncRecord*) (ring->data + (tail & ASYNC_RING_MASK));
+
+        if (recordP->kind == kAsyncRecord_Text)
+        {
+            ptidStr = (const char*) (recordP + 1);
+            msgid = ptidStr + recordP->ptidLen + 1;
+            s = msgid + recordP->msgidLen + 1;
+
+            PrvLogEmit(recordP->contextP, recordP->level, ptidStr, msgid, s, batch);
+        }
+        else if (recordP->kind == kAsyncRecord_Deferred)
+        {
+            ptidStr = (const char*) (recordP + 1);
+            msgid = ptidStr + recordP->ptidLen + 1;
+
+            if (PrvDeferredRender(recordP, deferredStr))
+            {
+                PrvLogEmit(recordP->contextP, recordP->level, ptidStr, msgid,
+                           deferredStr, batch);
+            }
+        }
+
+        tail += recordP->size;
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    // pairs with PrvAsyncWaitForRoom setting 'waiting' before its last look
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&ring->waiting, 0, __ATOMIC_SEQ_CST))
+    {
+        (void) syscall(SYS_futex, &ring->tail, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+
+    return true;
+}
+
+
+/*********************************************************************/
+/* PrvAsyncDrainAll */
+/**
+@brief  Drains all the registered rings and frees the ones whose
+        threads have exited.  Returns true if anything was written.
+**********************************************************************/
+static bool PrvAsyncDrainAll(void)
+{
+    PrvAsyncRing    *ring;
+    PrvAsyncRing    **linkP;
+    bool            worked = false;
+
+    // new rings are only ever pushed at the list head, and only this
+    // thread unlinks them, so a snapshot of the head is enough
+    pthread_mutex_lock(&gAsync.ringsLock);
+    ring = gAsync.rings;
+    pthread_mutex_unlock(&gAsync.ringsLock);
+
+    for (; ring != NULL; ring = ring->next)
+    {
+        worked |= PrvAsyncDrainRing(ring);
+    }
+
+    pthread_mutex_lock(&gAsync.ringsLock);
+    linkP = &gAsync.rings;
+    while ((ring = *linkP) != NULL)
+    {
+        if (__atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE))
+        {
+            // the owner is gone, so nothing can be added anymore
+            (void) PrvAsyncDrainRing(ring);
+            *linkP = ring->next;
+            free(ring);
+            continue;
+        }
+        linkP = &ring->next;
+    }
+    pthread_mutex_unlock(&gAsync.ringsLock);
+
+    PrvSyslogFlush(gAsyncBatch);
+
+    return worked;
+}
+
+
+/*********************************************************************/
+/* PrvAsyncWriterThread */
+/**
+@brief  Body of the writer thread.  Runs until asked to stop, and
+        drains all the rings before exiting.
+**********************************************************************/
+static void* PrvAsyncWriterThread(void *arg)
+{
+    sigset_t    old_set;
+    uint64_t    value;
+
+    (void) arg;
+
+    tAsyncWriter = true;
+
+    // signals are for the application threads
+    block_signals(&old_set);
+
+    for (;;)
+    {
+        PrvRepeatWriterTick();
+
+        if (PrvAsyncDrainAll())
+        {
+            continue;
+        }
+
+        if (__atomic_load_n(&gAsync.stop, __ATOMIC_ACQUIRE))
+        {
+            break;
+        }
+
+        // announce we are about to sleep, then look once more so a
+        // record published just before the announcement isn't missed
+        __atomic_store_n(&gAsync.writerIdle, 1, __ATOMIC_SEQ_CST);
+        if (PrvAsyncDrainAll())
+        {
+            __atomic_store_n(&gAsync.writerIdle, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        while ((read(gAsync.eventFd, &value, sizeof(value)) == -1) &&
+               (errno == EINTR))
+        {
+        }
+    }
+
+    return NULL;
+}
+
+
+/*********************************************************************/
+/* PrvAsyncStartWriter */
+/**
+@brief  Creates the doorbell and starts the writer thread.
+        Must be called with controlLock held.
+**********************************************************************/
+static PmLogErr PrvAsyncStartWriter(void)
+{
+    if (gAsyncBatch == NULL)
+    {
+        gAsyncBatch = malloc(sizeof(PrvSyslogBatch));
+        if (gAsyncBatch == NULL)
+        {
+            DbgPrint("malloc error\n");
+            return kPmLogErr_Unknown;
+        }
+    }
+    // a forked child may inherit the parent's unsent records
+    gAsyncBatch->count = 0;
+
+    gAsync.eventFd = eventfd(0, EFD_CLOEXEC);
+    if (gAsync.eventFd == -1)
+    {
+        DbgPrint("eventfd error: %s\n", strerror(errno));
+        return kPmLogErr_Unknown;
+    }
+
+    gAsync.stop = 0;
+    gAsync.writerIdle = 0;
+
+    if (pthread_create(&gAsync.writer, NULL, PrvAsyncWriterThread, NULL) != 0)
+    {
+        DbgPrint("pthread_create error\n");
+        close(gAsync.eventFd);
+        gAsync.eventFd = -1;
+        return kPmLogErr_Unknown;
+    }
+
+    gAsync.running = 1;
+    return kPmLogErr_None;
+}
+
+
+/*********************************************************************/
+/* PrvAsyncProducing */
+/**
+@brief  Returns true if a thread is adding a record to its ring.
+**********************************************************************/
+static bool PrvAsyncProducing(void)
+{
+    PrvAsyncRing    *ring;
+    bool            producing = false;
+
+    pthread_mutex_lock(&gAsync.ringsLock);
+    for (ring = gAsync.rings; (ring != NULL) && !producing; ring = ring->next)
+    {
+        producing = __atomic_load_n(&ring->producing, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&gAsync.ringsLock);
+
+    return producing;
+}
+
+
+/*********************************************************************/
+/* PrvAsyncStopWriter */
+/**
+@brief  Stops the writer thread after it has drained all the rings.
+        'enabled' must have been cleared, and controlLock be held.
+**********************************************************************/
+static void PrvAsyncStopWriter(void)
+{
+    bool producing;
+
+    if (!gAsync.running)
+    {
+        return;
+    }
+
+    __atomic_store_n(&gAsync.stop, 1, __ATOMIC_RELEASE);
+    PrvAsyncWakeWriter(true);
+    pthread_join(gAsync.writer, NULL);
+
+    // threads that saw 'enabled' still set may be adding records, or
+    // waiting for room, after the writer's last look: take its place
+    // until they are done
+    tAsyncWriter = true;
+    do
+    {
+        producing = PrvAsyncProducing();
+        (void) PrvAsyncDrainAll();
+        if (producing)
+        {
+            (void) sched_yield();
+        }
+    }
+    while (producing);
+    tAsyncWriter = false;
+
+    close(gAsync.eventFd);
+    gAsync.eventFd = -1;
+    gAsync.running = 0;
+
+    free(gAsyncBatch);
+    gAsyncBatch = NULL;
+}
+
+
+/*********************************************************************/
+/* PrvAsyncFreeStaleRings */
+/**
+@brief  Frees the rings inherited from the parent over fork().  They
+        hold records that the parent writes itself.
+        Must be called with controlLock held.
+**********************************************************************/
+static void PrvAsyncFreeStaleRings(void)
+{
+    PrvAsyncRing *ring;
+
+    while ((ring = gAsync.staleRings) != NULL)
+    {
+        gAsync.staleRings = ring->next;
+        free(ring);
+    }
+}
+
+/*********************************************************************/
+/* PrvAsyncRestart */
+/**
+@brief  Restarts the writer thread in a forked child on first use.
+**********************************************************************/
+static void PrvAsyncRestart(void)
+{
+    pthread_mutex_lock(&gAsync.controlLock);
+
+    if (gAsync.needRestart)
+    {
+        PrvAsyncFreeStaleRings();
+
+        if (PrvAsyncStartWriter() != kPmLogErr_None)
+        {
+            __atomic_store_n(&gAsync.enabled, 0, __ATOMIC_RELAXED);
+        }
+
+        __atomic_store_n(&gAsync.needRestart, 0, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&gAsync.controlLock);
+}
+
+
+/*********************************************************************/
+/* PrvAsyncPrepareFork / PrvAsyncParentFork / PrvAsyncChildFork */
+/**
+@brief  fork() handlers.  Only the forking thread survives in the
+        child, so the writer thread has to be restarted there.
+**********************************************************************/
+static void PrvAsyncPrepareFork(void)
+{
+    pthread_mutex_lock(&gAsync.controlLock);
+    pthread_mutex_lock(&gAsync.ringsLock);
+}
+
+static void PrvAsyncParentFork(void)
+{
+    pthread_mutex_unlock(&gAsync.ringsLock);
+    pthread_mutex_unlock(&gAsync.controlLock);
+}
+
+static void PrvAsyncChildFork(void)
+{
+    if (gAsync.running)
+    {
+        // the eventfd is shared with the parent, don't steal its wakeups
+        close(gAsync.eventFd);
+        gAsync.eventFd = -1;
+        gAsync.running = 0;
+        gAsync.needRestart = gAsync.enabled;
+    }
+
+    gAsync.staleRings = gAsync.rings;
+    gAsync.rings = NULL;
+    tAsyncRing = NULL;
+    if (gAsync.staleRings != NULL)
+    {
+        (void) pthread_setspecific(gAsync.ringKey, NULL);
+    }
+
+    pthread_mutex_unlock(&gAsync.ringsLock);
+    pthread_mutex_unlock(&gAsync.controlLock);
+}
+
+
+/*********************************************************************/
+/* PmLogSetAsyncLogging */
+/**
+@brief  Enables or disables asynchronous logging for this process.
+        Disabling waits until all queued records have been written.
+**********************************************************************/
+PmLogErr PmLogSetAsyncLogging(bool enable)
+{
+    PmLogErr logErr = kPmLogErr_None;
+
+    pthread_mutex_lock(&gAsync.controlLock);
+
+    if (gAsync.needRestart)
+    {
+        // forked child which hasn't logged yet, nothing is running
+        PrvAsyncFreeStaleRings();
+        gAsync.needRestart = 0;
+        gAsync.enabled = 0;
+    }
+
+    if (enable && !gAsync.enabled)
+    {
+        logErr = PrvAsyncStartWriter();
+        if (logErr == kPmLogErr_None)
+        {
+            __atomic_store_n(&gAsync.enabled, 1, __ATOMIC_RELEASE);
+        }
+    }
+    else if (!enable && gAsync.enabled)
+    {
+        // a thread that finds 'enabled' cleared finds 'draining' set;
+        // pairs with PrvAsyncBeginEnqueue setting 'producing' first
+        __atomic_store_n(&gAsync.draining, 1, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&gAsync.enabled, 0, __ATOMIC_SEQ_CST);
+        PrvAsyncStopWriter();
+        __atomic_store_n(&gAsync.draining, 0, __ATOMIC_SEQ_CST);
+        (void) syscall(SYS_futex, &gAsync.draining, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+
+    pthread_mutex_unlock(&gAsync.controlLock);
+
+    return logErr;
+}
+
+
+/*********************************************************************/
+/* PmLogSetDeferredFormatting */
+/**
+@brief  Enables or disables deferred formatting of PmLogMsg records
+        for this process.  See Deferred formatting below.
+**********************************************************************/
+PmLogErr PmLogSetDeferredFormatting(bool enable)
+{
+    __atomic_store_n(&gAsync.deferred, enable ? 1 : 0, __ATOMIC_RELAXED);
+
+    return kPmLogErr_None;
+}
+
+
+/***********************************************************************
+ * Repeat coalescing
+ *
+ * Retry loops tend to log the same record many times in a row.  When
+ * "repeatWindowMs" is set in default.conf, each thread remembers a
+ * hash of the last record it wrote, and exact repeats of it within the
+ * window are counted instead of being written.  A single
+ *
+ *     REPEATED {"MSGID":"...","COUNT":N} Last record repeated N times
+ *
+ * is written in the same context and at the same level when the run
+ * ends, when the window expires, or when the thread exits.
+ *
+ * The thread's state is registered in gRepeat.states and guarded by
+ * its own lock, which the thread only holds while it decides what to
+ * do with a record.  A timer thread, started with the first run,
+ * wakes up once per window while runs are being counted and reports
+ * the expired ones.  With asynchronous logging the writer thread does
+ * that instead, after draining the thread's ring, so that the summary
+ * never overtakes a record queued before it.  Both only try the lock
+ * of a thread, and leave a busy one for the next round.
+ ***********************************************************************/
+#define NSEC_PER_MSEC       1000000ull
+#define REPEAT_LINE_LEN     128
+
+typedef struct PrvRepeatState
+{
+    struct PrvRepeatState   *next;      /* in gRepeat.states */
+    pthread_mutex_t         lock;
+    bool                    registered;
+    uint64_t                hash;
+    uint64_t                startNs;
+    uint32_t                count;      /* read unlocked by the timer */
+    PmLogContext_           *contextP;
+    PmLogLevel              level;
+    PrvAsyncRing            *ring;      /* where the run's record went */
+    char                    msgid[ MSGID_LEN + 1 ];
+    char                    ptidStr[ PIDSTR_LEN ];
+}
+PrvRepeatState;
+
+static __thread PrvRepeatState tRepeat = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static struct
+{
+    pthread_mutex_t     lock;       /* protects the states list and the timer */
+    pthread_cond_t      cond;
+    pthread_once_t      once;
+    pthread_key_t       key;
+    PrvRepeatState      *states;
+    pthread_t           timer;
+    bool                timerRunning;
+    bool                timerIdle;
+    bool                stop;
+    int                 expired;    /* for the writer thread to look at */
+}
+gRepeat =
+{
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .once = PTHREAD_ONCE_INIT
+};
+
+
+/*********************************************************************/
+/* PrvRepeatHash */
+/**
+@brief  FNV-1a hash of a record.
+**********************************************************************/
+static uint64_t PrvRepeatHash(const PmLogContext_ *contextP, PmLogLevel level,
+        const char *msgid, const char *s)
+{
+    uint64_t    hash = 0xcbf29ce484222325ull;
+    const char  *p;
+
+    hash = (hash ^ (uintptr_t) contextP) * 0x100000001b3ull;
+    hash = (hash ^ (uint32_t) level) * 0x100000001b3ull;
+
+    for (p = msgid ? msgid : ""; *p != '\0'; p++)
+    {
+        hash = (hash ^ (unsigned char) *p) * 0x100000001b3ull;
+    }
+
+    // keep "AB" "C" apart from "A" "BC"
+    hash = (hash ^ 0xff) * 0x100000001b3ull;
+
+    for (p = s; *p != '\0'; p++)
+    {
+        hash = (hash ^ (unsigned char) *p) * 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+
+/*********************************************************************/
+/* PrvRepeatTake */
+/**
+@brief  Formats the summary of the run of state into lineStr and
+        forgets the run.  Returns false if there was none.
+**********************************************************************/
+static bool PrvRepeatTake(PrvRepeatState *state, char *lineStr)
+{
+    uint32_t count = state->count;
+
+    state->hash = 0;
+    __atomic_store_n(&state->count, 0, __ATOMIC_RELAXED);
+
+    if (count == 0)
+    {
+        return false;
+    }
+
+    snprintf(lineStr, REPEAT_LINE_LEN,
+             "{\"MSGID\":\"%s\",\"COUNT\":%u} Last record repeated %u times",
+             state->msgid, count, count);
+
+    return true;
+}
+
+
+/*********************************************************************/
+/* PrvRepeatFlush */
+/**
+@brief  Writes the summary of the calling thread's run of repeats, if
+        any, the way PrvLogWrite writes a record, and forgets it.
+**********************************************************************/
+static void PrvRepeatFlush(void)
+{
+    char lineStr[ REPEAT_LINE_LEN ];
+
+    if (!PrvRepeatTake(&tRepeat, lineStr))
+    {
+        return;
+    }
+
+    if (__atomic_load_n(&gAsync.enabled, __ATOMIC_ACQUIRE))
+    {
+        if (__atomic_load_n(&gAsync.needRestart, __ATOMIC_ACQUIRE))
+        {
+            PrvAsyncRestart();
+        }
+
+        if (PrvAsyncEnqueue(tRepeat.contextP, tRepeat.level, tRepeat.ptidStr,
+                            "REPEATED", lineStr))
+        {
+            return;
+        }
+    }
+
+    PrvAsyncWaitDrained();
+    PrvLogEmit(tRepeat.contextP, tRepeat.level, tRepeat.ptidStr,
+               "REPEATED", lineStr, NULL);
+}
+
+
+/*********************************************************************/
+/* PrvRepeatFlushRuns */
+/**
+@brief  Reports the runs of the other threads that have expired, or
+        all of them.  From the writer thread the summaries are added
+        to its batch after the thread's ring; from any other thread
+        they are only written while asynchronous logging is off.
+**********************************************************************/
+static void PrvRepeatFlushRuns(bool all)
+{
+    PrvSyslogBatch  *batch = tAsyncWriter ? gAsyncBatch : NULL;
+    PrvRepeatState  *state;
+    char            lineStr[ REPEAT_LINE_LEN ];
+    int32_t         windowMs = (gGlobalsP != NULL) ? gGlobalsP->repeatWindowMs : 0;
+    uint64_t        now = PrvNowNs();
+    bool            expired;
+
+    pthread_mutex_lock(&gRepeat.lock);
+
+    for (state = gRepeat.states; state != NULL; state = state->next)
+    {
+        // its thread is logging, try again next time
+        if (pthread_mutex_trylock(&state->lock) != 0)
+        {
+            continue;
+        }
+
+        expired = all || (windowMs <= 0) ||
+                  (now - state->startNs >= (uint64_t) windowMs * NSEC_PER_MSEC);
+
+        if ((state->count != 0) && expired)
+        {
+            if (batch != NULL)
+            {
+                if (state->ring != NULL)
+                {
+                    (void) PrvAsyncDrainRing(state->ring);
+                }
+                if (PrvRepeatTake(state, lineStr))
+                {
+                    PrvLogEmit(state->contextP, state->level, state->ptidStr,
+                               "REPEATED", lineStr, batch);
+                }
+            }
+            else if (!__atomic_load_n(&gAsync.enabled, __ATOMIC_ACQUIRE) &&
+                     !__atomic_load_n(&gAsync.draining, __ATOMIC_ACQUIRE) &&
+                     PrvRepeatTake(state, lineStr))
+            {
+                PrvLogEmit(state->contextP, state->level, state->ptidStr,
+                           "REPEATED", lineStr, NULL);
+            }
+        }
+
+        pthread_mutex_unlock(&state->lock);
+    }
+
+    pthread_mutex_unlock(&gRepeat.lock);
+
+    if (batch != NULL)
+    {
+        PrvSyslogFlush(batch);
+    }
 }
 
-static bool parse_json_file(const char *file_name)
+
+/*********************************************************************/
+/* PrvRepeatWriterTick */
+/**
+@brief  Called by the writer thread each time round its loop.  Reports
+        the expired runs if the timer asked for it.
+**********************************************************************/
+static void PrvRepeatWriterTick(void)
 {
-    int         index;
-    bool        found_context = false;
-    bool        have_valid_overrides = false;
-    JSchemaInfo schemainfo;
-    jvalue_ref  parsed;
-    jvalue_ref  contexts_array;
-    bool        ret;
-    jvalue_ref  value;
+    if (__atomic_exchange_n(&gRepeat.expired, 0, __ATOMIC_ACQ_REL))
+    {
+        PrvRepeatFlushRuns(false);
+    }
+}
 
-    jschema_info_init(&schemainfo, jschema_all(), NULL, NULL);
-    parsed = jdom_parse_file(file_name, &schemainfo, DOMOPT_INPUT_NOCHANGE);
-    if (jis_null(parsed)) {
-        j_release(&parsed);
-        ErrPrint(COMPONENT_PREFIX, "[]", "JSON_PARSE_ERR {\"file\":\"%s\"}", file_name);
-        return false;
+
+/*********************************************************************/
+/* PrvRepeatPending */
+/**
+@brief  Returns true if a run is being counted.  gRepeat.lock must be
+        held.
+**********************************************************************/
+static bool PrvRepeatPending(void)
+{
+    const PrvRepeatState *state;
+
+    for (state = gRepeat.states; state != NULL; state = state->next)
+    {
+        if (__atomic_load_n(&state->count, __ATOMIC_RELAXED) != 0)
+        {
+            return true;
+        }
     }
 
-        if(g_str_has_suffix(file_name, "default.conf")) {
-                if (jobject_get_exists(parsed, j_cstr_to_buffer("contextLogging"), &value)) {
-                        bool flag;
-                        if (CONV_OK == jboolean_get(value, &flag)) {
-                                gGlobalsP->contextLogging = flag;
-                        }
-                        else {
-                                ErrPrint(COMPONENT_PREFIX, "[]", "INV_CTXFLAG {\"file\":\"%s\"}", file_name);
-                        }
-                }
+    return false;
+}
+
+
+/*********************************************************************/
+/* PrvRepeatTimerThread */
+/**
+@brief  Body of the timer thread.  Sleeps until a run starts, then
+        looks for expired runs once per window until none are left.
+**********************************************************************/
+static void* PrvRepeatTimerThread(void *arg)
+{
+    sigset_t        old_set;
+    struct timespec deadline;
+    int32_t         windowMs;
+
+    (void) arg;
+
+    // signals are for the application threads
+    block_signals(&old_set);
+
+    pthread_mutex_lock(&gRepeat.lock);
+
+    while (!gRepeat.stop)
+    {
+        if (!PrvRepeatPending())
+        {
+            gRepeat.timerIdle = true;
+            pthread_cond_wait(&gRepeat.cond, &gRepeat.lock);
+            gRepeat.timerIdle = false;
+            continue;
         }
 
-    ret = jobject_get_exists(parsed, j_cstr_to_buffer("contexts"), &contexts_array);
-    if (ret) { // found contexts array
-        for (index = 0; index < jarray_size(contexts_array); index++) {
+        windowMs = (gGlobalsP != NULL) ? gGlobalsP->repeatWindowMs : 0;
+        if (windowMs < 0)
+        {
+            windowMs = 0;
+        }
 
-            jvalue_ref j_context;
+        (void) clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += windowMs / 1000;
+        deadline.tv_nsec += (long) (windowMs % 1000) * (long) NSEC_PER_MSEC;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
 
-            j_context = jarray_get(contexts_array, index);
-            if (!jis_null(j_context)) {
+        (void) pthread_cond_timedwait(&gRepeat.cond, &gRepeat.lock, &deadline);
+        if (gRepeat.stop)
+        {
+            break;
+        }
 
-                raw_buffer    name;
-                raw_buffer    level;
-                char          err_msg[80];
+        pthread_mutex_unlock(&gRepeat.lock);
 
-                name.m_str = NULL;
-                level.m_str = NULL;
+        // the writer owns the rings, so it reports while it runs
+        pthread_mutex_lock(&gAsync.controlLock);
+        if (gAsync.running)
+        {
+            __atomic_store_n(&gRepeat.expired, 1, __ATOMIC_RELEASE);
+            PrvAsyncWakeWriter(true);
+            pthread_mutex_unlock(&gAsync.controlLock);
+        }
+        else
+        {
+            pthread_mutex_unlock(&gAsync.controlLock);
+            PrvRepeatFlushRuns(false);
+        }
 
-                ret = jobject_get_exists(j_context, j_cstr_to_buffer("name"), &value);
-                if (ret) { //found name
-                    found_context = true;
-                    name = jstring_get(value);
-                    if (!name.m_str) {
-                        ErrPrint(COMPONENT_PREFIX, "[]", "CTX_NAME_ERR {\"index\":%d,\"file\":\"%s\"}",
-                                 index, file_name);
-                        goto context_end;
-                    }
-                } else {
-                    ErrPrint(COMPONENT_PREFIX, "[]", "NO_CTX_NAME {\"index\":%d,\"file\":\"%s\"}",
-                             index, file_name);
-                    goto context_end;
-                }
+        pthread_mutex_lock(&gRepeat.lock);
+    }
 
-                ret = jobject_get_exists(j_context, j_cstr_to_buffer(LOG_LEVEL_TAG), &value);
-                if (ret) { //found level
-                    level = jstring_get(value);
-                    if (!level.m_str) {
-                        ErrPrint(COMPONENT_PREFIX, "[]", "NO_CTX_LVL {\"context\":\"%s\",\"file\":\"%s\"}",
-                                 name.m_str, file_name);
-                        goto context_end;
-                    }
-                } else {
-                    ErrPrint(COMPONENT_PREFIX, "[]", "CTX_LVL_MISSING {\"context\":\"%s\",\"file\":\"%s\"}",
-                             name.m_str, file_name);
-                    goto context_end;
-                }
+    pthread_mutex_unlock(&gRepeat.lock);
 
-                if (!PrvInitContext(name.m_str, level.m_str, err_msg, sizeof(err_msg))) {
-                    DbgPrint("PrvInitContext failed for %s:%s: %s\n",
-                             file_name, name.m_str, err_msg);
-                    ErrPrint(COMPONENT_PREFIX, "[]", "INIT_CTX_ERR {\"file\":\"%s\",\"context\":\"%s\",\"err\":\"%s\"}",
-                             file_name, name.m_str, err_msg);
-                        goto context_end;
-                }
+    return NULL;
+}
 
-                // parse optional flags (Ex. LOG_PROCESS_IDS_TAG) for the given context
-                parse_config_flags(j_context, file_name, name.m_str);
 
-            context_end:
-                jstring_free_buffer(name);
-                jstring_free_buffer(level);
-            } // if current entry in CONTEXTS array is valid
-        } // for loop for traversing CONTEXTS array
-    } // if we found a CONTEXTS array
+/*********************************************************************/
+/* PrvRepeatRunStarted */
+/**
+@brief  Starts the timer thread, or wakes it up, for a new run.
+**********************************************************************/
+static void PrvRepeatRunStarted(void)
+{
+    pthread_mutex_lock(&gRepeat.lock);
 
-    jvalue_ref overrides;
-    ret = jobject_get_exists(parsed, j_cstr_to_buffer("overrides"), &overrides);
-    if (ret && parse_config_overrides(overrides, file_name)) {
-        have_valid_overrides = true;
+    if (!gRepeat.timerRunning && !gRepeat.stop)
+    {
+        if (pthread_create(&gRepeat.timer, NULL, PrvRepeatTimerThread, NULL) == 0)
+        {
+            gRepeat.timerRunning = true;
+        }
+        else
+        {
+            DbgPrint("pthread_create error\n");
+        }
+    }
+    else if (gRepeat.timerIdle)
+    {
+        pthread_cond_signal(&gRepeat.cond);
     }
 
-    j_release(&parsed);
+    pthread_mutex_unlock(&gRepeat.lock);
+}
 
-    if (!found_context && !have_valid_overrides) {
-        ErrPrint(COMPONENT_PREFIX, "[]", "CTX_MISSING {\"file\":\"%s\"}", file_name);
+
+/*********************************************************************/
+/* PrvRepeatStopTimer */
+/**
+@brief  Stops the timer thread, for good.
+**********************************************************************/
+static void PrvRepeatStopTimer(void)
+{
+    bool running;
+
+    pthread_mutex_lock(&gRepeat.lock);
+    gRepeat.stop = true;
+    pthread_cond_signal(&gRepeat.cond);
+    running = gRepeat.timerRunning;
+    gRepeat.timerRunning = false;
+    pthread_mutex_unlock(&gRepeat.lock);
+
+    if (running)
+    {
+        pthread_join(gRepeat.timer, NULL);
+    }
+}
+
+
+/*********************************************************************/
+/* PrvRepeatThreadExit */
+/**
+@brief  pthread key destructor, reports a run left by an exiting
+        thread.  Also called when the thread's asynchronous ring is
+        released, so the summary is queued behind its records.
+**********************************************************************/
+static void PrvRepeatThreadExit(void *arg)
+{
+    PrvRepeatState **linkP;
+
+    (void) arg;
+
+    if (!tRepeat.registered)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&gRepeat.lock);
+
+    for (linkP = &gRepeat.states; *linkP != NULL; linkP = &(*linkP)->next)
+    {
+        if (*linkP == &tRepeat)
+        {
+            *linkP = tRepeat.next;
+            break;
+        }
+    }
+    tRepeat.registered = false;
+
+    pthread_mutex_unlock(&gRepeat.lock);
+
+    // nobody else can see the state anymore
+    PrvRepeatFlush();
+}
+
+
+static void PrvRepeatInitKey(void)
+{
+    (void) pthread_key_create(&gRepeat.key, PrvRepeatThreadExit);
+}
+
+
+/*********************************************************************/
+/* PrvRepeatRegister */
+/**
+@brief  Makes the calling thread's state visible to the timer and the
+        writer thread.
+**********************************************************************/
+static void PrvRepeatRegister(void)
+{
+    (void) pthread_once(&gRepeat.once, PrvRepeatInitKey);
+    (void) pthread_setspecific(gRepeat.key, &tRepeat);
+
+    pthread_mutex_lock(&gRepeat.lock);
+    tRepeat.next = gRepeat.states;
+    gRepeat.states = &tRepeat;
+    tRepeat.registered = true;
+    pthread_mutex_unlock(&gRepeat.lock);
+
+    // a forked child may carry on with a run of its parent
+    if (__atomic_load_n(&tRepeat.count, __ATOMIC_RELAXED) != 0)
+    {
+        PrvRepeatRunStarted();
+    }
+}
+
+
+/*********************************************************************/
+/* PrvRepeatChildFork */
+/**
+@brief  pthread_atfork child handler: only the forking thread is left,
+        and neither the timer nor the rings are.
+**********************************************************************/
+static void PrvRepeatChildFork(void)
+{
+    pthread_mutex_init(&gRepeat.lock, NULL);
+    pthread_cond_init(&gRepeat.cond, NULL);
+    gRepeat.states = NULL;
+    gRepeat.timerRunning = false;
+    gRepeat.timerIdle = false;
+    gRepeat.expired = 0;
+
+    pthread_mutex_init(&tRepeat.lock, NULL);
+    tRepeat.registered = false;
+    tRepeat.ring = NULL;
+}
+
+
+/*********************************************************************/
+/* PrvRepeatCoalesce */
+/**
+@brief  Returns true if the record repeats the previous one of the
+        thread and is only to be counted.  Otherwise writes the summary
+        of the previous run, if any, and starts a new one.
+**********************************************************************/
+static bool PrvRepeatCoalesce(PmLogContext_ *contextP, PmLogLevel level,
+        const char *ptidStr, const char *msgid, const char *s)
+{
+    int32_t     windowMs = (gGlobalsP != NULL) ? gGlobalsP->repeatWindowMs : 0;
+    uint64_t    hash;
+    uint64_t    now;
+    bool        repeated = false;
+
+    if (windowMs <= 0)
+    {
+        if (__atomic_load_n(&tRepeat.count, __ATOMIC_RELAXED) != 0)
+        {
+            pthread_mutex_lock(&tRepeat.lock);
+            PrvRepeatFlush();
+            pthread_mutex_unlock(&tRepeat.lock);
+        }
         return false;
     }
 
-    return true;
+    if (!tRepeat.registered)
+    {
+        PrvRepeatRegister();
+    }
+
+    hash = PrvRepeatHash(contextP, level, msgid, s);
+    now = PrvNowNs();
+
+    pthread_mutex_lock(&tRepeat.lock);
+
+    if ((hash == tRepeat.hash) &&
+        (now - tRepeat.startNs < (uint64_t) windowMs * NSEC_PER_MSEC))
+    {
+        repeated = true;
+        if (__atomic_fetch_add(&tRepeat.count, 1, __ATOMIC_RELAXED) == 0)
+        {
+            // the first record of the run has been written by now
+            tRepeat.ring = tAsyncRing;
+            pthread_mutex_unlock(&tRepeat.lock);
+            PrvRepeatRunStarted();
+            return true;
+        }
+    }
+    else
+    {
+        PrvRepeatFlush();
+
+        tRepeat.hash = hash;
+        tRepeat.startNs = now;
+        tRepeat.contextP = contextP;
+        tRepeat.level = level;
+        mystrcpy(tRepeat.msgid, sizeof(tRepeat.msgid), msgid ? msgid : "");
+        mystrcpy(tRepeat.ptidStr, sizeof(tRepeat.ptidStr), ptidStr);
+    }
+
+    pthread_mutex_unlock(&tRepeat.lock);
+
+    return repeated;
+}
+
+
+/*********************************************************************/
+/* fini_function */
+/**
+@brief  Library destructor.  Flushes the asynchronous queues and the
+        runs of repeats before the process exits or the library is
+        unloaded, and removes the ring if nobody reads it.
+**********************************************************************/
+static void __attribute ((destructor)) fini_function(void)
+{
+    PrvRepeatStopTimer();
+
+    (void) PmLogSetAsyncLogging(false);
+
+    // the queues are empty, so the summaries come last
+    PrvRepeatFlushRuns(true);
+
+    PrvRingDestroy();
 }
 
-#define DEFAULT_CONFIG "default.conf"
-bool PmLogPrvReadConfigs(bool (*fn_ptr) (const char *file_name))
+
+/*********************************************************************/
+/* PrvLogWrite */
+/**
+@brief  Logs the specified formatted text to the specified context.
+**********************************************************************/
+static PmLogErr PrvLogWrite(PmLogContext_ *contextP, PmLogLevel level,
+        const char *msgid, const char *s)
 {
-    GDir *dir;
-    GError *error = NULL;
-    const char *file_name;
-    gchar *full_path = NULL;
-    bool found_default_conf = false;
+    char        ptidStr[ PIDSTR_LEN ];
+    int         savedErrNo;
+    uint64_t    start = PrvLatencyStart();
 
-    dir = g_dir_open(CONFIG_DIR, 0, &error);
-    if (!dir) {
-        ErrPrint(COMPONENT_PREFIX, "[]", "DIR_OPEN_ERR {\"Error\":\"%s\"}", error->message);
-        g_error_free(error);
-        return false;
+    // save and restore errno, so logging doesn't have side effects
+    savedErrNo = errno;
+
+    PrvLogEnter();
+
+    if (HandleLogLibCommand(s))
+    {
+        goto Exit;
     }
 
-    // default.conf should be the first one
-    full_path = g_build_filename(CONFIG_DIR, DEFAULT_CONFIG, NULL);
-    if (g_file_test(full_path, G_FILE_TEST_IS_REGULAR)) {
-        found_default_conf = true;
-        // execute caller supplied function
-        fn_ptr(full_path);
+    GetPidStr(contextP, ptidStr, sizeof(ptidStr));
+
+    if (!PrvLogNested() && PrvRepeatCoalesce(contextP, level, ptidStr, msgid, s))
+    {
+        goto Exit;
     }
-    g_free(full_path);
-    full_path = NULL;
 
-//! This macro can be defined to restrict logging
-//! to whitelist logs
-#ifndef ENABLE_WHITELIST // Parse only default.conf in production
-    if (gGlobalsP->contextLogging)  // Do not parse individual context conf files if context logging is disabled in development builds
+    // the ring has a single producer, so a signal handler logging on
+    // top of an enqueue in progress writes out directly
+    if (!PrvLogNested())
     {
-        while ((file_name = g_dir_read_name(dir))) {
-            // ignore hidden files or files without ".conf" suffix
-            if ('.' == file_name[0] ||
-                !g_str_has_suffix (file_name, ".conf")) {
-                continue;
+        if (__atomic_load_n(&gAsync.enabled, __ATOMIC_ACQUIRE))
+        {
+            if (__atomic_load_n(&gAsync.needRestart, __ATOMIC_ACQUIRE))
+            {
+                PrvAsyncRestart();
             }
 
-            if (!g_strcmp0(file_name, DEFAULT_CONFIG)) {
-                // we parsed this file already
-                continue;
+            if (PrvAsyncEnqueue(contextP, level, ptidStr, msgid, s))
+            {
+                goto Exit;
             }
+        }
 
-            // Construct full path for parsing selected conf file
-            // Ex: /etc/pmlog.d/default.conf = /etc/pmlog.d + default.conf
-            full_path = g_build_filename(CONFIG_DIR, file_name, NULL);
+        PrvAsyncWaitDrained();
+    }
 
-            // execute caller supplied function
-            fn_ptr(full_path);
+    PrvLogEmit(contextP, level, ptidStr, msgid, s, NULL);
 
-            g_free(full_path);
-        }
-    }
-#endif
+Exit:
+    PrvLatencyRecord(kPmLogLatency_Write, start);
 
-    g_dir_close(dir);
+    PrvLogLeave();
 
-    // Last phase - overrides.
-    // It should be always last as long as override for all components walks
-    // through already-defined-contexts.
-    if (g_file_test(OVERRIDES_CONF, G_FILE_TEST_IS_REGULAR)) {
-        // execute caller supplied function
-        fn_ptr(OVERRIDES_CONF);
-    }
+    // save and restore errno, so logging doesn't have side effects
+    errno = savedErrNo;
 
-    return found_default_conf;
+    return kPmLogErr_None;
+}
+
+/***********************************************************************
+ * JSON validator
+ *
+ * A single pass, allocation free validator for the JSON object at the
+ * start of a kvpairs string.  It follows RFC 8259, checks that strings
+ * are well-formed UTF-8 and limits nesting to PMLOG_JSON_MAX_DEPTH.
+ * The scan stops at the object's closing brace, so whatever follows
+ * (the free text) is never looked at.
+ ***********************************************************************/
+#define PMLOG_JSON_MAX_DEPTH    64
+
+typedef struct
+{
+    const char  *p;         /* current position; the error position on failure */
 }
+PrvJsonScan;
+
+static bool PrvJsonScanValue(PrvJsonScan *scan, int depth);
+
 
 /*********************************************************************/
-/* kHexChars */
+/* PrvJsonSkipSpace */
 /**
-@brief  Lookup for hex nybble output.
+@brief  Skips JSON whitespace.
 **********************************************************************/
-static const char kHexChars[16] =
+static inline void PrvJsonSkipSpace(PrvJsonScan *scan)
 {
-    '0', '1', '2', '3', '4', '5', '6', '7',
-    '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'
-};
+    while ((*scan->p == ' ') || (*scan->p == '\t') ||
+           (*scan->p == '\n') || (*scan->p == '\r'))
+    {
+        scan->p++;
+    }
+}
+
 
 /*********************************************************************/
-/* init_function */
+/* PrvJsonScanUtf8 */
 /**
-@brief  Library constructor executes automatically in the loading
-    process before any other library API is called.
+@brief  Checks the UTF-8 sequence starting with a non-ASCII byte at
+        the current position, and skips it.
 **********************************************************************/
-static void __attribute ((constructor)) init_function(void)
+static bool PrvJsonScanUtf8(PrvJsonScan *scan)
 {
-    const char* kPmLogLibSoFilePath = WEBOS_INSTALL_LIBDIR "/libPmLogLib.so";
-
-    key_t       key;
-    int         shmid;
-    char*       data;
-    size_t      shmSize;
-    bool        needInit;
-    Dl_info     dlInfo;
-    int         result;
-    const char* libFilePath;
-    mode_t      mode;
-    PmLogContext_* theContextP = NULL;
-
-    // get/create the PmLogLib lock
+    const uint8_t   *u = (const uint8_t*) scan->p;
+    uint8_t         lo = 0x80;
+    uint8_t         hi = 0xBF;
+    int             n;
+    int             i;
 
-    DbgPrint("Opening lock\n");
-
-    mode = umask(0);
-        lock_fd = open("/dev/shm/pmloglib.lock", O_CREAT|O_RDWR , 0666);
-    umask(mode);
-    if (lock_fd == -1)
+    if ((u[0] >= 0xC2) && (u[0] <= 0xDF))
     {
-        DbgPrint("open error: %s\n", strerror(errno));
-        return;
+        n = 1;
     }
-
-    // determine this library's file path dynamically
-    libFilePath = NULL;
-
-    memset(&dlInfo, 0, sizeof(dlInfo));
-    result = dladdr(init_function, &dlInfo);
-    if (result)
+    else if ((u[0] >= 0xE0) && (u[0] <= 0xEF))
     {
-        libFilePath = dlInfo.dli_fname;
-        DbgPrint("libFilePath: %s\n", libFilePath);
+        n = 2;
+        if (u[0] == 0xE0) lo = 0xA0;        // overlong
+        if (u[0] == 0xED) hi = 0x9F;        // surrogates
+    }
+    else if ((u[0] >= 0xF0) && (u[0] <= 0xF4))
+    {
+        n = 3;
+        if (u[0] == 0xF0) lo = 0x90;        // overlong
+        if (u[0] == 0xF4) hi = 0x8F;        // above U+10FFFF
     }
     else
     {
-        DbgPrint("dladdr err: %s\n", strerror(errno));
+        return false;
     }
 
-    // if lookup failed for some reason, fall back to expected
-    if (libFilePath == NULL)
+    for (i = 1; i <= n; i++)
     {
-        libFilePath = kPmLogLibSoFilePath;
+        if ((u[i] < lo) || (u[i] > hi))
+        {
+            scan->p += i;
+            return false;
+        }
+        lo = 0x80;
+        hi = 0xBF;
     }
 
-    DbgPrint("getting shm key\n");
+    scan->p += n + 1;
+    return true;
+}
 
-    key = ftok(libFilePath, 'A');
-    if (key == -1)
+
+/*********************************************************************/
+/* PrvJsonScanString */
+/**
+@brief  Scans a string, the current position being its opening quote.
+**********************************************************************/
+static bool PrvJsonScanString(PrvJsonScan *scan)
+{
+    int i;
+
+    scan->p++;
+
+    for (;;)
     {
-        DbgPrint("ftok error: %s\n", strerror(errno));
-        return;
-    }
+        unsigned char c = (unsigned char) *scan->p;
 
-    // lock the globals
-    PmLogPrvLock();
+        if (c == '"')
+        {
+            scan->p++;
+            return true;
+        }
+        else if (c < 0x20)
+        {
+            // control characters must be escaped, this includes the end
+            return false;
+        }
+        else if (c == '\\')
+        {
+            scan->p++;
+            switch (*scan->p)
+            {
+                case '"': case '\\': case '/':
+                case 'b': case 'f': case 'n': case 'r': case 't':
+                    scan->p++;
+                    break;
 
-    shmSize = sizeof(PmLogGlobals);
-    DbgPrint("Getting shm size=%u\n", shmSize);
+                case 'u':
+                    scan->p++;
+                    for (i = 0; i < 4; i++, scan->p++)
+                    {
+                        if (!isxdigit((unsigned char) *scan->p))
+                        {
+                            return false;
+                        }
+                    }
+                    break;
 
-    // if shm is guaranteed initialized to 0, we can use
-    // that to tell whether it needs initializing or not.
-    // Otherwise, we can do a shmget without the IPC_CREAT,
-    // and if returns errno == ENOENT we know it needs creation
-    // and initialization.
+                default:
+                    return false;
+            }
+        }
+        else if (c >= 0x80)
+        {
+            if (!PrvJsonScanUtf8(scan))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            scan->p++;
+        }
+    }
+}
 
-    shmid = shmget(key, shmSize, 0666 | IPC_CREAT);
-    if (shmid == -1)
+
+/*********************************************************************/
+/* PrvJsonScanDigits */
+/**
+@brief  Skips one or more decimal digits.
+**********************************************************************/
+static inline bool PrvJsonScanDigits(PrvJsonScan *scan)
+{
+    if ((*scan->p < '0') || (*scan->p > '9'))
     {
-        DbgPrint("shmget error: %s\n", strerror(errno));
-        return;
+        return false;
     }
 
-    data = (char*) shmat(shmid, NULL, 0 /* SHM_RDONLY */);
-    if (data == (char*) -1)
+    do
     {
-        DbgPrint("shmat error: %s\n", strerror(errno));
-        return;
+        scan->p++;
     }
+    while ((*scan->p >= '0') && (*scan->p <= '9'));
 
-    gShmData = (uint8_t*) data;
-
-    // same as gShmData, but typecast for use
-    gGlobalsP = (PmLogGlobals*) gShmData;
-    gGlobalContextP = &gGlobalsP->globalContext;
+    return true;
+}
 
-    needInit = false;
 
-    // use header as initialization flag
-    if (gGlobalsP->signature == 0)
+/*********************************************************************/
+/* PrvJsonScanNumber */
+/**
+@brief  Scans a number: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+**********************************************************************/
+static bool PrvJsonScanNumber(PrvJsonScan *scan)
+{
+    if (*scan->p == '-')
     {
-            DbgPrint("initializing shared mem\n");
-            memcpy(gGlobalsP, &defaultSet, shmSize);
-            //set default library context
-            theContextP = &gGlobalsP->userContexts[0];
-            gGlobalsP->numUserContexts++;
-            mystrcpy(theContextP->component, sizeof(theContextP->component), kPmLogDefaultLibContextName);
-            theContextP->info.enabledLevel = kPmLogLevel_Info;
-            theContextP->info.flags = 0;
-            needInit = true;
-        }
-    else if (gGlobalsP->signature == PMLOG_SIGNATURE)
+        scan->p++;
+    }
+
+    if (*scan->p == '0')
     {
-        DbgPrint("accessing shared mem\n");
+        scan->p++;
     }
-    else
+    else if (!PrvJsonScanDigits(scan))
     {
-        DbgPrint("unrecognized shared mem\n");
-
-        gGlobalsP = NULL;
-        gGlobalContextP = NULL;
+        return false;
     }
 
-    // release the globals lock
-    PmLogPrvUnlock();
+    if (*scan->p == '.')
+    {
+        scan->p++;
+        if (!PrvJsonScanDigits(scan))
+        {
+            return false;
+        }
+    }
 
-    // initialize contexts if this is the first time
-    if (needInit)
+    if ((*scan->p == 'e') || (*scan->p == 'E'))
     {
-        PmLogPrvReadConfigs(parse_json_file);
+        scan->p++;
+        if ((*scan->p == '+') || (*scan->p == '-'))
+        {
+            scan->p++;
+        }
+        if (!PrvJsonScanDigits(scan))
+        {
+            return false;
+        }
     }
+
+    return true;
 }
 
 
 /*********************************************************************/
-/* PmLogPrvGlobals */
+/* PrvJsonScanLiteral */
 /**
-@brief  Returns the pointer to the globals.
+@brief  Scans one of the literal names true, false and null.
 **********************************************************************/
-PmLogGlobals* PmLogPrvGlobals(void)
+static bool PrvJsonScanLiteral(PrvJsonScan *scan, const char *literal)
 {
-    return gGlobalsP;
+    for (; *literal != 0; literal++, scan->p++)
+    {
+        if (*scan->p != *literal)
+        {
+            return false;
+        }
+    }
+
+    return true;
 }
 
 
 /*********************************************************************/
-/* PmLogPrvLock */
+/* PrvJsonScanObject */
 /**
-@brief  Acquires the lock for write access to the PmLog shared
-        memory context.  This should be held as briefly as possible,
-        then released by calling PmLogPrvUnlock.
+@brief  Scans an object, the current position being its opening brace.
+        On success the position is right after the closing brace.
 **********************************************************************/
-void PmLogPrvLock(void)
+static bool PrvJsonScanObject(PrvJsonScan *scan, int depth)
 {
-    if (lockf(lock_fd, F_LOCK, 0) == -1)
+    if (depth > PMLOG_JSON_MAX_DEPTH)
     {
-        DbgPrint("lock error: %s\n", strerror(errno));
+        return false;
     }
-}
 
+    scan->p++;
+    PrvJsonSkipSpace(scan);
 
-/*********************************************************************/
-/* PmLogPrvUnlock */
-/**
-@brief  Releases the lock for write access to the PmLog shared
-        memory context, as previously acquired via PmLogPrvLock.
-**********************************************************************/
-void PmLogPrvUnlock(void)
-{
-    if (lockf(lock_fd, F_ULOCK, 0) == -1)
+    if (*scan->p == '}')
     {
-        DbgPrint("unlock error: %s\n", strerror(errno));
+        scan->p++;
+        return true;
     }
-}
 
+    for (;;)
+    {
+        if ((*scan->p != '"') || !PrvJsonScanString(scan))
+        {
+            return false;
+        }
 
-/*********************************************************************/
-/* PrvExportContext */
-/**
-@brief  Convert a private PmLogContext_ pointer to the corresponding
-        public PmLogContext pointer.
-**********************************************************************/
-static inline PmLogContext PrvExportContext(const PmLogContext_* contextP)
-{
-    return (contextP == NULL) ? NULL : &contextP->info;
-}
+        PrvJsonSkipSpace(scan);
+        if (*scan->p != ':')
+        {
+            return false;
+        }
+        scan->p++;
 
+        if (!PrvJsonScanValue(scan, depth))
+        {
+            return false;
+        }
 
-/*********************************************************************/
-/* PrvIsValidLevel */
-/**
-@brief  Checks if the level is recognized.
-**********************************************************************/
-static inline bool PrvIsValidLevel(PmLogLevel level)
-{
-/*
- * Temporarily suppress the deprecation warnings for this block, as we
- * are the deprecators
- */
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-    return
-        (level >= kPmLogLevel_Emergency) &&
-        (level <= kPmLogLevel_Debug);
-#pragma GCC diagnostic pop
+        if (*scan->p == '}')
+        {
+            scan->p++;
+            return true;
+        }
+
+        if (*scan->p != ',')
+        {
+            return false;
+        }
+        scan->p++;
+        PrvJsonSkipSpace(scan);
+    }
 }
 
 
 /*********************************************************************/
-/* PrvValidateContextName */
+/* PrvJsonScanArray */
 /**
-@brief  Returns true if and only if the given string is a valid
-        context name, i.e. meets the requirements for length
-        and valid characters.
+@brief  Scans an array, the current position being its opening
+        bracket.
 **********************************************************************/
-static PmLogErr PrvValidateContextName(const char* contextName)
+static bool PrvJsonScanArray(PrvJsonScan *scan, int depth)
 {
-    size_t    n;
-    size_t    i;
-    char    c;
-
-    // the global context name is a special case
-    if (strcmp(contextName, kPmLogGlobalContextName) == 0)
+    if (depth > PMLOG_JSON_MAX_DEPTH)
     {
-        return kPmLogErr_None;
+        return false;
     }
 
-    if (strcmp(contextName, kPmLogDefaultLibContextName) == 0)
+    scan->p++;
+    PrvJsonSkipSpace(scan);
+
+    if (*scan->p == ']')
     {
-        return kPmLogErr_None;
+        scan->p++;
+        return true;
     }
 
-    n = strlen(contextName);
-    if ((n < 1) || (n > PMLOG_MAX_CONTEXT_NAME_LEN))
+    for (;;)
     {
-        return kPmLogErr_InvalidContextName;
+        if (!PrvJsonScanValue(scan, depth))
+        {
+            return false;
+        }
+
+        if (*scan->p == ']')
+        {
+            scan->p++;
+            return true;
+        }
+
+        if (*scan->p != ',')
+        {
+            return false;
+        }
+        scan->p++;
     }
+}
 
-    for (i = 0; i < n; i++)
+
+/*********************************************************************/
+/* PrvJsonScanValue */
+/**
+@brief  Scans a value with the whitespace around it.  depth is the
+        nesting level of the enclosing container.
+**********************************************************************/
+static bool PrvJsonScanValue(PrvJsonScan *scan, int depth)
+{
+    bool ok;
+
+    PrvJsonSkipSpace(scan);
+
+    switch (*scan->p)
     {
-        c = contextName[ i ];
+        case '{':
+            ok = PrvJsonScanObject(scan, depth + 1);
+            break;
 
-        if ((c >= 'A') && (c <= 'Z'))
-            continue;
+        case '[':
+            ok = PrvJsonScanArray(scan, depth + 1);
+            break;
 
-        if ((c >= 'a') && (c <= 'z'))
-            continue;
+        case '"':
+            ok = PrvJsonScanString(scan);
+            break;
 
-        if ((c >= '0') && (c <= '9'))
-            continue;
+        case 't':
+            ok = PrvJsonScanLiteral(scan, "true");
+            break;
 
-        if ((c == '.') ||
-            (c == '-') ||
-            (c == '_'))
-            continue;
+        case 'f':
+            ok = PrvJsonScanLiteral(scan, "false");
+            break;
 
-        return kPmLogErr_InvalidContextName;
+        case 'n':
+            ok = PrvJsonScanLiteral(scan, "null");
+            break;
+
+        default:
+            ok = PrvJsonScanNumber(scan);
+            break;
     }
 
-    return kPmLogErr_None;
+    if (ok)
+    {
+        PrvJsonSkipSpace(scan);
+    }
+
+    return ok;
 }
 
 
 /*********************************************************************/
-/* PmLogGetNumContexts */
+/* validate_json_string */
 /**
-@brief  Returns the number of defined contexts, including the global
-        context.
-
-@return Error code:
-            kPmLogErr_None
-            kPmLogErr_InvalidParameter
+@brief  Checks that kvpairs starts with a valid JSON object.  If
+        with_tailing is set the object must be followed by a space,
+        i.e. the free text separator.  The object (and separator) must
+        fit in maxSize - 1 bytes, else logErr is set to
+        kPmLogErr_TooMuchData.
 **********************************************************************/
-PmLogErr PmLogGetNumContexts(int* pNumContexts)
+static bool validate_json_string(const char* kvpairs, size_t maxSize, PmLogErr *logErr,
+                                 const bool with_tailing)
 {
-    if (pNumContexts == NULL)
+
+//! This macro can be defined to restrict logging
+//! to whitelist logs
+#ifndef ENABLE_WHITELIST
+    PrvJsonScan scan = { kvpairs };
+    bool        ok;
+
+    PrvJsonSkipSpace(&scan);
+
+    ok = (*scan.p == '{') && PrvJsonScanObject(&scan, 1);
+
+    if (ok && with_tailing)
     {
-        return kPmLogErr_InvalidParameter;
+        ok = (*scan.p == ' ');
+        scan.p++;
     }
 
-    *pNumContexts = 0;
-
-    if (gGlobalsP == NULL)
+    // the object must fit in a log line
+    if (scan.p - kvpairs > maxSize - 1)
     {
-        return kPmLogErr_Unknown;
+        *logErr = kPmLogErr_TooMuchData;
+        return false;
     }
 
-    *pNumContexts = 1 + gGlobalsP->numUserContexts;
-    return kPmLogErr_None;
+    return ok;
+#else
+    return true;
+#endif
 }
 
+/***********************************************************************
+ * JSON escaping
+ *
+ * PmLogEscapeJson() makes a JSON string value of arbitrary text, so a
+ * record built from it always passes the validator above.  Runs of
+ * printable ASCII, the bulk of most values, are found 16 bytes at a
+ * time with SSE2 or NEON and copied as they are; '"', '\\', control
+ * characters and ill-formed UTF-8 take the scalar path.
+ ***********************************************************************/
+#define PMLOG_ESCAPE_RING_SLOTS     12      /* the most kv pairs of PmLogMsg */
+
+static __thread char *tEscapeRing;
+static __thread unsigned int tEscapeSlot;
+// set when a value was cut, reported by the _PmLogMsgKV call it is for
+static __thread bool tEscapeCut;
+
+static pthread_key_t gEscapeKey;
+static pthread_once_t gEscapeOnce = PTHREAD_ONCE_INIT;
+
 
 /*********************************************************************/
-/* PmLogGetIndContext */
+/* PrvJsonPlainSpan */
 /**
-@brief  Returns the context by index where index = 0..numContexts - 1.
-
-@return Error code:
-            kPmLogErr_None
-            kPmLogErr_InvalidParameter
+@brief  Returns the length of the run of bytes at the start of src
+        that can be copied to a JSON string as they are: printable
+        ASCII but '"' and '\\'.
 **********************************************************************/
-PmLogErr PmLogGetIndContext(int contextIndex, PmLogContext* pContext)
+static size_t PrvJsonPlainSpan(const char *src, size_t len)
 {
-    PmLogContext_*    theContextP;
+    size_t  i = 0;
 
-    if (pContext != NULL)
-    {
-        *pContext = NULL;
-    }
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i space = _mm_set1_epi8(' ');
 
-    if ((contextIndex < 0) || (contextIndex > gGlobalsP->numUserContexts))
+    for (; i + 16 <= len; i += 16)
     {
-        return kPmLogErr_InvalidContextIndex;
+        __m128i v = _mm_loadu_si128((const __m128i*) (src + i));
+        // signed compare: control characters and bytes >= 0x80 are < ' '
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+            _mm_cmplt_epi8(v, space));
+        int     mask = _mm_movemask_epi8(special);
+
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
     }
+#elif defined(__ARM_NEON)
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t space = vdupq_n_u8(' ');
+    const uint8x16_t ascii = vdupq_n_u8(0x7f);
 
-    if (pContext == NULL)
+    for (; i + 16 <= len; i += 16)
     {
-        return kPmLogErr_InvalidParameter;
-    }
+        uint8x16_t v = vld1q_u8((const uint8_t*) (src + i));
+        uint8x16_t special = vorrq_u8(
+            vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, backslash)),
+            vorrq_u8(vcltq_u8(v, space), vcgtq_u8(v, ascii)));
+        uint64x2_t halves = vreinterpretq_u64_u8(special);
 
-    if (contextIndex == 0)
-    {
-        theContextP = &gGlobalsP->globalContext;
+        if ((vgetq_lane_u64(halves, 0) | vgetq_lane_u64(halves, 1)) != 0)
+        {
+            // the scalar loop finds the byte
+            break;
+        }
     }
-    else
+#endif
+
+    for (; i < len; i++)
     {
-        theContextP = &gGlobalsP->userContexts[ contextIndex - 1 ];
+        unsigned char c = (unsigned char) src[i];
+
+        if ((c < ' ') || (c >= 0x80) || (c == '"') || (c == '\\'))
+        {
+            break;
+        }
     }
 
-    *pContext = PrvExportContext(theContextP);
-    return kPmLogErr_None;
+    return i;
 }
 
 
 /*********************************************************************/
-/* PmLogFindContext */
+/* PrvUtf8SequenceLen */
 /**
-@brief  Returns the logging context for the named context, or
-        NULL if the context does not exist.
-
-@return Error code:
-            kPmLogErr_None
-            kPmLogErr_InvalidParameter
-            kPmLogErr_InvalidContext
-            kPmLogErr_InvalidContextName
+@brief  Returns the length of the well-formed UTF-8 sequence starting
+        with the non-ASCII byte at u, of at most avail bytes, or 0,
+        with the same rules as PrvJsonScanUtf8.
 **********************************************************************/
-PmLogErr PmLogFindContext(const char* contextName, PmLogContext* pContext)
+static size_t PrvUtf8SequenceLen(const uint8_t *u, size_t avail)
 {
-    PmLogErr        logErr;
-    int                i;
-    PmLogContext_*    theContextP;
-    PmLogContext_*    contextP;
+    uint8_t     lo = 0x80;
+    uint8_t     hi = 0xBF;
+    size_t      n;
+    size_t      i;
 
-    if (pContext == NULL)
+    if ((u[0] >= 0xC2) && (u[0] <= 0xDF))
     {
-        return kPmLogErr_InvalidParameter;
+        n = 1;
     }
-
-    *pContext = NULL;
-
-    if (gGlobalsP == NULL)
+    else if ((u[0] >= 0xE0) && (u[0] <= 0xEF))
     {
-        return kPmLogErr_Unknown;
+        n = 2;
+        if (u[0] == 0xE0) lo = 0xA0;
+        if (u[0] == 0xED) hi = 0x9F;
+    }
+    else if ((u[0] >= 0xF0) && (u[0] <= 0xF4))
+    {
+        n = 3;
+        if (u[0] == 0xF0) lo = 0x90;
+        if (u[0] == 0xF4) hi = 0x8F;
+    }
+    else
+    {
+        return 0;
     }
 
-    if (contextName == NULL)
+    if (n >= avail)
     {
-        return kPmLogErr_InvalidParameter;
+        return 0;
     }
 
-    logErr = PrvValidateContextName(contextName);
-    if (logErr != kPmLogErr_None)
+    for (i = 1; i <= n; i++)
     {
-        return logErr;
+        if ((u[i] < lo) || (u[i] > hi))
+        {
+            return 0;
+        }
+        lo = 0x80;
+        hi = 0xBF;
     }
 
-    // lock the globals
-    PmLogPrvLock();
+    return n + 1;
+}
+
+
+/*********************************************************************/
+/* PmLogEscapeJson */
+/**
+@brief  Escapes src_len bytes of src for use inside a JSON string.
+        See PmLogLib.h.
+**********************************************************************/
+size_t PmLogEscapeJson(char *dst, size_t dst_size, const char *src, size_t src_len)
+{
+    static const char   hex[] = "0123456789abcdef";
+    char                esc[ 8 ];
+    const char          *piece;
+    size_t              pieceLen;
+    size_t              used = 0;       /* bytes written to dst */
+    size_t              total = 0;      /* length of the whole escaped string */
+    size_t              i = 0;
+    bool                full = (dst_size == 0);
+    bool                plain;
+
+    while (i < src_len)
+    {
+        unsigned char c;
 
-    theContextP = NULL;
+        pieceLen = PrvJsonPlainSpan(src + i, src_len - i);
+        piece = src + i;
+        plain = (pieceLen > 0);
 
-    // look for a match on the context name
-    for (i = -1; i < gGlobalsP->numUserContexts; i++)
-    {
-        if (i == -1)
+        if (plain)
         {
-            contextP = &gGlobalsP->globalContext;
+            i += pieceLen;
         }
         else
         {
-            contextP = &gGlobalsP->userContexts[ i ];
+            c = (unsigned char) src[i];
+
+            if (c >= 0x80)
+            {
+                pieceLen = PrvUtf8SequenceLen((const uint8_t*) src + i, src_len - i);
+                if (pieceLen == 0)
+                {
+                    // not UTF-8, written as U+FFFD
+                    piece = "\\ufffd";
+                    pieceLen = 6;
+                    i++;
+                }
+                else
+                {
+                    i += pieceLen;
+                }
+            }
+            else
+            {
+                piece = esc;
+                esc[0] = '\\';
+                pieceLen = 2;
+
+                switch (c)
+                {
+                    case '"':   esc[1] = '"'; break;
+                    case '\\':  esc[1] = '\\'; break;
+                    case '\b':  esc[1] = 'b'; break;
+                    case '\f':  esc[1] = 'f'; break;
+                    case '\n':  esc[1] = 'n'; break;
+                    case '\r':  esc[1] = 'r'; break;
+                    case '\t':  esc[1] = 't'; break;
+                    default:
+                        memcpy(esc + 1, "u00", 3);
+                        esc[4] = hex[c >> 4];
+                        esc[5] = hex[c & 0xf];
+                        pieceLen = 6;
+                        break;
+                }
+                i++;
+            }
+        }
+
+        total += pieceLen;
+
+        if (full)
+        {
+            continue;
         }
 
-        if (strcmp(contextName, contextP->component) == 0)
+        if (used + pieceLen >= dst_size)
         {
-            theContextP = contextP;
-            break;
+            // the output ends here: plain text is cut to fit, but an
+            // escape sequence or a UTF-8 character is never cut
+            full = true;
+            pieceLen = plain ? dst_size - 1 - used : 0;
         }
-    }
 
-    // release the globals lock
-    PmLogPrvUnlock();
+        memcpy(dst + used, piece, pieceLen);
+        used += pieceLen;
+    }
 
-    if (theContextP != NULL)
+    if (dst_size > 0)
     {
-        *pContext = PrvExportContext(theContextP);
-        return kPmLogErr_None;
+        dst[used] = '\0';
     }
 
-    return kPmLogErr_ContextNotFound;
+    return total;
+}
+
+
+static void PrvEscapeThreadExit(void *arg)
+{
+    free(arg);
+    tEscapeRing = NULL;
+}
+
+
+static void PrvEscapeInitKey(void)
+{
+    (void) pthread_key_create(&gEscapeKey, PrvEscapeThreadExit);
 }
 
 
 /*********************************************************************/
-/* PrvGetContextDefaults */
+/* _PmLogEscapeJsonRing */
 /**
-@brief  Look up the default settings for the context.  If the
-        component is part of a hierarchy, search up the ancestor
-        chain and use the settings of the first ancestor found.
-        Otherwise, use the settings from the global context.
+@brief  Escapes the NUL-terminated src into the next buffer of a
+        per-thread ring, for PMLOGKS_ESC.  See PmLogLib.h.
 **********************************************************************/
-static const PmLogContextInfo* PrvGetContextDefaults(const char* contextName)
+const char* _PmLogEscapeJsonRing(const char *src)
 {
-    // Note: this function is called only by PmLogGetContext when
-    // the context globals are locked.
-
-    int                        i;
-    const PmLogContext_*    contextP;
-    char                    parent[ PMLOG_MAX_CONTEXT_NAME_LEN + 1 ];
-    char*                    s;
+    char    *slot;
 
-    // copy the context name to a scratch buffer
-    mystrcpy(parent, sizeof(parent), contextName);
+    if (src == NULL)
+    {
+        return NULL;
+    }
 
-    for (;;)
+    if (tEscapeRing == NULL)
     {
-        // if there is no 'parent' path, we're done
-        s = strrchr(parent, '.');
-        if (s == NULL)
+        tEscapeRing = malloc(PMLOG_ESCAPE_RING_SLOTS * BUFFER_LEN);
+        if (tEscapeRing == NULL)
         {
-            break;
+            return "";
         }
 
-        // else trim off the child name to get the parent
-        *s = 0;
+        (void) pthread_once(&gEscapeOnce, PrvEscapeInitKey);
+        (void) pthread_setspecific(gEscapeKey, tEscapeRing);
+    }
 
-        // if a registered context matches the parent path,
-        // use its level as the default for the child
-        for (i = 0; i < gGlobalsP->numUserContexts; i++)
-        {
-            contextP = &gGlobalsP->userContexts[ i ];
-            if (strcmp(parent, contextP->component) == 0)
-            {
-                return &contextP->info;
-            }
-        }
+    slot = tEscapeRing + (tEscapeSlot++ % PMLOG_ESCAPE_RING_SLOTS) * BUFFER_LEN;
+
+    if (PmLogEscapeJson(slot, BUFFER_LEN, src, strlen(src)) >= BUFFER_LEN)
+    {
+        tEscapeCut = true;
     }
 
-    // otherwise use the global level as the default
-    return &gGlobalContextP->info;
+    return slot;
 }
 
+/***********************************************************************
+ * Message buffers
+ *
+ * Messages are formatted into a per-thread arena rather than into a
+ * zeroed BUFFER_LEN stack array.  The arena starts at BUFFER_LEN and
+ * grows, when a message doesn't fit, up to the "maxMessageSize" of the
+ * context (BUFFER_LEN unless set in its pmlog.d entry).  It is kept for
+ * the next messages of the thread and unmapped when the thread exits.
+ *
+ * The arena is mapped with mmap() rather than malloc'd, so that a
+ * signal handler that interrupts the application inside malloc can
+ * still set it up or grow it.  A call made while another logging call
+ * is in progress on the thread (a signal handler, or a message logged
+ * by the library itself) gets the caller's BUFFER_LEN fallback instead.
+ ***********************************************************************/
+#define ARENA_ROUND(size)   (((size) + 4095) & ~(size_t) 4095)
 
-/*********************************************************************/
-/* PmLogGetContext */
-/**
-@brief  Returns/creates the logging context for the named context.
+typedef struct
+{
+    char    *str;
+    size_t  size;       /* of str */
+    size_t  maxSize;    /* str may grow up to */
+    bool    arena;      /* str is the thread's arena */
+}
+PrvMsgBuffer;
 
-        If contextName is NULL, returns the global context.
+static __thread struct
+{
+    char    *str;
+    size_t  size;
+    bool    busy;
+}
+tArena;
 
-        Context names must be 1..31 characters long, and each
-        character must be one of A-Z, a-z, 0-9, '_', '-', '.'.
+static pthread_key_t gArenaKey;
+static pthread_once_t gArenaOnce = PTHREAD_ONCE_INIT;
 
-        Component hierarchies can be indicated using '.' as the path
-        separator.
-        E.g. "FOO.BAR" would indicate the "BAR" subcomponent
-        of the "FOO" component.
 
-@return Error code:
-            kPmLogErr_None
-            kPmLogErr_InvalidParameter
-            kPmLogErr_InvalidContext
-            kPmLogErr_InvalidContextName
-**********************************************************************/
-PmLogErr PmLogGetContext(const char* contextName, PmLogContext* pContext)
+static void PrvArenaThreadExit(void *arg)
 {
-    PmLogErr                logErr;
-    int                        i;
-    PmLogContext_*            theContextP;
-    PmLogContext_*            contextP;
-    const PmLogContextInfo*    defaultsP;
+    (void) arg;
 
-    if (pContext == NULL)
+    if (tArena.str != NULL)
     {
-        return kPmLogErr_InvalidParameter;
+        (void) munmap(tArena.str, tArena.size);
+        tArena.str = NULL;
+        tArena.size = 0;
     }
+}
 
-    *pContext = NULL;
 
-    if (gGlobalsP == NULL)
-    {
-        return kPmLogErr_Unknown;
-    }
+static void PrvArenaInitKey(void)
+{
+    (void) pthread_key_create(&gArenaKey, PrvArenaThreadExit);
+}
 
-    if (contextName == NULL)
-    {
-        *pContext = PrvExportContext(gGlobalContextP);
-        return kPmLogErr_None;
-    }
 
-    logErr = PrvValidateContextName(contextName);
-    if (logErr != kPmLogErr_None)
-    {
-        return logErr;
-    }
+/*********************************************************************/
+/* PrvArenaMap */
+/**
+@brief  Maps a new arena of at least size bytes, rounded up to whole
+        pages.  Returns NULL on failure.
+**********************************************************************/
+static char* PrvArenaMap(size_t size)
+{
+    void *str;
 
-    // lock the globals
-    PmLogPrvLock();
+    str = mmap(NULL, ARENA_ROUND(size), PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
-    // To meet RFC 3164, we need to use limited '__progname' to protect actual message
-    if (!syslogConnected) {
-        strncpy(progName, __progname, MAX_PROGRAM_NAME - 1);
-        progName[MAX_PROGRAM_NAME - 1] = 0;
-        openlog(progName, 0, 0);
-        syslogConnected = true;
-    }
+    return (str == MAP_FAILED) ? NULL : str;
+}
 
-    theContextP = NULL;
-    logErr = kPmLogErr_None;
 
-    // look for a match on the context name
-    for (i = -1; i < gGlobalsP->numUserContexts; i++)
+/*********************************************************************/
+/* PrvMsgBufferInit */
+/**
+@brief  Sets up buffer for a message of the context, with the thread's
+        arena if it is free, else with the fallback.
+**********************************************************************/
+static void PrvMsgBufferInit(PrvMsgBuffer *buffer, const PmLogContext_ *contextP,
+        char *fallback, size_t fallbackSize)
+{
+    buffer->maxSize = contextP->maxMessageSize ? contextP->maxMessageSize : BUFFER_LEN;
+    buffer->arena = false;
+
+    // PrvLogWrite enters later, so any depth here is an outer call
+    if (!tArena.busy && (tLogDepth == 0))
     {
-        if (i == -1)
-        {
-            contextP = &gGlobalsP->globalContext;
-        }
-        else
-        {
-            contextP = &gGlobalsP->userContexts[ i ];
-        }
+        tArena.busy = true;
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
 
-        if (strcmp(contextName, contextP->component) == 0)
+        if ((tArena.str == NULL) && ((tArena.str = PrvArenaMap(BUFFER_LEN)) != NULL))
         {
-            //DbgPrint("found context %s\n", contextName);
-            theContextP = contextP;
-            break;
+            tArena.size = ARENA_ROUND(BUFFER_LEN);
+            (void) pthread_once(&gArenaOnce, PrvArenaInitKey);
+            (void) pthread_setspecific(gArenaKey, tArena.str);
         }
-    }
 
-    // if context not found, add it
-    if (theContextP == NULL)
-    {
-        if (gGlobalsP->numUserContexts >= gGlobalsP->maxUserContexts)
+        if (tArena.str != NULL)
         {
-            DbgPrint("no more contexts available, fallback to global context\n");
+            buffer->str = tArena.str;
+            buffer->size = MIN(tArena.size, buffer->maxSize);
+            buffer->arena = true;
+            return;
         }
-        else
-        {
-            DbgPrint("adding context %s\n", contextName);
-            theContextP = &gGlobalsP->userContexts[ gGlobalsP->numUserContexts ];
-            gGlobalsP->numUserContexts++;
 
-            mystrcpy(theContextP->component, sizeof(theContextP->component),
-                contextName);
+        tArena.busy = false;
+    }
 
-            defaultsP = PrvGetContextDefaults(contextName);
+    buffer->str = fallback;
+    buffer->size = fallbackSize;
+    buffer->maxSize = fallbackSize;
+}
 
-            theContextP->info.enabledLevel = defaultsP->enabledLevel;
-            theContextP->info.flags = defaultsP->flags;
-        }
-    }
 
-    // release the globals lock
-    PmLogPrvUnlock();
+/*********************************************************************/
+/* PrvMsgBufferGrow */
+/**
+@brief  Grows the buffer to hold size bytes, or as many as allowed.
+        Returns false if it couldn't grow at all.  The contents are
+        not kept.
+**********************************************************************/
+static bool PrvMsgBufferGrow(PrvMsgBuffer *buffer, size_t size)
+{
+    char *str;
 
-    if (theContextP != NULL)
+    size = MIN(size, buffer->maxSize);
+    if (!buffer->arena || (size <= buffer->size))
     {
-        *pContext = PrvExportContext(theContextP);
+        return false;
+    }
 
-        return kPmLogErr_None;
+    str = PrvArenaMap(size);
+    if (str == NULL)
+    {
+        return false;
     }
 
-    // in case of error, return the global context pointer
-    *pContext = PrvExportContext(gGlobalContextP);
-    return logErr;
-}
+    (void) munmap(tArena.str, tArena.size);
+    tArena.str = buffer->str = str;
+    tArena.size = ARENA_ROUND(size);
+    buffer->size = MIN(tArena.size, buffer->maxSize);
 
-static int GetCurrentProcessName(char *dst, int size)
-{
-    FILE* f = fopen("/proc/self/cmdline", "rt");
-    if (f) {
-        int read = fread(dst, 1, size-1, f);
-        dst[read] = 0;
-        for(int i = 0 ; i < read ; i++) {
-            if (dst[i] == 0)
-                dst[i] = ' ';
-        }
-        fclose(f);
-        return read;
-    }
-    return 0;
+    return true;
 }
 
-#ifdef VALIDATE_INCOMING_LIBPROCESSCONTEXT
-void PmLogSetLibContext(PmLogContext libContext)
-{
-    bool invalid_value = (libContext == NULL);
 
-    if (!invalid_value)
-    {
-        PmLogPrvLock();
+/*********************************************************************/
+/* PrvMsgBufferVFormat */
+/**
+@brief  vsnprintf into the buffer at offset, growing it if the output
+        doesn't fit.  Returns what vsnprintf returned, i.e. the output
+        was truncated if that is >= size - offset.
+**********************************************************************/
+static int PrvMsgBufferVFormat(PrvMsgBuffer *buffer, size_t offset,
+        const char *fmt, va_list args)
+{
+    va_list args_copy;
+    int     ret;
 
-        if (PrvExportContext(&gGlobalsP->globalContext) != libContext)
-        {
-            bool found = false;
-            for (int i = 0; i < gGlobalsP->numUserContexts; i++)
-            {
-                if (PrvExportContext(&gGlobalsP->userContexts[i]) == libContext) {
-                    found = true;
-                    break;
-                }
-            }
-            invalid_value = invalid_value || !found;
-        }
+    // a single pass unless the message needs a bigger arena
+    va_copy(args_copy, args);
+    ret = vsnprintf(buffer->str + offset, buffer->size - offset, fmt, args_copy);
+    va_end(args_copy);
 
-        PmLogPrvUnlock();
+    if ((ret >= 0) && ((size_t) ret >= buffer->size - offset) &&
+        PrvMsgBufferGrow(buffer, offset + ret + 1))
+    {
+        ret = vsnprintf(buffer->str + offset, buffer->size - offset, fmt, args);
     }
 
-    if (invalid_value) {
-        char procName[1024];
-        int length = GetCurrentProcessName(procName, sizeof(procName));
-        WarnPrint("UNKNOWN", "[]", "Invalid context was passed to PmLogSetLibContext. Value: %p. Process: %.*s", libContext, length, procName);
-    } else {
-        libProcessContext = libContext;
-    }
-}
-#else
-void PmLogSetLibContext(PmLogContext libContext)
-{
-    libProcessContext = libContext;
+    return ret;
 }
-#endif
 
-PmLogContext PmLogGetLibContext(void)
-{
-    if (libProcessContext == kPmLogDefaultContext)
-    {
-        return PrvExportContext(&gGlobalsP->userContexts[0]);
-    }
 
-    return libProcessContext;
-}
+static int PrvMsgBufferFormat(PrvMsgBuffer *buffer, size_t offset,
+        const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
 
-void PmLogSetDevMode(bool isDevMode)
+static int PrvMsgBufferFormat(PrvMsgBuffer *buffer, size_t offset,
+        const char *fmt, ...)
 {
-    PmLogPrvLock();
-    gGlobalsP->devMode = isDevMode;
-    PmLogPrvUnlock();
+    va_list args;
+    int     ret;
+
+    va_start(args, fmt);
+    ret = PrvMsgBufferVFormat(buffer, offset, fmt, args);
+    va_end(args);
+
+    return ret;
 }
 
 
 /*********************************************************************/
-/* PmLogGetContextInline */
+/* PrvMsgBufferRelease */
 /**
-@brief  Returns the logging context for the named context.
+@brief  Gives the arena back to the thread.
 **********************************************************************/
-PmLogContext PmLogGetContextInline(const char* contextName)
+static void PrvMsgBufferRelease(PrvMsgBuffer *buffer)
 {
-    PmLogErr        logErr;
-    PmLogContext    context;
-
-    context = NULL;
-    logErr = PmLogGetContext(contextName, &context);
-    if (logErr == kPmLogErr_None)
+    if (buffer->arena)
     {
-        return context;
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        tArena.busy = false;
     }
+}
+
+
+/***********************************************************************
+ * Deferred formatting
+ *
+ * With PmLogSetDeferredFormatting on top of asynchronous logging,
+ * _PmLogMsgKV doesn't format the message on the caller's thread.  It
+ * copies the format and the raw argument values into the thread's ring
+ * as a kAsyncRecord_Deferred record, and the writer thread formats and
+ * validates it before sending it out.
+ *
+ * The arguments follow the format, 8 byte aligned, in the order the
+ * format consumes them.  Each value takes one 8 byte slot, except
+ * long doubles, which take two, and strings, which are stored as
+ * their length (or UINT64_MAX for NULL) followed by the characters,
+ * '\0' terminated and padded to 8 bytes.
+ *
+ * Nothing the caller passes has to outlive the call: the format is
+ * copied along with the arguments.  A %s argument is copied up to its
+ * '\0' or its precision, whichever comes first.
+ *
+ * Formats the writer can't reproduce later, like %n, %m, wide
+ * characters or positional arguments, are formatted synchronously.
+ ***********************************************************************/
+#define DEFERRED_MAX_SPEC_LEN   32
+#define DEFERRED_NULL_STRING    UINT64_MAX
 
-    return kPmLogGlobalContext;
+enum
+{
+    kDeferredArg_None,          /* %% */
+    kDeferredArg_Int,
+    kDeferredArg_Long,
+    kDeferredArg_LongLong,
+    kDeferredArg_IntMax,
+    kDeferredArg_Size,
+    kDeferredArg_PtrDiff,
+    kDeferredArg_Double,
+    kDeferredArg_LongDouble,
+    kDeferredArg_String,
+    kDeferredArg_Pointer,
+    kDeferredArg_Unsupported
+};
+
+enum
+{
+    kDeferred_NoRoom      = -1,
+    kDeferred_Unsupported = -2
+};
+
+typedef struct
+{
+    const char  *start;         /* the '%' */
+    size_t      len;            /* of the whole conversion */
+    int         argType;
+    bool        widthStar;
+    bool        precisionStar;
+    int         precision;      /* -1 if not given in the format */
 }
+PrvDeferredSpec;
 
 
 /*********************************************************************/
-/* PmLogGetContextName */
+/* PrvDeferredNextSpec */
 /**
-@brief  Returns the name of the specified context into the specified
-        string buffer.
-
-@return Error code:
-            kPmLogErr_None
-            kPmLogErr_InvalidParameter
+@brief  Finds the next conversion in fmt and describes it in spec.
+        Returns false at the end of the format.
 **********************************************************************/
-PmLogErr PmLogGetContextName(PmLogContext context, char* contextName,
-    size_t contextNameBuffSize)
+static bool PrvDeferredNextSpec(const char *fmt, PrvDeferredSpec *spec)
 {
-    PmLogContext_*    contextP;
+    const char  *p;
+    int         length = 0;
 
-    // clear out result in case of error
-    if ((contextName != NULL) && (contextNameBuffSize > 0))
+    p = strchr(fmt, '%');
+    if (p == NULL)
     {
-        contextName[ 0 ] = 0;
+        return false;
     }
 
-    contextP = PrvResolveContext(context);
-    if (contextP == NULL)
+    spec->start = p++;
+    spec->widthStar = false;
+    spec->precisionStar = false;
+    spec->precision = -1;
+    spec->argType = kDeferredArg_Unsupported;
+
+    while ((*p == '-') || (*p == '+') || (*p == ' ') || (*p == '#') ||
+           (*p == '0') || (*p == '\'') || (*p == 'I'))
     {
-        return kPmLogErr_InvalidContext;
+        p++;
     }
 
-    if ((contextName == NULL) || (contextNameBuffSize <= 1))
+    if (*p == '*')
     {
-        return kPmLogErr_InvalidParameter;
+        spec->widthStar = true;
+        p++;
+    }
+    while ((*p >= '0') && (*p <= '9'))
+    {
+        p++;
     }
 
-    mystrcpy(contextName, contextNameBuffSize, contextP->component);
-
-    if (contextNameBuffSize < strlen(contextP->component) + 1)
+    if (*p == '.')
     {
-        return kPmLogErr_BufferTooSmall;
+        p++;
+        if (*p == '*')
+        {
+            spec->precisionStar = true;
+            p++;
+        }
+        else
+        {
+            spec->precision = 0;
+            while ((*p >= '0') && (*p <= '9'))
+            {
+                spec->precision = (spec->precision < 100000) ?
+                                  spec->precision * 10 + (*p - '0') : spec->precision;
+                p++;
+            }
+        }
     }
 
-    return kPmLogErr_None;
-}
+    // length modifiers, 'L' for long double, 'H' for 'hh', 'Q' for 'll'
+    switch (*p)
+    {
+        case 'h':
+            length = (p[1] == 'h') ? 'H' : 'h';
+            p += (p[1] == 'h') ? 2 : 1;
+            break;
 
+        case 'l':
+            length = (p[1] == 'l') ? 'Q' : 'l';
+            p += (p[1] == 'l') ? 2 : 1;
+            break;
 
-/*********************************************************************/
-/* PmLogGetContextLevel */
-/**
-@brief  Gets the logging level for the specified context.
-        May be used for the global context.  This should generally not
-        be used by the components doing logging themselves.
-        Instead just use the PmLogPrint etc. APIs which will do
-        inline enabled checks.
+        case 'q':
+            length = 'Q';
+            p++;
+            break;
 
-@return Error code:
-            kPmLogErr_None
-            kPmLogErr_InvalidParameter
-**********************************************************************/
-PmLogErr PmLogGetContextLevel(PmLogContext context, PmLogLevel* levelP)
-{
-    PmLogContext_*    contextP;
+        case 'Z':
+            length = 'z';
+            p++;
+            break;
 
-    // clear out result in case of error
-    if (levelP != NULL)
-    {
-        *levelP = kPmLogLevel_Debug;
+        case 'L':
+        case 'j':
+        case 'z':
+        case 't':
+            length = *p++;
+            break;
     }
 
-    contextP = PrvResolveContext(context);
-    if (contextP == NULL)
+    switch (*p)
     {
-        return kPmLogErr_InvalidContext;
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+            switch (length)
+            {
+                case 0: case 'h': case 'H': spec->argType = kDeferredArg_Int; break;
+                case 'l':   spec->argType = kDeferredArg_Long; break;
+                case 'Q':   spec->argType = kDeferredArg_LongLong; break;
+                case 'j':   spec->argType = kDeferredArg_IntMax; break;
+                case 'z':   spec->argType = kDeferredArg_Size; break;
+                case 't':   spec->argType = kDeferredArg_PtrDiff; break;
+            }
+            break;
+
+        case 'c':
+            if (length == 0)
+            {
+                spec->argType = kDeferredArg_Int;
+            }
+            break;
+
+        case 'e': case 'E': case 'f': case 'F':
+        case 'g': case 'G': case 'a': case 'A':
+            if (length == 0 || length == 'l')
+            {
+                spec->argType = kDeferredArg_Double;
+            }
+            else if (length == 'L')
+            {
+                spec->argType = kDeferredArg_LongDouble;
+            }
+            break;
+
+        case 's':
+            if (length == 0)
+            {
+                spec->argType = kDeferredArg_String;
+            }
+            break;
+
+        case 'p':
+            if (length == 0)
+            {
+                spec->argType = kDeferredArg_Pointer;
+            }
+            break;
+
+        case '%':
+            if (p == spec->start + 1)
+            {
+                spec->argType = kDeferredArg_None;
+            }
+            break;
     }
 
-    if (levelP == NULL)
+    // an unknown conversion, or the end of the format
+    if (*p != '\0')
     {
-        return kPmLogErr_InvalidParameter;
+        p++;
     }
 
-    *levelP = contextP->info.enabledLevel;
+    spec->len = p - spec->start;
+    if (spec->len >= DEFERRED_MAX_SPEC_LEN)
+    {
+        spec->argType = kDeferredArg_Unsupported;
+    }
 
-    return kPmLogErr_None;
+    return true;
 }
 
 
 /*********************************************************************/
-/* PmLogSetContextLevel */
+/* PrvDeferredCapture */
 /**
-@brief  Sets the logging level for the specified context.
-        May be used for the global context.
+@brief  Copies the arguments consumed by fmt to dst, which has room
+        for size bytes.  Returns the number of bytes used,
+        kDeferred_NoRoom if they don't fit and kDeferred_Unsupported if
+        the format can't be deferred.
 **********************************************************************/
-PmLogErr PmLogSetContextLevel(PmLogContext context, PmLogLevel level)
+static ssize_t PrvDeferredCapture(char *dst, size_t size, const char *fmt,
+        va_list args)
 {
-    PmLogContext_*    contextP;
-    int             fd;
-        struct flock    fl;
-
-    contextP = PrvResolveContext(context);
-    if (contextP == NULL)
+    PrvDeferredSpec spec;
+    const char      *str;
+    uint64_t        *slotP;
+    size_t          used = 0;
+    size_t          len;
+    long double     ld;
+
+    // the slot for a value, if it fits
+    #define DEFERRED_SLOT(n) \
+        ((used + (n) > size) ? NULL : (slotP = (uint64_t*) (dst + used), used += (n), slotP))
+
+    for (; PrvDeferredNextSpec(fmt, &spec); fmt = spec.start + spec.len)
     {
-        return kPmLogErr_InvalidContext;
-    }
+        if (spec.argType == kDeferredArg_Unsupported)
+        {
+            return kDeferred_Unsupported;
+        }
 
-    if ((level != kPmLogLevel_None) && !PrvIsValidLevel(level))
-    {
-        return kPmLogErr_InvalidLevel;
-    }
+        if (spec.widthStar)
+        {
+            if (!DEFERRED_SLOT(8)) return kDeferred_NoRoom;
+            *slotP = (uint64_t) (int64_t) va_arg(args, int);
+        }
 
-    // dummy reference to avoid unused function warning
-    // when DbgPrint is compiled out
-    (void) &PrvGetLevelStr;
-    DbgPrint("SetContextLevel %s => %s\n", contextP->component,
-        PrvGetLevelStr(level));
+        if (spec.precisionStar)
+        {
+            if (!DEFERRED_SLOT(8)) return kDeferred_NoRoom;
+            spec.precision = va_arg(args, int);
+            *slotP = (uint64_t) (int64_t) spec.precision;
+        }
 
-    // write which process calls this function for debugging
-    if(gGlobalsP->devMode)
-    {
-        fd = open("/tmp/PmLogSetContextLevel.log", O_WRONLY | O_CREAT | O_NOCTTY |O_APPEND | O_NONBLOCK, 0644);
-        if (fd >= 0)
+        switch (spec.argType)
         {
-            /* get advisory file lock (write => exclusive lock) */
-            memset(&fl, 0, sizeof(fl));
-            fl.l_type = F_WRLCK;
-            if (fcntl(fd, F_SETLKW, &fl) == 0)
-            {
-                char procName[512] ={0, };
-                char debuglog[1024] ={0, };
-                GetCurrentProcessName(procName, sizeof(procName));
-                g_snprintf(debuglog, sizeof(debuglog), "PROCINFO:%s COMPONENT:%s ORIGINLEVEL:%d INPUTLEVEL:%d\n", procName, contextP->component, contextP->info.enabledLevel, level);
-                write(fd, debuglog, strlen(debuglog));
-            }
+            case kDeferredArg_None:
+                break;
+
+            case kDeferredArg_Int:
+                if (!DEFERRED_SLOT(8)) return kDeferred_NoRoom;
+                *slotP = (uint64_t) (int64_t) va_arg(args, int);
+                break;
+
+            case kDeferredArg_Long:
+                if (!DEFERRED_SLOT(8)) return kDeferred_NoRoom;
+                *slotP = (uint64_t) (int64_t) va_arg(args, long);
+                break;
+
+            case kDeferredArg_LongLong:
+                if (!DEFERRED_SLOT(8)) return kDeferred_NoRoom;
+                *slotP = (uint64_t) va_arg(args, long long);
+                break;
+
+            case kDeferredArg_IntMax:
+                if (!DEFERRED_SLOT(8)) return kDeferred_NoRoom;
+                *slotP = (uint64_t) va_arg(args, intmax_t);
+                break;
+
+            case kDeferredArg_Size:
+                if (!DEFERRED_SLOT(8)) return kDeferred_NoRoom;
+                *slotP = (uint64_t) va_arg(args, size_t);
+                break;
+
+            case kDeferredArg_PtrDiff:
+                if (!DEFERRED_SLOT(8)) return kDeferred_NoRoom;
+                *slotP = (uint64_t) va_arg(args, ptrdiff_t);
+                break;
+
+            case kDeferredArg_Double:
+                if (!DEFERRED_SLOT(8)) return kDeferred_NoRoom;
+                *(double*) slotP = va_arg(args, double);
+                break;
+
+            case kDeferredArg_LongDouble:
+                if (!DEFERRED_SLOT(16)) return kDeferred_NoRoom;
+                ld = va_arg(args, long double);
+                memcpy(slotP, &ld, sizeof(ld));
+                break;
+
+            case kDeferredArg_Pointer:
+                if (!DEFERRED_SLOT(8)) return kDeferred_NoRoom;
+                *slotP = (uint64_t) (uintptr_t) va_arg(args, void*);
+                break;
+
+            case kDeferredArg_String:
+                if (!DEFERRED_SLOT(8)) return kDeferred_NoRoom;
+                str = va_arg(args, const char*);
+                if (str == NULL)
+                {
+                    *slotP = DEFERRED_NULL_STRING;
+                    break;
+                }
 
-            /* release advisory file lock */
-            memset(&fl, 0, sizeof(fl));
-            fl.l_type = F_UNLCK;
-            if(fcntl(fd, F_SETLKW, &fl)  == -1)
-            {
-                DbgPrint("fcntl return error. code : %s\n", strerror(errno));
-            }
+                // with a precision the string need not be terminated
+                len = (spec.precision >= 0) ? strnlen(str, spec.precision) : strlen(str);
+                *slotP = len;
 
-            close(fd);
+                if (!DEFERRED_SLOT(ASYNC_ALIGN(len + 1))) return kDeferred_NoRoom;
+                memcpy(slotP, str, len);
+                ((char*) slotP)[ len ] = '\0';
+                break;
         }
     }
-    contextP->info.enabledLevel = level;
-    return kPmLogErr_None;
+
+    #undef DEFERRED_SLOT
+
+    return used;
 }
 
 
 /*********************************************************************/
-/* PrvCheckContext */
+/* PrvAsyncEnqueueDeferred */
 /**
-@brief  Validate the context and check whether logging is enabled.
+@brief  Copies a PmLogMsg record with its unformatted arguments into
+        the calling thread's ring.  Returns false if the record has to
+        be formatted synchronously instead.
 **********************************************************************/
-static PmLogErr PrvCheckContext(const PmLogContext_* contextP,
-    PmLogLevel level)
+static bool PrvAsyncEnqueueDeferred(PmLogContext_ *contextP, PmLogLevel level,
+        const char *ptidStr, const char *msgid, size_t kvCount,
+        const char *fmt, va_list args)
 {
-    // context should already have been resolved
-    assert(contextP != NULL);
-
-    if (!PrvIsValidLevel(level))
+    PrvAsyncRing    *ring;
+    PrvAsyncRecord  *recordP;
+    size_t          ptidLen;
+    size_t          msgidLen;
+    size_t          fmtLen;
+    size_t          fixedSize;
+    size_t          contiguous;
+    size_t          available;
+    size_t          room;
+    size_t          padding = 0;
+    ssize_t         argsSize = kDeferred_NoRoom;
+    uint32_t        head;
+    uint32_t        tail;
+    va_list         argsCopy;
+    char            *p;
+
+    ptidLen = strlen(ptidStr);
+    msgidLen = strlen(msgid);
+    fmtLen = strlen(fmt);
+
+    fixedSize = ASYNC_ALIGN(sizeof(PrvAsyncRecord) + ptidLen + 1 + msgidLen + 1 + fmtLen + 1);
+    if ((fixedSize > ASYNC_MAX_RECORD_SIZE) || (ptidLen > UINT16_MAX) || (msgidLen > UINT16_MAX))
     {
-        return kPmLogErr_InvalidLevel;
+        return false;
     }
 
-    if (level > contextP->info.enabledLevel)
+    ring = PrvAsyncBeginEnqueue();
+    if (ring == NULL)
     {
-        return kPmLogErr_LevelDisabled;
+        return false;
     }
 
-    return kPmLogErr_None;
-}
+    head = ring->head;
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
 
+    available = ASYNC_RING_SIZE - (uint32_t) (head - tail);
+    contiguous = ASYNC_RING_SIZE - (head & ASYNC_RING_MASK);
 
-/*********************************************************************/
-/* PrvLogToConsole */
-/**
-@brief  Echos the logged info + message to the output.
-**********************************************************************/
-static void PrvLogToConsole(FILE* out, const char* identStr,
-    const char* ptidStr, const char* componentStr, const char* s)
-{
-    size_t        sLen;
-    const char* endStr;
-
-    sLen = strlen(s);
+    // the size of the arguments is only known once they are copied, so
+    // try at the head first, then at the start of the ring
+    room = MIN(MIN(contiguous, available), ASYNC_MAX_RECORD_SIZE);
+    if (fixedSize <= room)
+    {
+        va_copy(argsCopy, args);
+        argsSize = PrvDeferredCapture(ring->data + (head & ASYNC_RING_MASK) + fixedSize,
+                                      room - fixedSize, fmt, argsCopy);
+        va_end(argsCopy);
+    }
 
-    if ((sLen > 0) && (s[sLen - 1] == '\n'))
+    if ((argsSize == kDeferred_NoRoom) && (contiguous < available))
     {
-        endStr = "";
+        room = MIN(available - contiguous, ASYNC_MAX_RECORD_SIZE);
+        if (fixedSize <= room)
+        {
+            padding = contiguous;
+
+            va_copy(argsCopy, args);
+            argsSize = PrvDeferredCapture(ring->data + fixedSize, room - fixedSize,
+                                          fmt, argsCopy);
+            va_end(argsCopy);
+        }
     }
-    else
+
+    // the record is formatted here and queued as text instead, which
+    // waits for room if needed and so keeps the order of the records
+    if (argsSize < 0)
     {
-        endStr = "\n";
+        PrvAsyncEndEnqueue(ring);
+        return false;
     }
 
-    fprintf(out, "%s%s%s%s%s", identStr, ptidStr, componentStr, s, endStr);
+    if (padding != 0)
+    {
+        recordP = (PrvAsyncRecord*) (ring->data + (head & ASYNC_RING_MASK));
+        recordP->size = padding;
+        recordP->kind = kAsyncRecord_Padding;
+        head += padding;
+    }
+
+    recordP = (PrvAsyncRecord*) (ring->data + (head & ASYNC_RING_MASK));
+    recordP->size = fixedSize + argsSize;
+    recordP->kind = kAsyncRecord_Deferred;
+    recordP->contextP = contextP;
+    recordP->level = level;
+    recordP->ptidLen = ptidLen;
+    recordP->msgidLen = msgidLen;
+    recordP->textLen = fmtLen;
+    recordP->kvCount = kvCount;
+
+    p = (char*) (recordP + 1);
+    memcpy(p, ptidStr, ptidLen + 1);
+    p += ptidLen + 1;
+    memcpy(p, msgid, msgidLen + 1);
+    p += msgidLen + 1;
+    memcpy(p, fmt, fmtLen + 1);
+
+    __atomic_store_n(&ring->head, head + recordP->size, __ATOMIC_SEQ_CST);
+    PrvAsyncEndEnqueue(ring);
+
+    PrvAsyncWakeWriter(false);
+    return true;
 }
 
 
-/***********************************************************************
- * HandleLogLibCommand
- ***********************************************************************/
-static bool HandleLogLibCommand(const char* msg)
+/*********************************************************************/
+/* PrvLogDefer */
+/**
+@brief  Queues a PmLogMsg record for the writer thread to format, if
+        deferred formatting is on.  Returns false if the caller has to
+        format and write it itself.  Repeats are found by comparing
+        the formatted records, so nothing is deferred while repeat
+        coalescing is on.
+**********************************************************************/
+static bool PrvLogDefer(PmLogContext_ *contextP, PmLogLevel level,
+        const char *ptidStr, const char *msgid, size_t kvCount,
+        const char *fmt, va_list args)
 {
-    const char*  kLogLibCmdPrefix    = "!loglib ";
-    const size_t kLogLibCmdPrefixLen = 8;
-    int contextsNumber, contextIndex;
-    PmLogContext  context;
-    PmLogContext_ *contextP;
-    PmLogErr      logErr;
+    bool    deferred = false;
+    int     savedErrNo;
 
-    if (strncmp(msg, kLogLibCmdPrefix, kLogLibCmdPrefixLen) != 0)
+    if (!__atomic_load_n(&gAsync.deferred, __ATOMIC_RELAXED) ||
+        !__atomic_load_n(&gAsync.enabled, __ATOMIC_ACQUIRE) ||
+        (gGlobalsP == NULL) || (gGlobalsP->repeatWindowMs > 0) ||
+        PrvLogNested())
     {
         return false;
     }
 
-    msg += kLogLibCmdPrefixLen;
+    // save and restore errno, so logging doesn't have side effects
+    savedErrNo = errno;
 
-    if (strcmp(msg, "loadconf") == 0)
+    PrvLogEnter();
+
+    // a run left from before coalescing was turned off goes first
+    if (__atomic_load_n(&tRepeat.count, __ATOMIC_RELAXED) != 0)
     {
-        DbgPrint("HandleLogLibCommand: re-loading global config\n");
-        PmLogPrvReadConfigs(parse_json_file);
+        pthread_mutex_lock(&tRepeat.lock);
+        PrvRepeatFlush();
+        pthread_mutex_unlock(&tRepeat.lock);
+    }
 
-        /* updating all context flags that preserved defaults */
-        logErr = PmLogGetNumContexts(&contextsNumber);
-        if (logErr != kPmLogErr_None)
-        {
-            DbgPrint("No contexts found. Error no: %d", logErr);
-            return false;
-        }
-        for (contextIndex = 0; contextIndex < contextsNumber; ++contextIndex)
-        {
-            logErr = PmLogGetIndContext(contextIndex, &context);
-            if(logErr != kPmLogErr_None)
-            {
-                DbgPrint("Context no %d not found. Error no: %d", contextIndex, logErr);
-                continue;
-            }
-            contextP = PrvResolveContext(context);
-            if ((contextP) && (gGlobalContextP) &&
-                !(contextP->info.flags & kPmLogFlag_Overridden))
-            {
-                contextP->info.flags = gGlobalContextP->info.flags;
-            }
-        }
-        return true;
+    if (__atomic_load_n(&gAsync.needRestart, __ATOMIC_ACQUIRE))
+    {
+        PrvAsyncRestart();
+    }
+
+    if (__atomic_load_n(&gAsync.enabled, __ATOMIC_ACQUIRE))
+    {
+        deferred = PrvAsyncEnqueueDeferred(contextP, level, ptidStr, msgid,
+                                           kvCount, fmt, args);
     }
 
-    return false;
+    PrvLogLeave();
+
+    errno = savedErrNo;
+
+    return deferred;
 }
 
+
 /*********************************************************************/
-/* PrvLogWrite */
+/* PrvDeferredAppend */
 /**
-@brief  Logs the specified formatted text to the specified context.
+@brief  Appends len bytes to the BUFFER_LEN sized s, as far as they
+        fit.  *lenP is the length s would have without truncation.
 **********************************************************************/
-static PmLogErr PrvLogWrite(PmLogContext_ *contextP, PmLogLevel level,
-        const char *msgid, const char *s)
+static void PrvDeferredAppend(char *s, size_t *lenP, const char *src, size_t len)
 {
-    const char  *identStr;
-    char        ptidStr[ PIDSTR_LEN ];
-    int         savedErrNo;
-
-    // one character before, 3 after, \0 terminator
-    char        componentStr[ 1 + PMLOG_MAX_CONTEXT_NAME_LEN + 3 +1 ];
-
-    // save and restore errno, so logging doesn't have side effects
-    savedErrNo = errno;
-
-    if (HandleLogLibCommand(s))
+    if (*lenP < BUFFER_LEN - 1)
     {
-        goto Exit;
+        memcpy(s + *lenP, src, MIN(len, BUFFER_LEN - 1 - *lenP));
     }
+    *lenP += len;
+}
 
-    identStr = __progname;
-
-    GetPidStr(contextP, ptidStr, sizeof(ptidStr));
 
-    snprintf(componentStr, sizeof(componentStr), "%s",
-        contextP->component);
+/*********************************************************************/
+/* PrvDeferredRender */
+/**
+@brief  Formats a deferred record into s, which has room for
+        BUFFER_LEN bytes, and validates it the way _PmLogMsgKV does.
+        Returns false if the record must be dropped.  Called from the
+        writer thread only.
+**********************************************************************/
+static bool PrvDeferredRender(const PrvAsyncRecord *recordP, char *s)
+{
+    const char      *ptidStr;
+    const char      *msgid;
+    const char      *fmt;
+    const char      *component = recordP->contextP->component;
+    const uint64_t  *slotP;
+    PrvDeferredSpec spec;
+    PmLogErr        err = kPmLogErr_None;
+    char            specStr[ DEFERRED_MAX_SPEC_LEN ];
+    char            *out;
+    size_t          len = 0;
+    size_t          prefixLen = 0;
+    size_t          room;
+    int             width = 0;
+    int             precision = 0;
+    int             n = 0;
+    long double     ld;
+
+    ptidStr = (const char*) (recordP + 1);
+    msgid = ptidStr + recordP->ptidLen + 1;
+    fmt = msgid + recordP->msgidLen + 1;
+    slotP = (const uint64_t*) ((const char*) recordP +
+            ASYNC_ALIGN(sizeof(PrvAsyncRecord) + recordP->ptidLen + 1 +
+                        recordP->msgidLen + 1 + recordP->textLen + 1));
+
+    if (recordP->kvCount == 0)
+    {
+        PrvDeferredAppend(s, &len, "{} ", 3);
+        prefixLen = len;
+    }
 
-    sigset_t old_set;
-    block_signals(&old_set);
-    syslog(level, "%s %s %s %s %s", ptidStr, PMLOG_IDENTIFIER, componentStr, msgid ? msgid : "", s);
-    unblock_signals(&old_set);
+    // one snprintf per conversion, with the '*' values in front
+    #define DEFERRED_FORMAT(value) \
+        (spec.widthStar ? \
+            (spec.precisionStar ? snprintf(out, room, specStr, width, precision, value) \
+                                : snprintf(out, room, specStr, width, value)) : \
+            (spec.precisionStar ? snprintf(out, room, specStr, precision, value) \
+                                : snprintf(out, room, specStr, value)))
 
-    if (contextP->info.flags & kPmLogFlag_LogToConsole)
+    for (; PrvDeferredNextSpec(fmt, &spec); fmt = spec.start + spec.len)
     {
-        const PmLogConsole* consoleConfP = &gGlobalsP->consoleConf;
+        PrvDeferredAppend(s, &len, fmt, spec.start - fmt);
 
-        if (ptidStr[0] == 0)
-        {
-            mystrcpy(ptidStr, sizeof(ptidStr), ": ");
-        }
+        memcpy(specStr, spec.start, spec.len);
+        specStr[ spec.len ] = '\0';
 
-        if ((level >= consoleConfP->stdErrMinLevel) &&
-            (level <= consoleConfP->stdErrMaxLevel))
+        if (spec.widthStar)
         {
-            PrvLogToConsole(stderr, identStr, ptidStr, componentStr, s);
+            width = (int) *slotP++;
         }
-
-        if ((level >= consoleConfP->stdOutMinLevel) &&
-            (level <= consoleConfP->stdOutMaxLevel))
+        if (spec.precisionStar)
         {
-            PrvLogToConsole(stdout, identStr, ptidStr, componentStr, s);
+            precision = (int) *slotP++;
         }
-    }
 
-Exit:
-    // save and restore errno, so logging doesn't have side effects
-    errno = savedErrNo;
+        // formatted in place as far as it fits, the length is counted
+        // all the same
+        out = s + MIN(len, BUFFER_LEN - 1);
+        room = BUFFER_LEN - MIN(len, BUFFER_LEN - 1);
 
-    return kPmLogErr_None;
-}
+        switch (spec.argType)
+        {
+            case kDeferredArg_None:
+                n = snprintf(out, room, "%%");
+                break;
+
+            case kDeferredArg_Int:
+                n = DEFERRED_FORMAT((int) *slotP++);
+                break;
+
+            case kDeferredArg_Long:
+                n = DEFERRED_FORMAT((long) *slotP++);
+                break;
+
+            case kDeferredArg_LongLong:
+                n = DEFERRED_FORMAT((long long) *slotP++);
+                break;
+
+            case kDeferredArg_IntMax:
+                n = DEFERRED_FORMAT((intmax_t) *slotP++);
+                break;
+
+            case kDeferredArg_Size:
+                n = DEFERRED_FORMAT((size_t) *slotP++);
+                break;
+
+            case kDeferredArg_PtrDiff:
+                n = DEFERRED_FORMAT((ptrdiff_t) *slotP++);
+                break;
+
+            case kDeferredArg_Double:
+                n = DEFERRED_FORMAT(*(const double*) slotP++);
+                break;
+
+            case kDeferredArg_LongDouble:
+                memcpy(&ld, slotP, sizeof(ld));
+                slotP += 2;
+                n = DEFERRED_FORMAT(ld);
+                break;
+
+            case kDeferredArg_Pointer:
+                n = DEFERRED_FORMAT((void*) (uintptr_t) *slotP++);
+                break;
+
+            case kDeferredArg_String:
+                if (*slotP == DEFERRED_NULL_STRING)
+                {
+                    slotP++;
+                    n = DEFERRED_FORMAT((const char*) NULL);
+                }
+                else
+                {
+                    n = DEFERRED_FORMAT((const char*) (slotP + 1));
+                    slotP += 1 + ASYNC_ALIGN(*slotP + 1) / 8;
+                }
+                break;
+        }
 
-static bool validate_json_string(const char* kvpairs, PmLogErr *logErr, const bool with_tailing)
-{
+        len += (n > 0) ? n : 0;
+    }
 
-//! This macro can be defined to restrict logging
-//! to whitelist logs
-#ifndef ENABLE_WHITELIST
-    JSchemaInfo  schemaInfo;
+    #undef DEFERRED_FORMAT
 
-    const char *ptr_kvpairs = kvpairs;
-    char json_str[BUFFER_LEN] = {0, };
-    int next_brace_pos = 0;
-    int previous_pos = 0;
-    char *search_str = NULL;
-    int move_index = 0;
+    PrvDeferredAppend(s, &len, fmt, strlen(fmt));
+    s[ MIN(len, BUFFER_LEN - 1) ] = '\0';
 
-    if (with_tailing) {
-        search_str = "} ";
-        move_index = 2;
-    }
-    else {
-        search_str = "}";
-        move_index = 1;
+    if (len - prefixLen >= BUFFER_LEN)
+    {
+        gchar *escaped_str = strtruncate_and_escape(s + prefixLen);
+        WarnPrint(component, ptidStr,
+                  "MSG_TRUNCATED {\"MSGID\":\"%s\",\"CAUSE\":\"Log message exceeded 1024 bytes\",\"TRUNCATED_MSG\":\"%s ...\"}",
+                  msgid, escaped_str);
+        g_free(escaped_str);
+        PrvCountersTruncated(recordP->contextP);
     }
 
-    // split json string and freetext until parsing is successful
-    while (ptr_kvpairs != NULL)
+    if ((recordP->level != kPmLogLevel_Debug) && (recordP->kvCount != 0) &&
+        !validate_json_string(s, BUFFER_LEN, &err, true))
     {
-        ptr_kvpairs = strstr(ptr_kvpairs, search_str);
-        if (!ptr_kvpairs)
-        {
-            return false;
-        }
-
-        next_brace_pos = ptr_kvpairs - kvpairs + move_index; // index after closing curly braces
-
-        // To prevent buffer overflowing
-        if (next_brace_pos > sizeof(json_str) - 1)
-        {
-            *logErr = kPmLogErr_TooMuchData;
-            return false;
-        }
-
-        // copy memory for spaces
-        memcpy(json_str + previous_pos, kvpairs + previous_pos, next_brace_pos - previous_pos);
+        gchar *escaped_str = strtruncate_and_escape(s);
 
-        jschema_info_init(&schemaInfo, jschema_all(), NULL, NULL);
-        if(jsax_parse(NULL, j_cstr_to_buffer(json_str), &schemaInfo))
-        {
-            return true;
-        }
+        ErrPrint(component, ptidStr,
+                 "INVALID_JSON {\"MSGID\":\"%s\", \"CAUSE\":\"%s\",\"JSON\":\"%s ...\"}",
+                 msgid, (err == kPmLogErr_TooMuchData) ?
+                        "The json string exceeded 1024 bytes." : "The json string is wrong.",
+                 escaped_str);
 
-        // move 2 pointers to find next "} "
-        ptr_kvpairs += move_index;
+        g_free(escaped_str);
+        PrvCountersCountErr(recordP->contextP, kPmLogErr_InvalidFormat);
+        return false;
     }
-    return false;
-#else
+
     return true;
-#endif
 }
 
+
 /*********************************************************************/
-/* PmLogString_ */
+/* PrvLogString */
 /**
 @brief  Logs the specified string of kv pairs and free text to the
         specified context.
 **********************************************************************/
-PmLogErr PmLogString_(PmLogContext context, PmLogLevel level,
-        const char* msgid, const char* kvpairs, const char* message)
+static PmLogErr PrvLogString(PmLogContext_ *contextP, PmLogLevel level,
+        const char* msgid, const char* kvpairs, const char* message,
+        PrvMsgBuffer *buffer)
 {
-    PmLogContext_*  contextP;
     PmLogErr        logErr;
-    char            lineStr[BUFFER_LEN] = {0,};
     int             ret;
     char            ptidStr[PIDSTR_LEN];
     const char      *ptr_msgid = msgid;
+    uint32_t        weight;
 
-    contextP = PrvResolveContext(context);
-    if (!contextP) {
-        return kPmLogErr_InvalidContext;
+    weight = PrvSampleAdmit(contextP, msgid);
+    if (weight == 0) {
+        return kPmLogErr_None;
     }
 
-    logErr = PrvCheckContext(contextP, level);
+    GetPidStr(contextP, ptidStr, sizeof(ptidStr));
+
+    // drop flooding records before doing any work on them
+    logErr = PrvRateLimitAdmit(contextP, ptidStr, msgid);
     if (logErr != kPmLogErr_None) {
         return logErr;
     }
 
-    GetPidStr(contextP, ptidStr, sizeof(ptidStr));
-
     if (level != kPmLogLevel_Debug) {
         logErr = validate_msgid(msgid, contextP);
         if (kPmLogErr_InvalidMsgID == logErr) {
@@ -2233,13 +7756,13 @@ PmLogErr PmLogString_(PmLogContext context, PmLogLevel level,
         }
 
         if (kvpairs) {
-            if (!validate_json_string(kvpairs, &logErr, false)) {
+            if (!validate_json_string(kvpairs, buffer->maxSize, &logErr, false)) {
                 gchar *err_str = NULL;
                 gchar *escaped_str = strtruncate_and_escape(kvpairs);
 
                 if (logErr == kPmLogErr_TooMuchData)
                 {
-                    err_str = "The json string exceeded 1024 bytes.";
+                    err_str = "The json string exceeded the maximum message size.";
                 }
                 else
                 {
@@ -2276,21 +7799,22 @@ PmLogErr PmLogString_(PmLogContext context, PmLogLevel level,
         ptr_msgid = DEBUG_MSG_ID;
     }
 
-    ret = snprintf(lineStr, sizeof(lineStr), "%s %s",
-                   kvpairs ? kvpairs : "{}",
-                   message ? message : "");
+    ret = PrvMsgBufferFormat(buffer, 0, "%s %s",
+                             kvpairs ? kvpairs : "{}",
+                             message ? message : "");
     if (ret < 0) {
         ErrPrint(contextP->component, ptidStr, "SNPRINTF_ERR {\"MSGID\":\"%s\",\"ERROR\":\"%s\"}",
                  msgid, strerror(errno));
         return kPmLogErr_FormatStringFailed;
     } else {
-        if (ret >= sizeof(lineStr)) {
+        if (ret >= buffer->size) {
             DbgPrint("snprintf truncation\n");
+            PrvCountersTruncated(contextP);
         }
     }
 
     if (kPmLogErr_EmptyMsgID == logErr) {
-        gchar *escaped_str = strtruncate_and_escape(lineStr);
+        gchar *escaped_str = strtruncate_and_escape(buffer->str);
         ErrPrint(contextP->component, ptidStr,
                  "EMPTY_MSGID {\"MESSAGE\":\"%s ...\"} MSGID must not be empty",
                  escaped_str);
@@ -2298,7 +7822,43 @@ PmLogErr PmLogString_(PmLogContext context, PmLogLevel level,
         return kPmLogErr_InvalidFormat;
     }
 
-    return PrvLogWrite(contextP, level, ptr_msgid, lineStr);
+    PrvSampleTag(buffer->str, buffer->size, weight);
+
+    return PrvLogWrite(contextP, level, ptr_msgid, buffer->str);
+}
+
+/*********************************************************************/
+/* PmLogString_ */
+/**
+@brief  Logs the specified string of kv pairs and free text to the
+        specified context.
+**********************************************************************/
+PmLogErr PmLogString_(PmLogContext context, PmLogLevel level,
+        const char* msgid, const char* kvpairs, const char* message)
+{
+    PmLogContext_*  contextP;
+    PmLogErr        logErr;
+    uint64_t        start = PrvLatencyStart();
+    char            fallback[ BUFFER_LEN ];
+    PrvMsgBuffer    buffer;
+
+    contextP = PrvResolveContext(context);
+    if (!contextP) {
+        return kPmLogErr_InvalidContext;
+    }
+
+    logErr = PrvCheckContext(contextP, level);
+    if (logErr == kPmLogErr_None) {
+        PrvMsgBufferInit(&buffer, contextP, fallback, sizeof(fallback));
+        logErr = PrvLogString(contextP, level, msgid, kvpairs, message, &buffer);
+        PrvMsgBufferRelease(&buffer);
+    }
+
+    PrvCountersCountErr(contextP, logErr);
+
+    PrvLatencyRecord(kPmLogLatency_String, start);
+
+    return logErr;
 }
 
 /*********************************************************************/
@@ -2309,10 +7869,11 @@ PmLogErr PmLogString_(PmLogContext context, PmLogLevel level,
 static PmLogErr PrvLogVPrint(PmLogContext_* contextP, PmLogLevel level,
     const char* fmt, va_list args)
 {
-    PmLogErr  logErr;
-    char      lineStr[BUFFER_LEN];
-    int       n;
-    char      ptidStr[ PIDSTR_LEN ];
+    PmLogErr      logErr;
+    char          fallback[ BUFFER_LEN ];
+    PrvMsgBuffer  buffer;
+    int           n;
+    char          ptidStr[ PIDSTR_LEN ];
 
     GetPidStr(contextP, ptidStr, sizeof(ptidStr));
 
@@ -2321,7 +7882,9 @@ static PmLogErr PrvLogVPrint(PmLogContext_* contextP, PmLogLevel level,
         return kPmLogErr_InvalidFormat;
     }
 
-    n = vsnprintf(lineStr, sizeof(lineStr), fmt, args);
+    PrvMsgBufferInit(&buffer, contextP, fallback, sizeof(fallback));
+
+    n = PrvMsgBufferVFormat(&buffer, 0, fmt, args);
     if (n < 0)
     {
         // Deprecated function .....
@@ -2330,18 +7893,73 @@ static PmLogErr PrvLogVPrint(PmLogContext_* contextP, PmLogLevel level,
     }
     else
     {
-        if (n >= sizeof(lineStr))
+        if (n >= buffer.size)
         {
             DbgPrint("vsnprintf truncation\n");
+            PrvCountersTruncated(contextP);
         }
 
-        logErr = PrvLogWrite(contextP, level, NULL, lineStr);
+        logErr = PrvLogWrite(contextP, level, NULL, buffer.str);
     }
 
+    PrvMsgBufferRelease(&buffer);
+
     return logErr;
 }
 
 
+/***********************************************************************
+ * gLegacy
+ *
+ * The legacy print APIs log to the LEGACY_LOG context.  It is resolved
+ * once per process: contexts in the shared table are only ever
+ * appended, never moved or removed, and the table stays mapped at the
+ * same address for the life of the process (forked children included).
+ * A failed lookup is final too, since it means the table is full or
+ * the globals were never mapped.
+ ***********************************************************************/
+static struct
+{
+    pthread_once_t  once;
+    PmLogContext    context;    /* NULL if it could not be resolved */
+}
+gLegacy = { .once = PTHREAD_ONCE_INIT, .context = NULL };
+
+
+/*********************************************************************/
+/* PrvInitLegacyContext */
+/**
+@brief  pthread_once routine resolving the LEGACY_LOG context.
+**********************************************************************/
+static void PrvInitLegacyContext(void)
+{
+    PmLogContext    context;
+    PmLogErr        logErr;
+
+    logErr = PmLogGetContext(LEGACY_LOG, &context);
+    if (logErr != kPmLogErr_None) {
+        DbgPrint("%s: PmLogGetContext err %d", __func__, logErr);
+        return;
+    }
+
+    gLegacy.context = context;
+}
+
+
+/*********************************************************************/
+/* PrvGetLegacyContext */
+/**
+@brief  Returns the LEGACY_LOG context, or the given context if it
+        couldn't be resolved.
+**********************************************************************/
+static inline PmLogContext PrvGetLegacyContext(PmLogContext context)
+{
+    (void) pthread_once(&gLegacy.once, PrvInitLegacyContext);
+
+    return (gLegacy.context != NULL) ? gLegacy.context : context;
+}
+
+
 /*********************************************************************/
 /* PmLogPrint_ */
 /**
@@ -2354,14 +7972,7 @@ PmLogErr PmLogPrint_(PmLogContext context, PmLogLevel level,
     PmLogErr    logErr;
     va_list     args;
 
-    PmLogContext forced_context = context;
-    logErr = PmLogGetContext(LEGACY_LOG, &forced_context);
-    if (logErr != kPmLogErr_None) {
-        forced_context = context;
-        DbgPrint("%s: PmLogGetContext err %d", __func__, logErr);
-    }
-
-    contextP = PrvResolveContext(forced_context);
+    contextP = PrvResolveContext(PrvGetLegacyContext(context));
     if (contextP == NULL)
     {
         return kPmLogErr_InvalidContext;
@@ -2461,33 +8072,35 @@ static bool validate_format(const unsigned int flags, const size_t kv_count, con
 #endif
 }
 
-PmLogErr _PmLogMsgKV(PmLogContext context, PmLogLevel level, unsigned int flags,
-                     const char *msgid, size_t kv_count, const char *check_keywords,
-                     const char *check_formats, const char *fmt, ...)
+static PmLogErr PrvLogMsgKV(PmLogContext_ *context_ptr, PmLogLevel level, unsigned int flags,
+                            const char *msgid, size_t kv_count, const char *check_keywords,
+                            const char *check_formats, const char *fmt, va_list args,
+                            PrvMsgBuffer *buffer, bool escapeCut)
 {
-    PmLogContext_  *context_ptr;
     PmLogErr       err;
-    va_list        args;
+    va_list        args_copy;
     int            ret;
-    char           final_str[BUFFER_LEN] = {0, };
-    char           *ptr_final_str = final_str;
+    char           *final_str;
+    char           *ptr_final_str;
     const char*    empty_kv_pair_str = "{} ";
     const char     *ptr_msgid = msgid;
     char           ptidStr[ PIDSTR_LEN ];
     int            empty_kv_pair_size = 0;
+    uint32_t       weight;
 
-    context_ptr = PrvResolveContext(context);
-    if (!context_ptr) {
-        return kPmLogErr_InvalidContext;
+    weight = PrvSampleAdmit(context_ptr, msgid);
+    if (0 == weight) {
+        return kPmLogErr_None;
     }
 
-    err = PrvCheckContext(context_ptr, level);
+    GetPidStr(context_ptr, ptidStr, sizeof(ptidStr));
+
+    // drop flooding records before doing any work on them
+    err = PrvRateLimitAdmit(context_ptr, ptidStr, msgid);
     if (kPmLogErr_None != err) {
         return err;
     }
 
-    GetPidStr(context_ptr, ptidStr, sizeof(ptidStr));
-
     if (kPmLogLevel_Debug != level) {
 
         err = validate_msgid(msgid, context_ptr);
@@ -2495,7 +8108,9 @@ PmLogErr _PmLogMsgKV(PmLogContext context, PmLogLevel level, unsigned int flags,
             return err;
         }
 
-        if (kv_count) {
+        // the PmLogMsg macros check literal keys and formats at build
+        // time where they can (see _PmLogMsgFlags in PmLogLib.h)
+        if (kv_count && !(flags & kPmLogValidateFormatFlag_PreValidated)) {
             // make sure number of keys received matches with
             // kv_count
             if (!validate_keys(kv_count, check_keywords, context_ptr->component, msgid)) {
@@ -2529,27 +8144,51 @@ PmLogErr _PmLogMsgKV(PmLogContext context, PmLogLevel level, unsigned int flags,
         ptr_msgid = DEBUG_MSG_ID;
     }
 
+    if (escapeCut) {
+        WarnPrint(context_ptr->component, ptidStr,
+                  "MSG_TRUNCATED {\"MSGID\":\"%s\",\"CAUSE\":\"Escaped value exceeded %d bytes\"}",
+                  msgid ? msgid : "NULL", BUFFER_LEN - 1);
+        PrvCountersTruncated(context_ptr);
+    }
+
+    // leave the formatting to the writer thread if asked to, unless
+    // the weight of a sampled record has to be added to it, or the
+    // message may be longer than the writer's buffer
+    if ((kPmLogErr_EmptyMsgID != err) && (weight <= 1) && (buffer->maxSize <= BUFFER_LEN)) {
+        va_copy(args_copy, args);
+        ret = PrvLogDefer(context_ptr, level, ptidStr, ptr_msgid, kv_count, fmt, args_copy);
+        va_end(args_copy);
+        if (ret) {
+            return kPmLogErr_None;
+        }
+    }
+
     if (kv_count == 0) {
         // Add "{} " when kv_count comes 0 or level is debug
-        snprintf(ptr_final_str, sizeof(final_str), "%s", empty_kv_pair_str);
         empty_kv_pair_size = strlen(empty_kv_pair_str);
-        ptr_final_str += empty_kv_pair_size;
     }
 
-    va_start(args, fmt);
-    ret = vsnprintf(ptr_final_str, sizeof(final_str) - empty_kv_pair_size, fmt, args);
-    va_end(args);
+    ret = PrvMsgBufferVFormat(buffer, empty_kv_pair_size, fmt, args);
+
+    // the buffer may have moved while growing
+    final_str = buffer->str;
+    memcpy(final_str, empty_kv_pair_str, empty_kv_pair_size);
+    ptr_final_str = final_str + empty_kv_pair_size;
+
     if (ret < 0) {
         ErrPrint(context_ptr->component, ptidStr, "VSNPRN_ERR {\"MSGID\":\"%s\",\"ERR_STR\":\"%s\"}",
                  msgid ? msgid : "NULL",
                  strerror(errno));
         return kPmLogErr_FormatStringFailed;
-    } else if (ret >= sizeof(final_str)) {
+    } else if (ret >= buffer->size - empty_kv_pair_size) {
         gchar *escaped_str = strtruncate_and_escape(ptr_final_str);
         WarnPrint(context_ptr->component, ptidStr,
-                  "MSG_TRUNCATED {\"MSGID\":\"%s\",\"CAUSE\":\"Log message exceeded 1024 bytes\",\"TRUNCATED_MSG\":\"%s ...\"}",
-                  msgid ? msgid : "NULL", escaped_str);
+                  "MSG_TRUNCATED {\"MSGID\":\"%s\",\"CAUSE\":\"Log message exceeded %zu bytes\",\"TRUNCATED_MSG\":\"%s ...\"}",
+                  msgid ? msgid : "NULL", buffer->size, escaped_str);
         g_free(escaped_str);
+        if (!escapeCut) {
+            PrvCountersTruncated(context_ptr);
+        }
     }
 
 
@@ -2565,13 +8204,13 @@ PmLogErr _PmLogMsgKV(PmLogContext context, PmLogLevel level, unsigned int flags,
     if (kPmLogLevel_Debug != level) {
         // validate key-value pairs string is valid json data
         if (kv_count != 0) {
-            if (!validate_json_string(final_str, &err, true)) {
+            if (!validate_json_string(final_str, buffer->size, &err, true)) {
                 char *err_str = NULL;
                 gchar *escaped_str = strtruncate_and_escape(final_str);
 
                 if (err == kPmLogErr_TooMuchData)
                 {
-                    err_str = "The json string exceeded 1024 bytes.";
+                    err_str = "The json string exceeded the maximum message size.";
                 }
                 else
                 {
@@ -2588,9 +8227,50 @@ PmLogErr _PmLogMsgKV(PmLogContext context, PmLogLevel level, unsigned int flags,
         }
     }
 
+    PrvSampleTag(final_str, buffer->size, weight);
+
     return PrvLogWrite(context_ptr, level, ptr_msgid, final_str);
 }
 
+PmLogErr _PmLogMsgKV(PmLogContext context, PmLogLevel level, unsigned int flags,
+                     const char *msgid, size_t kv_count, const char *check_keywords,
+                     const char *check_formats, const char *fmt, ...)
+{
+    PmLogContext_  *context_ptr;
+    PmLogErr       err;
+    va_list        args;
+    uint64_t       start = PrvLatencyStart();
+    char           fallback[ BUFFER_LEN ];
+    PrvMsgBuffer   buffer;
+    bool           escapeCut = tEscapeCut;
+
+    // the PMLOGKS_ESC arguments of this call have been escaped by now
+    tEscapeCut = false;
+
+    context_ptr = PrvResolveContext(context);
+    if (!context_ptr) {
+        return kPmLogErr_InvalidContext;
+    }
+
+    err = PrvCheckContext(context_ptr, level);
+    if (kPmLogErr_None == err) {
+        PrvMsgBufferInit(&buffer, context_ptr, fallback, sizeof(fallback));
+
+        va_start(args, fmt);
+        err = PrvLogMsgKV(context_ptr, level, flags, msgid, kv_count, check_keywords,
+                          check_formats, fmt, args, &buffer, escapeCut);
+        va_end(args);
+
+        PrvMsgBufferRelease(&buffer);
+    }
+
+    PrvCountersCountErr(context_ptr, err);
+
+    PrvLatencyRecord(kPmLogLatency_MsgKV, start);
+
+    return err;
+}
+
 /*********************************************************************/
 /* PmLogVPrint_ */
 /**
@@ -2612,14 +8292,7 @@ PmLogErr PmLogVPrint_(PmLogContext context, PmLogLevel level,
     PmLogContext_*    contextP;
     PmLogErr    logErr;
 
-        PmLogContext forced_context = context;
-        logErr = PmLogGetContext(LEGACY_LOG, &forced_context);
-        if (logErr != kPmLogErr_None) {
-                forced_context = context;
-                DbgPrint("%s: PmLogGetContext err %d", __func__, logErr);
-        }
-
-        contextP = PrvResolveContext(forced_context);
+    contextP = PrvResolveContext(PrvGetLegacyContext(context));
     if (contextP == NULL)
     {
         return kPmLogErr_InvalidContext;
@@ -2824,6 +8497,7 @@ const char* PmLogGetErrDbgString(PmLogErr logErr)
         /*  15 */ DEFINE_ERR_STR( InvalidMsgID );
         /*  16 */ DEFINE_ERR_STR( EmptyMsgID );
         /*  17 */ DEFINE_ERR_STR( LoggingDisabled );
+        /*  18 */ DEFINE_ERR_STR( RateLimited );
         //---------------------------------------------
         /* 999 */ DEFINE_ERR_STR( Unknown );
     }
@@ -2855,6 +8529,79 @@ static PmLogErr PmLogPrvTestReadMem(void* data)
 }
 
 
+/*********************************************************************/
+/* PmLogPrvTestSetSyslogPath */
+/**
+@brief  Sends the records of this process to the datagram socket at
+        the given path instead of /dev/log, e.g. to a stand-in for
+        syslogd in benchmarks.
+**********************************************************************/
+static PmLogErr PmLogPrvTestSetSyslogPath(void* data)
+{
+    const char* path = (const char*) data;
+
+    if ((path == NULL) || (strlen(path) >= sizeof(gSyslog.path)))
+    {
+        return kPmLogErr_InvalidParameter;
+    }
+
+    pthread_mutex_lock(&gSyslog.lock);
+
+    mystrcpy(gSyslog.path, sizeof(gSyslog.path), path);
+    gSyslog.nextRetry = 0;
+
+    // an open socket is reconnected in place to the new path
+    if (gSyslog.fd != -1)
+    {
+        (void) PrvSyslogConnect();
+    }
+
+    pthread_mutex_unlock(&gSyslog.lock);
+
+    return kPmLogErr_None;
+}
+
+
+/*********************************************************************/
+/* PmLogPrvTestRingBadEntry */
+/**
+@brief  Publishes an entry of size 0 in the ring of this process, so
+        a check can see how the reader deals with a bad producer.
+**********************************************************************/
+static PmLogErr PmLogPrvTestRingBadEntry(void* data)
+{
+    PrvRingHeader   *header = gRing.header;
+    PrvRingEntry    *entryP;
+    uint64_t        head;
+    size_t          size = RING_ALIGN(sizeof(PrvRingEntry) + 1);
+
+    (void) data;
+
+    if (header == NULL)
+    {
+        return kPmLogErr_NoData;
+    }
+
+    head = __atomic_load_n(&header->head, __ATOMIC_RELAXED);
+    do
+    {
+        if ((header->size - (head & (header->size - 1)) < size) ||
+            (head + size - __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE) > header->size))
+        {
+            return kPmLogErr_Unknown;
+        }
+    }
+    while (!__atomic_compare_exchange_n(&header->head, &head, head + size,
+                                        true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    entryP = (PrvRingEntry*) (header->data + (head & (header->size - 1)));
+    entryP->size = 0;
+    __atomic_store_n(&entryP->state, kRingEntry_Record, __ATOMIC_SEQ_CST);
+
+    return kPmLogErr_None;
+}
+
+
 /*********************************************************************/
 /* PmLogPrvTest */
 /**
@@ -2868,5 +8615,15 @@ PmLogErr PmLogPrvTest(const char* cmd, void* data)
         return PmLogPrvTestReadMem(data);
     }
 
+    if (strcmp(cmd, "SetSyslogPath") == 0)
+    {
+        return PmLogPrvTestSetSyslogPath(data);
+    }
+
+    if (strcmp(cmd, "RingBadEntry") == 0)
+    {
+        return PmLogPrvTestRingBadEntry(data);
+    }
+
     return kPmLogErr_InvalidParameter;
 }